@@ -576,8 +576,12 @@ class Pv(pyca.capv):
         if not self.isconnected and not self.connect(DEFAULT_TIMEOUT):
             raise pyca.pyexc("get: connection timedout for PV %s" % self.name)
 
-        with utils.TimeoutSem(self.__pyca_sem, tmo):
+        if self.sync_callback:
+            # Blocking gets only wait on their own request in this mode
             self.get_data(ctrl, tmo, count)
+        else:
+            with utils.TimeoutSem(self.__pyca_sem, tmo):
+                self.get_data(ctrl, tmo, count)
 
         if tmo > 0 and DEBUG != 0:
             logprint("got %s\n" % self.value.__str__())
@@ -588,6 +592,10 @@ class Pv(pyca.capv):
 
         if as_string:
             if self.type() == 'DBF_ENUM':
+                # Converted by pyca when the enum strings are cached
+                enum_str = self.data.get('enum_str')
+                if enum_str is not None:
+                    return enum_str
                 enums = self.get_enum_set(timeout=tmo)
                 if len(enums) > self.value >= 0:
                     return enums[self.value]
@@ -641,8 +649,11 @@ class Pv(pyca.capv):
 
             self.wait_ready(DEFAULT_TIMEOUT * 2)
 
-        with utils.TimeoutSem(self.__pyca_sem, tmo):
+        if self.sync_callback:
             self.put_data(value, tmo)
+        else:
+            with utils.TimeoutSem(self.__pyca_sem, tmo):
+                self.put_data(value, tmo)
 
         return value
 
@@ -653,7 +664,8 @@ class Pv(pyca.capv):
         Since this information usually only changes when an IOC is remade, it
         is only necessary to get this information once. After the first call,
         the tuple is stored in the dictionary :attr:`data` and accessible via
-        the property :attr:`enum_set`
+        the property :attr:`enum_set`. pyca also caches it until the PV
+        reconnects, so later calls do not ask the IOC again
 
         Parameters
         ----------
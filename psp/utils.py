@@ -27,6 +27,24 @@ def set_numpy(use_numpy):
     pyca.set_numpy(use_numpy)
 
 
+def set_sync_callback(sync_callback):
+    """
+    The choice to have blocking gets and puts wait on their own request
+
+    By default a blocking get or put waits in ca_pend_io, which waits for
+    all the outstanding requests of the context, so concurrent threads end
+    up waiting on each other. When enabled, each request is issued with a
+    completion callback and the caller waits only for its own reply. PVs
+    created afterwards use this setting.
+
+    Parameters
+    ----------
+    sync_callback: bool
+        True means blocking requests wait on their own completion
+    """
+    pyca.set_sync_callback(sync_callback)
+
+
 def ensure_context():
     """
     Let pyca create/attach context if needed. This is important if we're using
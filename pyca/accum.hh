@@ -0,0 +1,122 @@
+#include "p3compat.h"
+// Running statistics of the monitor events of a PV.
+//
+// The monitor handlers update, in the CA thread and without the GIL,
+// the count and per element mean, sum of squared deviations (Welford's
+// algorithm), minimum and maximum of the values, so averaging does not
+// require to keep or even decode every sample in Python.
+
+struct pyca_accum {
+  pthread_mutex_t lock;
+  int active;           // accumulating
+  long nelm;            // elements of the accumulated values
+  unsigned long count;  // accumulated samples
+  double* mean;
+  double* m2;           // sum of squared deviations from the mean
+  double* min;
+  double* max;
+};
+
+static pyca_accum* pyca_accum_new()
+{
+  pyca_accum* accum = new pyca_accum;
+  pthread_mutex_init(&accum->lock, NULL);
+  accum->active = 0;
+  accum->nelm = 0;
+  accum->count = 0;
+  accum->mean = 0;
+  accum->m2 = 0;
+  accum->min = 0;
+  accum->max = 0;
+  return accum;
+}
+
+static void pyca_accum_free_arrays(pyca_accum* accum)
+{
+  delete [] accum->mean;
+  delete [] accum->m2;
+  delete [] accum->min;
+  delete [] accum->max;
+  accum->mean = accum->m2 = accum->min = accum->max = 0;
+  accum->nelm = 0;
+}
+
+// Welford update of every element, written as plain loops over
+// contiguous arrays so that the compiler can vectorize them
+template<class T> static inline
+void pyca_accum_add(pyca_accum* accum, const T* values)
+{
+  long nelm = accum->nelm;
+  double* mean = accum->mean;
+  double* m2 = accum->m2;
+  double* min = accum->min;
+  double* max = accum->max;
+  if (accum->count == 0) {
+    for (long i=0; i<nelm; i++) {
+      double x = values[i];
+      mean[i] = x;
+      m2[i] = 0;
+      min[i] = x;
+      max[i] = x;
+    }
+  } else {
+    double inv = 1.0 / (accum->count + 1);
+    for (long i=0; i<nelm; i++) {
+      double x = values[i];
+      double delta = x - mean[i];
+      mean[i] += delta * inv;
+      m2[i] += delta * (x - mean[i]);
+      min[i] = x < min[i] ? x : min[i];
+      max[i] = x > max[i] ? x : max[i];
+    }
+  }
+  accum->count++;
+}
+
+// Accumulate a monitor event. Called by the CA thread without the GIL.
+static void pyca_accum_record(pyca_accum* accum, struct event_handler_args& args)
+{
+  if (args.status != ECA_NORMAL || !args.dbr) {
+    return;
+  }
+  pthread_mutex_lock(&accum->lock);
+  if (!accum->active) {
+    pthread_mutex_unlock(&accum->lock);
+    return;
+  }
+  if (accum->nelm != args.count) {
+    // A new element count restarts the statistics
+    pyca_accum_free_arrays(accum);
+    accum->nelm = args.count;
+    accum->count = 0;
+    accum->mean = new double[args.count];
+    accum->m2 = new double[args.count];
+    accum->min = new double[args.count];
+    accum->max = new double[args.count];
+  }
+  const void* value = dbr_value_ptr(args.dbr, args.type);
+  switch (args.type % (LAST_TYPE+1)) {
+  case DBR_ENUM:
+    pyca_accum_add(accum, reinterpret_cast<const dbr_enum_t*>(value));
+    break;
+  case DBR_CHAR:
+    pyca_accum_add(accum, reinterpret_cast<const dbr_char_t*>(value));
+    break;
+  case DBR_SHORT:
+    pyca_accum_add(accum, reinterpret_cast<const dbr_short_t*>(value));
+    break;
+  case DBR_LONG:
+    pyca_accum_add(accum, reinterpret_cast<const dbr_long_t*>(value));
+    break;
+  case DBR_FLOAT:
+    pyca_accum_add(accum, reinterpret_cast<const dbr_float_t*>(value));
+    break;
+  case DBR_DOUBLE:
+    pyca_accum_add(accum, reinterpret_cast<const dbr_double_t*>(value));
+    break;
+  default:
+    // Strings have no statistics
+    break;
+  }
+  pthread_mutex_unlock(&accum->lock);
+}
@@ -0,0 +1,431 @@
+#include "p3compat.h"
+// asyncio support: gets, puts and monitor updates as awaitables.
+//
+// Every asyncio event loop using pyca gets a notifier whose descriptor
+// the loop watches with add_reader(). The CA thread completes requests
+// without the GIL: it copies the reply, posts the request on the
+// notifier of its loop and, for the first one of a batch, wakes the
+// loop up. The loop then decodes all the completed requests and
+// resolves their futures under a single GIL acquisition. Requests
+// issued during one iteration of the loop are flushed together by a
+// single ca_flush_io() scheduled with call_soon().
+
+enum pyca_async_kind {
+  PYCA_ASYNC_GET,
+  PYCA_ASYNC_PUT,
+  PYCA_ASYNC_MONITOR
+};
+
+struct pyca_loop {
+  pyca_notifier* notifier;
+  PyObject* loop;       // asyncio event loop
+  PyObject* dispatch;   // reader of the notifier descriptor
+  PyObject* flush;      // flushes the requests of an iteration
+  long inflight;        // requests and subscriptions not finished yet
+  int flushing;         // flush is scheduled
+  int dispatching;      // completing requests
+};
+
+struct pyca_async_op {
+  pyca_notice notice;   // first, notices are cast back to requests
+  int kind;
+  capv* pv;             // owns a reference
+  pyca_loop* loop;
+  PyObject* future;     // result of the request, or update awaited
+  int status;
+  short dbr_type;       // reply of a get
+  long count;
+  char* buffer;
+  std::atomic<int> posted;  // on the notifier list, or was for gets and puts
+  int closed;           // monitor subscription cleared
+  int refs;             // monitor: iterator and subscription
+  pyca_async_op* prevop;    // gets and puts in flight for pv
+  pyca_async_op* nextop;
+};
+
+// Event loops in use, mapped to capsules of their pyca_loop
+static PyObject* pyca_async_loops = 0;
+static PyObject* pyca_asyncio = 0;
+
+static PyObject* pyca_loop_dispatch(PyObject* self, PyObject*);
+static PyObject* pyca_loop_flush(PyObject* self, PyObject*);
+
+static PyMethodDef pyca_loop_dispatch_def = {
+  "_dispatch", pyca_loop_dispatch, METH_NOARGS, NULL
+};
+static PyMethodDef pyca_loop_flush_def = {
+  "_flush", pyca_loop_flush, METH_NOARGS, NULL
+};
+
+static pyca_loop* _pyca_loop_of(PyObject* capsule)
+{
+  return reinterpret_cast<pyca_loop*>(PyCapsule_GetPointer(capsule, "pyca.loop"));
+}
+
+// State of the running event loop, created and registered with the loop
+// on first use. Returns NULL with an exception if no loop is running.
+static pyca_loop* _pyca_loop_get()
+{
+  if (!pyca_asyncio) {
+    pyca_asyncio = PyImport_ImportModule("asyncio");
+    if (!pyca_asyncio) {
+      return NULL;
+    }
+    pyca_async_loops = PyDict_New();
+    if (!pyca_async_loops) {
+      Py_CLEAR(pyca_asyncio);
+      return NULL;
+    }
+  }
+  PyObject* loop = PyObject_CallMethod(pyca_asyncio, (char*)"get_running_loop", NULL);
+  if (!loop) {
+    return NULL;
+  }
+  PyObject* capsule = PyDict_GetItem(pyca_async_loops, loop);
+  if (capsule) {
+    Py_DECREF(loop);
+    return _pyca_loop_of(capsule);
+  }
+  pyca_notifier* notifier = pyca_notifier_new();
+  if (!notifier) {
+    Py_DECREF(loop);
+    PyErr_SetFromErrno(PyExc_OSError);
+    return NULL;
+  }
+  pyca_loop* pl = new pyca_loop;
+  pl->notifier = notifier;
+  pl->loop = loop;
+  pl->inflight = 0;
+  pl->flushing = 0;
+  pl->dispatching = 0;
+  capsule = PyCapsule_New(pl, "pyca.loop", NULL);
+  pl->dispatch = capsule ? PyCFunction_New(&pyca_loop_dispatch_def, capsule) : NULL;
+  pl->flush = capsule ? PyCFunction_New(&pyca_loop_flush_def, capsule) : NULL;
+  Py_XDECREF(capsule);
+  PyObject* res = pl->dispatch && pl->flush ?
+    PyObject_CallMethod(loop, (char*)"add_reader", (char*)"iO",
+                        notifier->rfd, pl->dispatch) : NULL;
+  if (!res || PyDict_SetItem(pyca_async_loops, loop, capsule) < 0) {
+    Py_XDECREF(res);
+    Py_XDECREF(pl->dispatch);
+    Py_XDECREF(pl->flush);
+    Py_DECREF(loop);
+    pyca_notifier_free(notifier);
+    delete pl;
+    return NULL;
+  }
+  Py_DECREF(res);
+  return pl;
+}
+
+// Forget a loop which has nothing in flight anymore
+static void _pyca_loop_idle(pyca_loop* pl)
+{
+  if (pl->inflight || pl->flushing || pl->dispatching) {
+    return;
+  }
+  PyObject* res = PyObject_CallMethod(pl->loop, (char*)"remove_reader", (char*)"i",
+                                      pl->notifier->rfd);
+  Py_XDECREF(res);
+  if (PyDict_DelItem(pyca_async_loops, pl->loop) < 0 || !res) {
+    PyErr_Clear();
+  }
+  Py_DECREF(pl->dispatch);
+  Py_DECREF(pl->flush);
+  Py_DECREF(pl->loop);
+  pyca_notifier_free(pl->notifier);
+  delete pl;
+}
+
+// Schedule a flush of the requests issued during this loop iteration
+static void _pyca_loop_schedule_flush(pyca_loop* pl)
+{
+  if (pl->flushing) {
+    return;
+  }
+  PyObject* res = PyObject_CallMethod(pl->loop, (char*)"call_soon", (char*)"(O)", pl->flush);
+  if (res) {
+    pl->flushing = 1;
+    Py_DECREF(res);
+  } else {
+    // Not flushed with the others, then flushed on its own
+    PyErr_Clear();
+    ca_flush_io();
+  }
+}
+
+static pyca_async_op* _pyca_async_op_new(int kind, capv* pv, pyca_loop* pl,
+                                         PyObject* future)
+{
+  pyca_async_op* op = new pyca_async_op;
+  op->kind = kind;
+  Py_INCREF(pv);
+  op->pv = pv;
+  op->loop = pl;
+  op->future = future;
+  op->status = ECA_NORMAL;
+  op->dbr_type = -1;
+  op->count = 0;
+  op->buffer = 0;
+  op->posted.store(0);
+  op->closed = 0;
+  op->refs = 1;
+  op->prevop = 0;
+  op->nextop = 0;
+  if (kind != PYCA_ASYNC_MONITOR) {
+    // Clearing the channel fails those not answered yet
+    op->nextop = pv->asyncops;
+    if (op->nextop) {
+      op->nextop->prevop = op;
+    }
+    pv->asyncops = op;
+  }
+  pl->inflight++;
+  return op;
+}
+
+// Forget a get or put of the requests in flight of its PV
+static void _pyca_async_op_unlink(pyca_async_op* op)
+{
+  if (op->prevop) {
+    op->prevop->nextop = op->nextop;
+  } else if (op->pv->asyncops == op) {
+    op->pv->asyncops = op->nextop;
+  }
+  if (op->nextop) {
+    op->nextop->prevop = op->prevop;
+  }
+  op->prevop = 0;
+  op->nextop = 0;
+}
+
+// Drop a reference to a request; the last one releases its loop. The
+// loop may be gone when this returns.
+static void _pyca_async_op_unref(pyca_async_op* op)
+{
+  if (--op->refs) {
+    return;
+  }
+  pyca_loop* pl = op->loop;
+  _pyca_async_op_unlink(op);
+  Py_XDECREF(op->future);
+  Py_DECREF(op->pv);
+  delete [] op->buffer;
+  delete op;
+  pl->inflight--;
+}
+
+// Resolve a future unless it was cancelled. Steals the references to
+// result and exc, one of which is NULL.
+static void _pyca_future_set(PyObject* future, PyObject* result, PyObject* exc)
+{
+  PyObject* done = PyObject_CallMethod(future, (char*)"done", NULL);
+  PyObject* res = NULL;
+  if (done && !PyObject_IsTrue(done)) {
+    if (exc) {
+      res = PyObject_CallMethod(future, (char*)"set_exception", (char*)"(O)", exc);
+    } else {
+      res = PyObject_CallMethod(future, (char*)"set_result", (char*)"(O)", result);
+    }
+  }
+  if (PyErr_Occurred()) {
+    PyErr_WriteUnraisable(future);
+  }
+  Py_XDECREF(done);
+  Py_XDECREF(res);
+  Py_XDECREF(result);
+  Py_XDECREF(exc);
+}
+
+// Exception instance for a failed request
+static PyObject* _pyca_async_exc(capv* pv, int status)
+{
+  PyObject* msg = pyca_data_status_msg(status, pv);
+  PyObject* exc = PyObject_CallFunctionObjArgs(pyca_caexc, msg, NULL);
+  Py_XDECREF(msg);
+  return exc;
+}
+
+// Decode the latest monitor update of pv. Returns a snapshot of its data,
+// or NULL with *exc set if the update failed, or NULL if there is none.
+static PyObject* _pyca_async_next(capv* pv, PyObject** exc)
+{
+  short dbr_type;
+  long count;
+  int status;
+  pyca_latest* latest = pv->latest;
+  *exc = NULL;
+  if (!pyca_latest_take(latest, &dbr_type, &count, &status)) {
+    return NULL;
+  }
+  if (status == ECA_NORMAL &&
+      !_pyca_event_process(pv, latest->spare, dbr_type, count)) {
+    PyErr_Clear();
+    status = ECA_BADTYPE;
+  }
+  if (status != ECA_NORMAL) {
+    *exc = _pyca_async_exc(pv, status);
+    return NULL;
+  }
+  _pyca_record_sync(pv);
+  return PyDict_Copy(pv->data);
+}
+
+// Complete a request posted by the CA thread
+static void _pyca_async_complete(pyca_async_op* op)
+{
+  capv* pv = op->pv;
+  PyObject* exc = NULL;
+  PyObject* result = NULL;
+  switch (op->kind) {
+  case PYCA_ASYNC_GET:
+    if (op->status == ECA_NORMAL &&
+        !_pyca_event_process(pv, op->buffer, op->dbr_type, op->count)) {
+      PyErr_Clear();
+      op->status = ECA_BADTYPE;
+    }
+    if (op->status == ECA_NORMAL) {
+      result = _pyca_field_get(pv, PYCA_VALUE);
+      if (!result) {
+        // The value went to a processor
+        PyErr_Clear();
+        Py_INCREF(Py_None);
+        result = Py_None;
+      }
+    }
+    break;
+  case PYCA_ASYNC_PUT:
+    if (op->status == ECA_NORMAL) {
+      Py_INCREF(Py_None);
+      result = Py_None;
+    }
+    break;
+  case PYCA_ASYNC_MONITOR:
+    op->posted.store(0);
+    if (op->closed) {
+      _pyca_async_op_unref(op);
+      return;
+    }
+    if (op->future) {
+      result = _pyca_async_next(pv, &exc);
+      if (result || exc) {
+        PyObject* future = op->future;
+        op->future = 0;
+        _pyca_future_set(future, result, exc);
+        Py_DECREF(future);
+      }
+    }
+    return;
+  }
+  if (!result) {
+    exc = _pyca_async_exc(pv, op->status);
+  }
+  _pyca_future_set(op->future, result, exc);
+  _pyca_async_op_unref(op);
+}
+
+// Reader of the notifier descriptor
+static PyObject* pyca_loop_dispatch(PyObject* self, PyObject*)
+{
+  pyca_loop* pl = _pyca_loop_of(self);
+  pyca_notice* notice = pyca_notifier_take(pl->notifier);
+  pl->dispatching = 1;
+  while (notice) {
+    pyca_async_op* op = reinterpret_cast<pyca_async_op*>(notice);
+    notice = notice->next;
+    _pyca_async_complete(op);
+  }
+  pl->dispatching = 0;
+  _pyca_loop_idle(pl);
+  Py_RETURN_NONE;
+}
+
+static PyObject* pyca_loop_flush(PyObject* self, PyObject*)
+{
+  pyca_loop* pl = _pyca_loop_of(self);
+  pl->flushing = 0;
+  Py_BEGIN_ALLOW_THREADS
+    ca_flush_io();
+  Py_END_ALLOW_THREADS
+  _pyca_loop_idle(pl);
+  Py_RETURN_NONE;
+}
+
+// End the monitor updates of pv once its subscription is cleared: the
+// pending update, if any, raises StopAsyncIteration. Once its channel
+// is cleared too, CA drops the callbacks of the gets and puts in flight
+// and their futures fail, unless their reply is already posted.
+static void _pyca_async_close(capv* pv)
+{
+  if (!pv->cid) {
+    pyca_async_op* next;
+    for (pyca_async_op* op = pv->asyncops; op; op = next) {
+      next = op->nextop;
+      _pyca_async_op_unlink(op);
+      if (!op->posted.load()) {
+        pyca_loop* pl = op->loop;
+        _pyca_future_set(op->future, NULL, _pyca_async_exc(pv, ECA_DISCONNCHID));
+        _pyca_async_op_unref(op);
+        _pyca_loop_idle(pl);
+      }
+    }
+  }
+  pyca_async_op* op = pv->asyncmon;
+  if (!op) {
+    return;
+  }
+  pv->asyncmon = 0;
+  op->closed = 1;
+  if (op->future) {
+    PyObject* future = op->future;
+    op->future = 0;
+    _pyca_future_set(future, NULL,
+                     PyObject_CallFunctionObjArgs(PyExc_StopAsyncIteration, NULL));
+    Py_DECREF(future);
+  }
+  if (!op->posted.load()) {
+    // Otherwise the dispatch drops the reference of the subscription
+    pyca_loop* pl = op->loop;
+    _pyca_async_op_unref(op);
+    _pyca_loop_idle(pl);
+  }
+}
+
+// Callbacks invoked by the CA thread, without the GIL
+static void pyca_async_get_handler(struct event_handler_args args)
+{
+  pyca_async_op* op = reinterpret_cast<pyca_async_op*>(args.usr);
+  pyca_get_taps(op->pv, args);
+  op->status = args.status;
+  if (args.status == ECA_NORMAL && args.dbr) {
+    unsigned size = dbr_size_n(args.type, args.count);
+    op->buffer = new char[size];
+    memcpy(op->buffer, args.dbr, size);
+    op->dbr_type = args.type;
+    op->count = args.count;
+  } else if (args.status == ECA_NORMAL) {
+    op->status = ECA_BADTYPE;
+  }
+  op->posted.store(1);
+  pyca_notifier_post(op->loop->notifier, &op->notice);
+}
+
+static void pyca_async_put_handler(struct event_handler_args args)
+{
+  pyca_async_op* op = reinterpret_cast<pyca_async_op*>(args.usr);
+  op->status = args.status;
+  op->posted.store(1);
+  pyca_notifier_post(op->loop->notifier, &op->notice);
+}
+
+static void pyca_async_monitor_handler(struct event_handler_args args)
+{
+  pyca_async_op* op = reinterpret_cast<pyca_async_op*>(args.usr);
+  if (pyca_monitor_taps(op->pv, args)) {
+    return;
+  }
+  pyca_latest_store(op->pv, args);
+  if (!op->posted.exchange(1)) {
+    pyca_notifier_post(op->loop->notifier, &op->notice);
+  }
+}
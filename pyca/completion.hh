@@ -0,0 +1,198 @@
+#include "p3compat.h"
+// Completion tracking for requests whose replies are handled natively.
+//
+// A batch owns one pyca_request per PV. Replies are copied into the
+// request by the CA thread without taking the GIL, and the issuing
+// thread waits on the batch condition variable (also without the GIL)
+// until every request has completed or the timeout expires. Replies
+// which arrive after the waiter gave up are still accepted, so the
+// batch is reference counted and freed by whoever drops the last
+// reference.
+struct pyca_batch;
+
+struct pyca_request {
+  capv* pv;             // PV this request was issued for
+  pyca_batch* batch;    // owning batch
+  short dbr_type;       // requested DBR type
+  long count;           // requested (then received) element count
+  int status;           // ECA status, ECA_TIMEOUT until completed
+  int done;             // set once the reply has been received
+  char* buffer;         // copy of the received DBR payload
+};
+
+struct pyca_batch {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int pending;          // requests still waiting for a reply
+  int refcnt;           // waiter + requests still owned by CA
+  long size;            // number of requests
+  pyca_request* requests;
+};
+
+// Absolute CLOCK_REALTIME deadline timeout seconds from now, for
+// pthread_cond_timedwait
+static void pyca_deadline(double timeout, struct timespec* deadline)
+{
+  clock_gettime(CLOCK_REALTIME, deadline);
+  long secs = (long)timeout;
+  deadline->tv_sec += secs;
+  deadline->tv_nsec += (long)((timeout - secs) * 1e9);
+  if (deadline->tv_nsec >= 1000000000L) {
+    deadline->tv_sec++;
+    deadline->tv_nsec -= 1000000000L;
+  }
+}
+
+static pyca_batch* pyca_batch_new(long size)
+{
+  pyca_batch* batch = new pyca_batch;
+  pthread_mutex_init(&batch->lock, NULL);
+  pthread_cond_init(&batch->cond, NULL);
+  batch->pending = 0;
+  batch->refcnt = 1;
+  batch->size = size;
+  batch->requests = new pyca_request[size];
+  for (long i=0; i<size; i++) {
+    pyca_request* req = &batch->requests[i];
+    req->pv = 0;
+    req->batch = batch;
+    req->dbr_type = -1;
+    req->count = 0;
+    req->status = ECA_TIMEOUT;
+    req->done = 0;
+    req->buffer = 0;
+  }
+  return batch;
+}
+
+// Must be called with batch->lock held; unlocks (and maybe frees) the batch
+static void pyca_batch_unref_locked(pyca_batch* batch)
+{
+  int refcnt = --batch->refcnt;
+  pthread_mutex_unlock(&batch->lock);
+  if (refcnt == 0) {
+    for (long i=0; i<batch->size; i++) {
+      delete [] batch->requests[i].buffer;
+    }
+    delete [] batch->requests;
+    pthread_cond_destroy(&batch->cond);
+    pthread_mutex_destroy(&batch->lock);
+    delete batch;
+  }
+}
+
+// Account for a request handed over to CA; its reply will drop the reference
+static void pyca_batch_issued(pyca_request* req)
+{
+  pyca_batch* batch = req->batch;
+  pthread_mutex_lock(&batch->lock);
+  batch->pending++;
+  batch->refcnt++;
+  pthread_mutex_unlock(&batch->lock);
+}
+
+// Wait until all issued requests completed or timeout expired. A
+// timeout <= 0 waits forever. Returns the number of requests still
+// pending. Must be called without the GIL.
+static int pyca_batch_wait(pyca_batch* batch, double timeout)
+{
+  struct timespec deadline;
+  if (timeout > 0) {
+    pyca_deadline(timeout, &deadline);
+  }
+  pthread_mutex_lock(&batch->lock);
+  while (batch->pending > 0) {
+    if (timeout > 0) {
+      if (pthread_cond_timedwait(&batch->cond, &batch->lock, &deadline) == ETIMEDOUT)
+        break;
+    } else {
+      pthread_cond_wait(&batch->cond, &batch->lock);
+    }
+  }
+  int pending = batch->pending;
+  pthread_mutex_unlock(&batch->lock);
+  return pending;
+}
+
+// Drop the waiter reference; outstanding replies keep the batch alive
+static void pyca_batch_release(pyca_batch* batch)
+{
+  pthread_mutex_lock(&batch->lock);
+  pyca_batch_unref_locked(batch);
+}
+
+// Whether the reply for req has arrived (safe to read once true)
+static bool pyca_request_done(pyca_request* req)
+{
+  pthread_mutex_lock(&req->batch->lock);
+  bool done = req->done != 0;
+  pthread_mutex_unlock(&req->batch->lock);
+  return done;
+}
+
+// Record the reply for req and drop the reference it held on the batch
+static void pyca_request_complete(pyca_request* req,
+                                  struct event_handler_args& args,
+                                  char* buffer)
+{
+  pyca_batch* batch = req->batch;
+  pthread_mutex_lock(&batch->lock);
+  req->buffer = buffer;
+  req->dbr_type = args.type;
+  req->count = args.count;
+  req->status = args.status;
+  req->done = 1;
+  if (--batch->pending == 0) {
+    pthread_cond_broadcast(&batch->cond);
+  }
+  pyca_batch_unref_locked(batch);
+}
+
+// - batched get data events, invoked by CA without the GIL
+static void pyca_batch_get_handler(struct event_handler_args args)
+{
+  pyca_request* req = reinterpret_cast<pyca_request*>(args.usr);
+  char* buffer = 0;
+  if (args.status == ECA_NORMAL && args.dbr) {
+    unsigned size = dbr_size_n(args.type, args.count);
+    buffer = new char[size];
+    memcpy(buffer, args.dbr, size);
+  }
+  pyca_request_complete(req, args, buffer);
+}
+
+// - batched put completion events, invoked by CA without the GIL
+static void pyca_batch_put_handler(struct event_handler_args args)
+{
+  pyca_request* req = reinterpret_cast<pyca_request*>(args.usr);
+  pyca_request_complete(req, args, 0);
+}
+
+// Complete a request CA refused to issue, no reply will ever come for it
+static void pyca_request_failed(pyca_request* req, int status)
+{
+  event_handler_args args;
+  memset(&args, 0, sizeof(args));
+  args.usr = req;
+  args.status = status;
+  pyca_request_complete(req, args, 0);
+}
+
+// Flush and wait for the reply to a single request with the GIL
+// released. Unlike ca_pend_io, this only waits for this request and
+// not for the I/O issued by other threads. Returns the ECA status of
+// the reply, ECA_TIMEOUT if it did not arrive in time.
+static int pyca_request_wait(pyca_request* req, double timeout)
+{
+  int result = ca_flush_io();
+  if (result != ECA_NORMAL) {
+    return result;
+  }
+  Py_BEGIN_ALLOW_THREADS
+    pyca_batch_wait(req->batch, timeout);
+  Py_END_ALLOW_THREADS
+  if (!pyca_request_done(req)) {
+    return ECA_TIMEOUT;
+  }
+  return req->status;
+}
@@ -0,0 +1,286 @@
+#include "p3compat.h"
+// Deferred dispatch of the channel access callbacks.
+//
+// Once pyca.event_fd() has been called, the connection, access rights,
+// monitor, get and put handlers no longer take the GIL in the CA
+// thread: they copy the event into a pyca_deferred record and post it
+// on a notifier, whose descriptor becomes readable. The application
+// watches the descriptor with select(), poll() or its event loop and
+// calls pyca.dispatch_pending(), which decodes the events and runs the
+// callbacks, in the order CA delivered them, on its own thread. Records
+// and their payload buffers are recycled through a free list.
+//
+// Instead, pyca.dispatcher_start() hands the records to a native
+// dispatcher thread, which takes the GIL once per batch of up to 'batch'
+// events: a batch is dispatched once full, or once its first event has
+// waited 'max_latency' seconds.
+#include <atomic>
+#include <time.h>
+
+enum pyca_deferred_kind {
+  PYCA_DEFER_CONNECT,
+  PYCA_DEFER_RWACCESS,
+  PYCA_DEFER_MONITOR,
+  PYCA_DEFER_PROPERTY,
+  PYCA_DEFER_GET,
+  PYCA_DEFER_PUT,
+  PYCA_DEFER_CACHED     // get answered from data pyca already had
+};
+
+struct pyca_deferred {
+  pyca_notice notice;   // first, notices are cast back to records
+  int kind;
+  capv* pv;
+  int status;           // CA status, connection state or read access
+  int arg;              // write access
+  short dbr_type;
+  long count;
+  const void* dbr;      // buffer, or NULL if the event has no payload
+  char* buffer;
+  unsigned bufsiz;
+  unsigned long long entry; // of the CA callback, for latency histograms
+};
+
+// Notifier of the deferred events, NULL until pyca.event_fd() is called
+static std::atomic<pyca_notifier*> pyca_deferred_notifier(NULL);
+
+// Notifier of pyca.event_fd(), kept once deferred dispatch is switched
+// off, since events deferred before may still be pending
+static pyca_notifier* pyca_deferred_fd = 0;
+
+static pthread_mutex_t pyca_deferred_lock = PTHREAD_MUTEX_INITIALIZER;
+static pyca_deferred* pyca_deferred_free = 0;
+static long pyca_deferred_nfree = 0;
+static const long pyca_deferred_maxfree = 1024;
+
+static pyca_deferred* pyca_deferred_new()
+{
+  pthread_mutex_lock(&pyca_deferred_lock);
+  pyca_deferred* deferred = pyca_deferred_free;
+  if (deferred) {
+    pyca_deferred_free = reinterpret_cast<pyca_deferred*>(deferred->notice.next);
+    pyca_deferred_nfree--;
+  }
+  pthread_mutex_unlock(&pyca_deferred_lock);
+  if (!deferred) {
+    deferred = new pyca_deferred;
+    deferred->buffer = 0;
+    deferred->bufsiz = 0;
+  }
+  return deferred;
+}
+
+static void pyca_deferred_release(pyca_deferred* deferred)
+{
+  pthread_mutex_lock(&pyca_deferred_lock);
+  if (pyca_deferred_nfree < pyca_deferred_maxfree) {
+    deferred->notice.next = reinterpret_cast<pyca_notice*>(pyca_deferred_free);
+    pyca_deferred_free = deferred;
+    pyca_deferred_nfree++;
+    deferred = 0;
+  }
+  pthread_mutex_unlock(&pyca_deferred_lock);
+  if (deferred) {
+    delete [] deferred->buffer;
+    delete deferred;
+  }
+}
+
+// Records taken for dispatch and not dispatched yet, oldest first. GIL
+// protected: callbacks may clear the PVs of the records after them.
+struct pyca_deferred_list {
+  pyca_notice* first;
+  pyca_notice* last;
+};
+
+// Taken by pyca.dispatch_pending()
+static pyca_deferred_list pyca_deferred_taken = {0, 0};
+
+static void pyca_deferred_append(pyca_deferred_list* list, pyca_notice* notices)
+{
+  if (!notices) {
+    return;
+  }
+  if (list->last) {
+    list->last->next = notices;
+  } else {
+    list->first = notices;
+  }
+  while (notices->next) {
+    notices = notices->next;
+  }
+  list->last = notices;
+}
+
+static pyca_deferred* pyca_deferred_pop(pyca_deferred_list* list)
+{
+  pyca_notice* notice = list->first;
+  if (notice) {
+    list->first = notice->next;
+    if (!list->first) {
+      list->last = 0;
+    }
+  }
+  return reinterpret_cast<pyca_deferred*>(notice);
+}
+
+// Mark the records of pv dead, they are released without dispatch
+static void pyca_deferred_forget(pyca_notice* notice, capv* pv)
+{
+  for (; notice; notice = notice->next) {
+    pyca_deferred* deferred = reinterpret_cast<pyca_deferred*>(notice);
+    if (deferred->pv == pv) {
+      deferred->pv = 0;
+    }
+  }
+}
+
+struct pyca_dispatcher {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;  // signaled for the first event of a batch, a full batch or stop
+  pthread_t thread;
+  ca_client_context* context; // attached by the thread, for callbacks using CA
+  pyca_notice* first;   // pending records, in arrival order
+  pyca_notice* last;
+  pyca_notice* taken;   // batch being dispatched
+  unsigned long pending;
+  struct timespec since;// CLOCK_REALTIME arrival of the first pending record
+  unsigned long batch;  // most callbacks per GIL acquisition
+  double max_latency;   // seconds the first event of a batch waits for more
+  int stop;             // no more records are accepted
+  std::atomic<unsigned long> batches;
+  std::atomic<unsigned long> dispatched;
+};
+
+// Dispatcher thread taking the deferred events, NULL unless running. It
+// is allocated once and kept, since the CA thread may be posting to it.
+static std::atomic<pyca_dispatcher*> pyca_deferred_dispatcher(NULL);
+static pyca_dispatcher* pyca_dispatcher_thread = 0;
+
+static pyca_dispatcher* pyca_dispatcher_new()
+{
+  pyca_dispatcher* dispatcher = new pyca_dispatcher;
+  pthread_mutex_init(&dispatcher->lock, NULL);
+  pthread_cond_init(&dispatcher->cond, NULL);
+  dispatcher->context = 0;
+  dispatcher->first = 0;
+  dispatcher->last = 0;
+  dispatcher->taken = 0;
+  dispatcher->pending = 0;
+  dispatcher->batch = 1;
+  dispatcher->max_latency = 0;
+  dispatcher->stop = 1;
+  dispatcher->batches = 0;
+  dispatcher->dispatched = 0;
+  return dispatcher;
+}
+
+// Queue a record for the dispatcher thread. Returns false if it is
+// stopping and the record must go elsewhere.
+static bool pyca_dispatcher_post(pyca_dispatcher* dispatcher, pyca_notice* notice)
+{
+  notice->next = 0;
+  pthread_mutex_lock(&dispatcher->lock);
+  if (dispatcher->stop) {
+    pthread_mutex_unlock(&dispatcher->lock);
+    return false;
+  }
+  if (dispatcher->last) {
+    dispatcher->last->next = notice;
+  } else {
+    dispatcher->first = notice;
+  }
+  dispatcher->last = notice;
+  if (!dispatcher->pending++) {
+    clock_gettime(CLOCK_REALTIME, &dispatcher->since);
+  }
+  bool wake = dispatcher->pending == 1 || dispatcher->pending == dispatcher->batch;
+  pthread_mutex_unlock(&dispatcher->lock);
+  if (wake) {
+    pthread_cond_signal(&dispatcher->cond);
+  }
+  return true;
+}
+
+// Wait for the next batch and take its *count records, oldest first.
+// The batch stays reachable as dispatcher->taken until dispatched.
+// Returns NULL once stopped with nothing pending.
+static pyca_notice* pyca_dispatcher_take(pyca_dispatcher* dispatcher, unsigned long* count)
+{
+  pthread_mutex_lock(&dispatcher->lock);
+  while (!dispatcher->pending && !dispatcher->stop) {
+    pthread_cond_wait(&dispatcher->cond, &dispatcher->lock);
+  }
+  if (dispatcher->pending < dispatcher->batch && !dispatcher->stop &&
+      dispatcher->max_latency > 0) {
+    struct timespec deadline = dispatcher->since;
+    double secs = deadline.tv_sec + deadline.tv_nsec * 1e-9 + dispatcher->max_latency;
+    deadline.tv_sec = (time_t)secs;
+    deadline.tv_nsec = (long)((secs - deadline.tv_sec) * 1e9);
+    while (dispatcher->pending < dispatcher->batch && !dispatcher->stop &&
+           pthread_cond_timedwait(&dispatcher->cond, &dispatcher->lock, &deadline) != ETIMEDOUT) {
+    }
+  }
+  pyca_notice* notices = dispatcher->first;
+  unsigned long n = 0;
+  if (notices) {
+    pyca_notice* last = notices;
+    for (n=1; n<dispatcher->batch && last->next; n++) {
+      last = last->next;
+    }
+    dispatcher->first = last->next;
+    if (!dispatcher->first) {
+      dispatcher->last = 0;
+    }
+    last->next = 0;
+    // The rest keeps the earlier arrival, so it never waits longer
+    dispatcher->pending -= n;
+  }
+  dispatcher->taken = notices;
+  pthread_mutex_unlock(&dispatcher->lock);
+  *count = n;
+  return notices;
+}
+
+// Defer an event of pv if deferred dispatch is enabled. Called by the
+// CA thread without the GIL. Returns false if the event must be
+// dispatched right away.
+static bool pyca_defer(int kind, capv* pv, int status, int arg,
+                       const void* dbr, short dbr_type, long count,
+                       unsigned long long entry = 0)
+{
+  pyca_dispatcher* dispatcher = pyca_deferred_dispatcher.load(std::memory_order_acquire);
+  pyca_notifier* notifier = pyca_deferred_notifier.load(std::memory_order_acquire);
+  if (!dispatcher && !notifier) {
+    return false;
+  }
+  pyca_deferred* deferred = pyca_deferred_new();
+  deferred->kind = kind;
+  deferred->pv = pv;
+  deferred->status = status;
+  deferred->arg = arg;
+  deferred->dbr_type = dbr_type;
+  deferred->count = count;
+  deferred->entry = entry;
+  deferred->dbr = 0;
+  if (dbr) {
+    unsigned size = dbr_size_n(dbr_type, count);
+    if (size > deferred->bufsiz) {
+      delete [] deferred->buffer;
+      deferred->buffer = new char[size];
+      deferred->bufsiz = size;
+    }
+    memcpy(deferred->buffer, dbr, size);
+    deferred->dbr = deferred->buffer;
+  }
+  if (dispatcher && pyca_dispatcher_post(dispatcher, &deferred->notice)) {
+    return true;
+  }
+  // The dispatcher was stopped meanwhile
+  if (!notifier) {
+    pyca_deferred_release(deferred);
+    return false;
+  }
+  pyca_notifier_post(notifier, &deferred->notice);
+  return true;
+}
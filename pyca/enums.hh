@@ -0,0 +1,115 @@
+#include "p3compat.h"
+// Enum strings of a PV.
+//
+// The strings are fetched once with DBR_GR_ENUM and kept natively, so
+// that they do not have to be requested from the IOC again. The
+// connection handler drops them without the GIL when the channel goes
+// up or down, since the IOC may have been rebuilt, and DBE_PROPERTY
+// events of DBR_CTRL_ENUM refresh them. The Python tuple of the strings
+// is rebuilt, with the GIL, only when the native copy changed.
+#include <atomic>
+
+struct pyca_enums {
+  pthread_mutex_t lock;
+  int valid;                    // strs holds the strings of the IOC
+  unsigned long generation;     // changes of strs
+  dbr_short_t no_str;
+  char strs[MAX_ENUM_STATES][MAX_ENUM_STRING_SIZE];
+  PyObject* pystrs;             // tuple of strs, guarded by the GIL
+  unsigned long pygeneration;   // generation of pystrs
+};
+
+static pyca_enums* pyca_enums_new()
+{
+  pyca_enums* enums = new pyca_enums;
+  pthread_mutex_init(&enums->lock, NULL);
+  enums->valid = 0;
+  enums->generation = 0;
+  enums->no_str = 0;
+  enums->pystrs = 0;
+  enums->pygeneration = 0;
+  return enums;
+}
+
+static void pyca_enums_free(pyca_enums* enums)
+{
+  Py_XDECREF(enums->pystrs);
+  pthread_mutex_destroy(&enums->lock);
+  delete enums;
+}
+
+// Drop the strings. Called by the CA thread without the GIL.
+static void pyca_enums_invalidate(pyca_enums* enums)
+{
+  pthread_mutex_lock(&enums->lock);
+  if (enums->valid) {
+    enums->valid = 0;
+    enums->generation++;
+  }
+  pthread_mutex_unlock(&enums->lock);
+}
+
+static void pyca_enums_store(pyca_enums* enums,
+                             dbr_short_t no_str,
+                             const char strs[][MAX_ENUM_STRING_SIZE])
+{
+  if (no_str < 0) {
+    no_str = 0;
+  } else if (no_str > MAX_ENUM_STATES) {
+    no_str = MAX_ENUM_STATES;
+  }
+  pthread_mutex_lock(&enums->lock);
+  enums->no_str = no_str;
+  for (int i=0; i<no_str; i++) {
+    memcpy(enums->strs[i], strs[i], MAX_ENUM_STRING_SIZE);
+    enums->strs[i][MAX_ENUM_STRING_SIZE-1] = 0;
+  }
+  enums->valid = 1;
+  enums->generation++;
+  pthread_mutex_unlock(&enums->lock);
+}
+
+// Tuple of the strings, NULL if they are not known. Must be called
+// with the GIL, returns a borrowed reference.
+static PyObject* pyca_enums_tuple(pyca_enums* enums)
+{
+  if (!enums) {
+    return NULL;
+  }
+  pthread_mutex_lock(&enums->lock);
+  if (!enums->valid) {
+    pthread_mutex_unlock(&enums->lock);
+    return NULL;
+  }
+  if (enums->pystrs && enums->pygeneration == enums->generation) {
+    pthread_mutex_unlock(&enums->lock);
+    return enums->pystrs;
+  }
+  // Python objects are created out of the lock
+  unsigned long generation = enums->generation;
+  dbr_short_t no_str = enums->no_str;
+  char strs[MAX_ENUM_STATES][MAX_ENUM_STRING_SIZE];
+  memcpy(strs, enums->strs, sizeof(strs));
+  pthread_mutex_unlock(&enums->lock);
+  PyObject* pystrs = PyTuple_New(no_str);
+  for (int i=0; pystrs && i<no_str; i++) {
+    PyTuple_SET_ITEM(pystrs, i, PyString_FromString(strs[i]));
+  }
+  Py_XDECREF(enums->pystrs);
+  enums->pystrs = pystrs;
+  enums->pygeneration = generation;
+  return enums->pystrs;
+}
+
+// String of an enum value, None if the strings are not known or the
+// value has no string. Returns a new reference.
+static PyObject* pyca_enums_str(pyca_enums* enums, dbr_enum_t value)
+{
+  PyObject* pystrs = pyca_enums_tuple(enums);
+  PyObject* pystr = Py_None;
+  if (pystrs && value < PyTuple_GET_SIZE(pystrs)) {
+    pystr = PyTuple_GET_ITEM(pystrs, value);
+  }
+  Py_INCREF(pystr);
+  return pystr;
+}
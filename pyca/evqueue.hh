@@ -0,0 +1,469 @@
+#include "p3compat.h"
+// Bounded lock-free queue of raw monitor events.
+//
+// Queued subscriptions do not decode anything in the CA thread: the
+// monitor handler copies the DBR payload into a slot of this ring
+// without taking the GIL and Python drains many events at once with
+// pyca.poll_events(). The ring is a multi-producer multi-consumer queue
+// with a sequence number per slot (several CA threads may produce and
+// the drop-oldest policy makes producers consume too). Each slot owns a
+// payload buffer which is reused, so once the buffers have grown to the
+// event size there is no allocation per event.
+#include <atomic>
+
+// Conflated subscriptions keep only the latest event of a PV in a
+// native slot. The CA thread overwrites it and, when the PV was not
+// already dirty, pushes the PV on a lock-free list of dirty PVs owned
+// by the queue, so Python is notified once per PV however many updates
+// arrived, and that list never holds more entries than there are PVs.
+struct pyca_latest {
+  pthread_mutex_t lock;
+  char* buffer;         // latest DBR payload, written by CA
+  unsigned bufsiz;
+  char* spare;          // payload being decoded, owned by the GIL holder
+  unsigned sparesiz;
+  short dbr_type;
+  long count;
+  int status;
+  int fresh;            // buffer holds an event not decoded yet
+  std::atomic<int> dirty;   // pv is on the dirty list
+  capv* next;           // next dirty pv
+};
+
+static pyca_latest* pyca_latest_new()
+{
+  pyca_latest* latest = new pyca_latest;
+  pthread_mutex_init(&latest->lock, NULL);
+  latest->buffer = 0;
+  latest->bufsiz = 0;
+  latest->spare = 0;
+  latest->sparesiz = 0;
+  latest->dbr_type = -1;
+  latest->count = 0;
+  latest->status = ECA_NORMAL;
+  latest->fresh = 0;
+  latest->dirty.store(0);
+  latest->next = 0;
+  return latest;
+}
+
+static void pyca_latest_free(pyca_latest* latest)
+{
+  delete [] latest->buffer;
+  delete [] latest->spare;
+  pthread_mutex_destroy(&latest->lock);
+  delete latest;
+}
+
+// Move the latest event of pv to its spare buffer for decoding. Called
+// with the GIL. Returns false if there is nothing new since last time.
+static bool pyca_latest_take(pyca_latest* latest,
+                             short* dbr_type, long* count, int* status)
+{
+  pthread_mutex_lock(&latest->lock);
+  bool fresh = latest->fresh != 0;
+  if (fresh) {
+    *dbr_type = latest->dbr_type;
+    *count = latest->count;
+    *status = latest->status;
+    char* buffer = latest->spare;
+    unsigned bufsiz = latest->sparesiz;
+    latest->spare = latest->buffer;
+    latest->sparesiz = latest->bufsiz;
+    latest->buffer = buffer;
+    latest->bufsiz = bufsiz;
+    latest->fresh = 0;
+  }
+  pthread_mutex_unlock(&latest->lock);
+  return fresh;
+}
+
+// Overwrite the latest event of pv with the one of args. Called by the
+// CA thread without the GIL. Returns true if the event it replaced was
+// not decoded yet.
+static bool pyca_latest_store(capv* pv, struct event_handler_args& args)
+{
+  pyca_latest* latest = pv->latest;
+  pthread_mutex_lock(&latest->lock);
+  latest->dbr_type = args.type;
+  latest->count = args.count;
+  latest->status = args.status;
+  if (args.status == ECA_NORMAL && args.dbr) {
+    unsigned size = dbr_size_n(args.type, args.count);
+    if (size > latest->bufsiz) {
+      delete [] latest->buffer;
+      latest->buffer = new char[size];
+      latest->bufsiz = size;
+      pyca_stat_add(pv, PYCA_STAT_REALLOCS, 1);
+    }
+    memcpy(latest->buffer, args.dbr, size);
+  }
+  bool overwritten = latest->fresh != 0;
+  latest->fresh = 1;
+  pthread_mutex_unlock(&latest->lock);
+  return overwritten;
+}
+
+enum pyca_overflow_policy {
+  PYCA_DROP_NEWEST = 0, // discard the incoming event when full
+  PYCA_DROP_OLDEST = 1  // discard the oldest queued event to make room
+};
+
+struct pyca_event {
+  std::atomic<size_t> seq;
+  std::atomic<capv*> pv;  // NULL once the subscription is gone
+  short dbr_type;
+  long count;
+  int status;
+  char* buffer;         // copy of the DBR payload, reused across events
+  unsigned bufsiz;
+};
+
+struct pyca_evqueue {
+  size_t mask;
+  pyca_event* events;
+  char pad0[64];
+  std::atomic<size_t> head;     // next slot to fill
+  char pad1[64];
+  std::atomic<size_t> tail;     // next slot to drain
+  char pad2[64];
+  std::atomic<int> policy;
+  std::atomic<unsigned long> queued;
+  std::atomic<unsigned long> dropped;
+  std::atomic<unsigned long> conflated; // overwritten before being drained
+  std::atomic<int> waiters;     // consumers blocked in pyca_evqueue_wait
+  std::atomic<capv*> dirty;     // conflated PVs with a new event, newest first
+  capv* taken;          // dirty PVs taken but not drained yet, GIL protected
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+// Number of slots for a queue of at least capacity events
+static size_t pyca_evqueue_slots(size_t capacity)
+{
+  size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  return size;
+}
+
+static pyca_evqueue* pyca_evqueue_new(size_t capacity, int policy)
+{
+  size_t size = pyca_evqueue_slots(capacity);
+  pyca_evqueue* q = new pyca_evqueue;
+  q->mask = size - 1;
+  q->events = new pyca_event[size];
+  for (size_t i=0; i<size; i++) {
+    pyca_event* ev = &q->events[i];
+    ev->seq.store(i, std::memory_order_relaxed);
+    ev->pv = 0;
+    ev->dbr_type = -1;
+    ev->count = 0;
+    ev->status = ECA_NORMAL;
+    ev->buffer = 0;
+    ev->bufsiz = 0;
+  }
+  q->head.store(0);
+  q->tail.store(0);
+  q->policy.store(policy);
+  q->queued.store(0);
+  q->dropped.store(0);
+  q->conflated.store(0);
+  q->waiters.store(0);
+  q->dirty.store(0);
+  q->taken = 0;
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->cond, NULL);
+  return q;
+}
+
+// Only once no subscription can produce into it any more
+static void pyca_evqueue_free(pyca_evqueue* q)
+{
+  // Dirty PVs must be able to notify the next queue
+  capv* lists[2] = {q->dirty.load(), q->taken};
+  for (int i=0; i<2; i++) {
+    for (capv* pv = lists[i]; pv; pv = pv->latest->next) {
+      pv->latest->dirty.store(0);
+    }
+  }
+  for (size_t i=0; i<=q->mask; i++) {
+    delete [] q->events[i].buffer;
+  }
+  delete [] q->events;
+  pthread_cond_destroy(&q->cond);
+  pthread_mutex_destroy(&q->lock);
+  delete q;
+}
+
+static inline size_t pyca_evqueue_capacity(const pyca_evqueue* q)
+{
+  return q->mask + 1;
+}
+
+// Wake up consumers waiting for events
+static void pyca_evqueue_notify(pyca_evqueue* q)
+{
+  if (q->waiters.load() > 0) {
+    pthread_mutex_lock(&q->lock);
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+  }
+}
+
+// Claim a free slot to fill, NULL if the queue is full
+static pyca_event* pyca_evqueue_claim_push(pyca_evqueue* q)
+{
+  size_t pos = q->head.load(std::memory_order_relaxed);
+  for (;;) {
+    pyca_event* ev = &q->events[pos & q->mask];
+    size_t seq = ev->seq.load(std::memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0) {
+      if (q->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        return ev;
+      }
+    } else if (diff < 0) {
+      return NULL;
+    } else {
+      pos = q->head.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+// Make a slot claimed with pyca_evqueue_claim_push visible to consumers
+static void pyca_evqueue_publish(pyca_evqueue* q, pyca_event* ev)
+{
+  ev->seq.store(ev->seq.load(std::memory_order_relaxed) + 1);
+  q->queued++;
+  pyca_evqueue_notify(q);
+}
+
+// Claim the oldest filled slot, NULL if the queue is empty
+static pyca_event* pyca_evqueue_claim_pop(pyca_evqueue* q)
+{
+  size_t pos = q->tail.load(std::memory_order_relaxed);
+  for (;;) {
+    pyca_event* ev = &q->events[pos & q->mask];
+    size_t seq = ev->seq.load(std::memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (diff == 0) {
+      if (q->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        return ev;
+      }
+    } else if (diff < 0) {
+      return NULL;
+    } else {
+      pos = q->tail.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+// Give a slot claimed with pyca_evqueue_claim_pop back to producers
+static void pyca_evqueue_release(pyca_evqueue* q, pyca_event* ev)
+{
+  ev->seq.store(ev->seq.load(std::memory_order_relaxed) + q->mask,
+                std::memory_order_release);
+}
+
+// Number of events waiting to be drained (approximate while producing)
+static size_t pyca_evqueue_size(const pyca_evqueue* q)
+{
+  size_t head = q->head.load();
+  size_t tail = q->tail.load();
+  return head > tail ? head - tail : 0;
+}
+
+// Whether the oldest slot has been published and can be drained, or a
+// conflated PV is dirty
+static bool pyca_evqueue_ready(pyca_evqueue* q)
+{
+  size_t pos = q->tail.load();
+  return q->events[pos & q->mask].seq.load() == pos + 1 || q->dirty.load();
+}
+
+// Push pv on the dirty list, unless it is already there
+static void pyca_evqueue_mark_dirty(pyca_evqueue* q, capv* pv)
+{
+  pyca_latest* latest = pv->latest;
+  if (latest->dirty.exchange(1)) {
+    return;
+  }
+  capv* head = q->dirty.load();
+  do {
+    latest->next = head;
+  } while (!q->dirty.compare_exchange_weak(head, pv));
+  pyca_evqueue_notify(q);
+}
+
+// Next dirty PV to drain, in the order they became dirty. Called with
+// the GIL. The PV is no longer dirty once returned, so updates arriving
+// while it is decoded notify again.
+static capv* pyca_evqueue_next_dirty(pyca_evqueue* q)
+{
+  if (!q->taken) {
+    // The list is newest first, reverse it
+    capv* pv = q->dirty.exchange(0);
+    while (pv) {
+      capv* next = pv->latest->next;
+      pv->latest->next = q->taken;
+      q->taken = pv;
+      pv = next;
+    }
+  }
+  capv* pv = q->taken;
+  if (pv) {
+    q->taken = pv->latest->next;
+    pv->latest->dirty.store(0);
+  }
+  return pv;
+}
+
+// Take a conflated pv off the dirty lists and discard the event it had
+// pending there.
+// Called with the GIL once its subscription is cleared, so that it can
+// not be marked dirty again.
+static void pyca_evqueue_unlink_dirty(pyca_evqueue* q, capv* pv)
+{
+  pyca_latest* latest = pv->latest;
+  if (latest->dirty.load()) {
+    // Other PVs may still be pushed on the lock-free list: move it behind
+    // the taken ones, where the order is kept, and unlink pv there
+    capv* older = 0;
+    capv* dirty = q->dirty.exchange(0);
+    while (dirty) {
+      capv* next = dirty->latest->next;
+      dirty->latest->next = older;
+      older = dirty;
+      dirty = next;
+    }
+    capv** link = &q->taken;
+    while (*link) {
+      link = &(*link)->latest->next;
+    }
+    *link = older;
+    for (link = &q->taken; *link; link = &(*link)->latest->next) {
+      if (*link == pv) {
+        *link = latest->next;
+        break;
+      }
+    }
+    latest->next = 0;
+    latest->dirty.store(0);
+    pthread_mutex_lock(&latest->lock);
+    latest->fresh = 0;
+    pthread_mutex_unlock(&latest->lock);
+  }
+}
+
+// Drop the events of pv still in the queue. Called with the GIL once
+// its subscription is cleared, so that no more of them can be pushed.
+// Slots are only marked dead: producers and consumers may be moving
+// them, and one reused by another PV meanwhile is left alone.
+static void pyca_evqueue_forget(pyca_evqueue* q, capv* pv)
+{
+  size_t head = q->head.load();
+  for (size_t pos = q->tail.load(); pos < head; pos++) {
+    capv* expected = pv;
+    q->events[pos & q->mask].pv.compare_exchange_strong(expected, NULL);
+  }
+  if (pv->latest) {
+    pyca_evqueue_unlink_dirty(q, pv);
+  }
+}
+
+// Copy one monitor event in the queue, applying the overflow policy
+// when it is full. Called by the CA thread without the GIL. Returns
+// false if the event was dropped.
+static bool pyca_evqueue_push(pyca_evqueue* q, struct event_handler_args& args)
+{
+  pyca_event* ev = pyca_evqueue_claim_push(q);
+  // Bounded retries: other producers may refill the room we make
+  for (int retry=0; !ev && retry<4; retry++) {
+    if (q->policy.load(std::memory_order_relaxed) != PYCA_DROP_OLDEST) {
+      break;
+    }
+    pyca_event* old = pyca_evqueue_claim_pop(q);
+    if (old) {
+      capv* oldpv = old->pv.load();
+      if (oldpv) {
+        pyca_stat_add(oldpv, PYCA_STAT_DROPPED, 1);
+      }
+      pyca_evqueue_release(q, old);
+      q->dropped++;
+    }
+    ev = pyca_evqueue_claim_push(q);
+  }
+  if (!ev) {
+    pyca_stat_add(reinterpret_cast<capv*>(args.usr), PYCA_STAT_DROPPED, 1);
+    q->dropped++;
+    return false;
+  }
+  ev->pv = reinterpret_cast<capv*>(args.usr);
+  ev->dbr_type = args.type;
+  ev->count = args.count;
+  ev->status = args.status;
+  if (args.status == ECA_NORMAL && args.dbr) {
+    unsigned size = dbr_size_n(args.type, args.count);
+    if (size > ev->bufsiz) {
+      delete [] ev->buffer;
+      ev->buffer = new char[size];
+      ev->bufsiz = size;
+    }
+    memcpy(ev->buffer, args.dbr, size);
+  }
+  pyca_evqueue_publish(q, ev);
+  return true;
+}
+
+// Block until the queue is not empty or the timeout expires. Must be
+// called without the GIL. Returns false on timeout.
+static bool pyca_evqueue_wait(pyca_evqueue* q, double timeout)
+{
+  struct timespec deadline;
+  pyca_deadline(timeout, &deadline);
+  bool ready = true;
+  pthread_mutex_lock(&q->lock);
+  q->waiters++;
+  while (!pyca_evqueue_ready(q)) {
+    if (pthread_cond_timedwait(&q->cond, &q->lock, &deadline) == ETIMEDOUT) {
+      ready = pyca_evqueue_ready(q);
+      break;
+    }
+  }
+  q->waiters--;
+  pthread_mutex_unlock(&q->lock);
+  return ready;
+}
+
+// The event queue shared by all queued subscriptions, created on first
+// use, and the number of subscriptions currently feeding it
+static const size_t pyca_evqueue_default_capacity = 1024;
+static pyca_evqueue* pyca_events = 0;
+static long pyca_queued_subscriptions = 0;
+
+// - queued monitor data events, only copied into the event queue
+static void pyca_queued_monitor_handler(struct event_handler_args args)
+{
+  if (pyca_monitor_taps(reinterpret_cast<capv*>(args.usr), args)) {
+    return;
+  }
+  pyca_evqueue_push(pyca_events, args);
+}
+
+// - conflated monitor data events, only the latest is kept
+static void pyca_conflated_monitor_handler(struct event_handler_args args)
+{
+  capv* pv = reinterpret_cast<capv*>(args.usr);
+  if (pyca_monitor_taps(pv, args)) {
+    return;
+  }
+  bool overwritten = pyca_latest_store(pv, args);
+  pyca_events->queued++;
+  if (overwritten) {
+    pyca_stat_add(pv, PYCA_STAT_CONFLATED, 1);
+    pyca_events->conflated++;
+  }
+  pyca_evqueue_mark_dirty(pyca_events, pv);
+}
@@ -97,6 +97,113 @@ int _numpy_array_type(const dbr_double_t*)
   return NPY_FLOAT64;
 }
 
+// Size of an element of the arrays of typenum: strings are fixed size
+static inline int _pyca_array_itemsize(int typenum)
+{
+  return typenum == NPY_STRING ? MAX_STRING_SIZE : 0;
+}
+
+// New uninitialized array of count elements of typenum
+static inline PyObject* _pyca_new_array(int typenum, long count)
+{
+  npy_intp dims[1] = {count};
+  return PyArray_New(&PyArray_Type, 1, dims, typenum, NULL, NULL,
+                     _pyca_array_itemsize(typenum), 0, NULL);
+}
+
+// Whether a pooled array can receive count elements of typenum in place
+static inline bool _pyca_array_fits(PyObject* obj, int typenum, long count)
+{
+  if (!PyArray_Check(obj)) {
+    return false;
+  }
+  PyArrayObject* arr = reinterpret_cast<PyArrayObject*>(obj);
+  return PyArray_TYPE(arr) == typenum &&
+    PyArray_SIZE(arr) == count &&
+    (typenum != NPY_STRING || PyArray_ITEMSIZE(arr) == MAX_STRING_SIZE) &&
+    PyArray_ISCARRAY(arr);
+}
+
+// Next array of the PV's pool to fill with count elements of typenum,
+// NULL if the PV has no pool or its user supplied array does not fit.
+// Pool arrays are (re)allocated here when they do not fit the event.
+static PyObject* _pyca_pool_array(capv* pv, int typenum, long count)
+{
+  if (!pv->arrays) {
+    return NULL;
+  }
+  Py_ssize_t depth = PyList_GET_SIZE(pv->arrays);
+  if (pv->nextarray >= depth) {
+    pv->nextarray = 0;
+  }
+  PyObject* nparray = PyList_GET_ITEM(pv->arrays, pv->nextarray);
+  if (!_pyca_array_fits(nparray, typenum, count)) {
+    if (pv->userarrays) {
+      return NULL;
+    }
+    nparray = _pyca_new_array(typenum, count);
+    if (!nparray) {
+      PyErr_Clear();
+      return NULL;
+    }
+    PyList_SetItem(pv->arrays, pv->nextarray, nparray);
+    pyca_stat_add(pv, PYCA_STAT_REALLOCS, 1);
+  }
+  pv->nextarray = (pv->nextarray + 1) % depth;
+  Py_INCREF(nparray);
+  return nparray;
+}
+
+// Numpy type of the values of a DBR type, as in the table above
+static int _numpy_dbr_type(short dbr_type)
+{
+  switch (dbr_type % (LAST_TYPE+1)) {
+  case DBR_STRING:
+    return NPY_STRING;
+  case DBR_ENUM:
+    return NPY_UINT16;
+  case DBR_CHAR:
+    return NPY_UINT8;
+  case DBR_SHORT:
+    return NPY_INT16;
+  case DBR_LONG:
+    return NPY_INT32;
+  case DBR_FLOAT:
+    return NPY_FLOAT32;
+  default:
+    return NPY_FLOAT64;
+  }
+}
+
+// Alarm status, severity and time stamp of a DBR structure, zero where
+// the DBR type does not carry them
+struct pyca_dbr_meta {
+  dbr_short_t status;
+  dbr_short_t severity;
+  dbr_ulong_t secs;
+  dbr_ulong_t nsec;
+};
+
+static inline void _pyca_dbr_meta(const void* dbr, short dbr_type, pyca_dbr_meta* meta)
+{
+  // All the DBR structures which are not plain start with status and severity
+  const struct dbr_time_short* tdbr = reinterpret_cast<const struct dbr_time_short*>(dbr);
+  if (dbr_type_is_plain(dbr_type)) {
+    meta->status = 0;
+    meta->severity = 0;
+  } else {
+    meta->status = tdbr->status;
+    meta->severity = tdbr->severity;
+  }
+  if (dbr_type_is_TIME(dbr_type)) {
+    meta->secs = tdbr->stamp.secPastEpoch;
+    meta->nsec = tdbr->stamp.nsec;
+  } else {
+    meta->secs = 0;
+    meta->nsec = 0;
+  }
+}
+
 template<class T> static inline
 PyObject* _pyca_get_value(capv* pv, const T* dbrv, long count)
 {
@@ -105,10 +212,15 @@ PyObject* _pyca_get_value(capv* pv, const T* dbrv, long count)
   } else {
     if (!pv->processor) {
       if (PyObject_IsTrue(pv->use_numpy)) {
-        npy_intp dims[1] = {count};
         int typenum = _numpy_array_type(&(dbrv->value));
-        PyObject* nparray = PyArray_EMPTY(1, dims, typenum, 0);
-        PyArrayObject *arr = (PyArrayObject *)PyArray_FROM_O(nparray);
+        PyObject* nparray = _pyca_pool_array(pv, typenum, count);
+        if (!nparray) {
+          nparray = _pyca_new_array(typenum, count);
+          if (!nparray) {
+            return NULL;
+          }
+        }
+        PyArrayObject* arr = reinterpret_cast<PyArrayObject*>(nparray);
         memcpy(PyArray_DATA(arr), &(dbrv->value), count*sizeof(dbrv->value));
         return nparray;
       } else {
@@ -157,13 +269,12 @@ void _pyca_get_time(capv* pv, const T* dbrv, long count)
 
 }
 
-// Copy channel access control objects into python
+// Copy channel access control limits into python, leaving out the
+// status and the value
 template<class T> static inline
-void _pyca_get_ctrl_long(capv* pv, const T* dbrv, long count)
+void _pyca_get_limits(capv* pv, const T* dbrv)
 {
   PyObject* pydata = pv->data;
-  _pyca_setitem(pydata, "status",      _pyca_get(dbrv->status));
-  _pyca_setitem(pydata, "severity",    _pyca_get(dbrv->severity));
   _pyca_setitem(pydata, "units",       _pyca_get(dbrv->units));
   _pyca_setitem(pydata, "display_llim",_pyca_get(dbrv->lower_disp_limit));
   _pyca_setitem(pydata, "display_hlim",_pyca_get(dbrv->upper_disp_limit));
@@ -173,6 +284,23 @@ void _pyca_get_ctrl_long(capv* pv, const T* dbrv, long count)
   _pyca_setitem(pydata, "alarm_hlim",  _pyca_get(dbrv->upper_alarm_limit));
   _pyca_setitem(pydata, "ctrl_llim",   _pyca_get(dbrv->lower_ctrl_limit));
   _pyca_setitem(pydata, "ctrl_hlim",   _pyca_get(dbrv->upper_ctrl_limit));
+}
+
+template<class T> static inline
+void _pyca_get_limits_double(capv* pv, const T* dbrv)
+{
+  _pyca_setitem(pv->data, "precision", _pyca_get(dbrv->precision));
+  _pyca_get_limits(pv, dbrv);
+}
+
+// Copy channel access control objects into python
+template<class T> static inline
+void _pyca_get_ctrl_long(capv* pv, const T* dbrv, long count)
+{
+  PyObject* pydata = pv->data;
+  _pyca_setitem(pydata, "status",      _pyca_get(dbrv->status));
+  _pyca_setitem(pydata, "severity",    _pyca_get(dbrv->severity));
+  _pyca_get_limits(pv, dbrv);
   _pyca_setitem(pydata, "value",       _pyca_get_value(pv, dbrv, count));
 }
 
@@ -192,36 +320,56 @@ void _pyca_get_ctrl_double(capv* pv, const T* dbrv, long count)
   PyObject* pydata = pv->data;
   _pyca_setitem(pydata, "status",      _pyca_get(dbrv->status));
   _pyca_setitem(pydata, "severity",    _pyca_get(dbrv->severity));
-  _pyca_setitem(pydata, "precision",   _pyca_get(dbrv->precision));
-  _pyca_setitem(pydata, "units",       _pyca_get(dbrv->units));
-  _pyca_setitem(pydata, "display_llim",_pyca_get(dbrv->lower_disp_limit));
-  _pyca_setitem(pydata, "display_hlim",_pyca_get(dbrv->upper_disp_limit));
-  _pyca_setitem(pydata, "warn_llim",   _pyca_get(dbrv->lower_warning_limit));
-  _pyca_setitem(pydata, "warn_hlim",   _pyca_get(dbrv->upper_warning_limit));
-  _pyca_setitem(pydata, "alarm_llim",  _pyca_get(dbrv->lower_alarm_limit));
-  _pyca_setitem(pydata, "alarm_hlim",  _pyca_get(dbrv->upper_alarm_limit));
-  _pyca_setitem(pydata, "ctrl_llim",   _pyca_get(dbrv->lower_ctrl_limit));
-  _pyca_setitem(pydata, "ctrl_hlim",   _pyca_get(dbrv->upper_ctrl_limit));
+  _pyca_get_limits_double(pv, dbrv);
   _pyca_setitem(pydata, "value",       _pyca_get_value(pv, dbrv, count));
 }
 
+// Enum strings cache of pv, allocated on first use. The connection
+// handler reads it without the GIL, publish it only once initialized.
+static pyca_enums* _pyca_enums(capv* pv)
+{
+  if (!pv->enums) {
+    pyca_enums* enums = pyca_enums_new();
+    std::atomic_thread_fence(std::memory_order_release);
+    pv->enums = enums;
+  }
+  return pv->enums;
+}
+
+// Keep the enum strings of a DBR_GR_ENUM or DBR_CTRL_ENUM event and
+// copy them into python
+template<class T> static inline
+void _pyca_get_enum_set(capv* pv, const T* dbrv)
+{
+  pyca_enums* enums = _pyca_enums(pv);
+  pyca_enums_store(enums, dbrv->no_str, dbrv->strs);
+  PyObject* enstrs = pyca_enums_tuple(enums);
+  Py_XINCREF(enstrs);
+  _pyca_setitem(pv->data, "enum_set", enstrs);
+}
+
 static inline
 void _pyca_get_gr_enum(capv* pv, const struct dbr_gr_enum* dbrv, long count)
 {
-  PyObject* pydata = pv->data;
-  PyObject* enstrs = PyTuple_New(dbrv->no_str);
-  for (int i=0; i < dbrv->no_str; i++) {
-    // TODO:  This is no bueno.  We need a new accessor above for
-    //        char arrays...
-    PyTuple_SET_ITEM(enstrs, i, _pyca_get(dbrv->strs[i]));
+  _pyca_get_enum_set(pv, dbrv);
+}
+
+// String of the value of an enum event, converted with the cached enum
+// strings; None for arrays or if the strings are not known
+template<class T> static inline
+PyObject* _pyca_get_enum_str(capv* pv, const T* dbrv, long count)
+{
+  if (count != 1) {
+    Py_RETURN_NONE;
   }
-  _pyca_setitem(pydata, "enum_set", enstrs);
+  return pyca_enums_str(pv->enums, dbrv->value);
 }
 
-static const void* _pyca_event_process(capv* pv,
-                                       const void* buffer,
-                                       short dbr_type,
-                                       long count)
+// Decode an event into the data dictionary of pv
+static const void* _pyca_event_decode(capv* pv,
+                                      const void* buffer,
+                                      short dbr_type,
+                                      long count)
 {
   const db_access_val* dbr = reinterpret_cast<const db_access_val*>(buffer);
   switch (dbr_type) {
@@ -233,6 +381,7 @@ static const void* _pyca_event_process(capv* pv,
     break;
   case DBR_TIME_ENUM:
     _pyca_get_time(pv, &dbr->tenmval, count);
+    _pyca_setitem(pv->data, "enum_str", _pyca_get_enum_str(pv, &dbr->tenmval, count));
     break;
   case DBR_TIME_CHAR:
     _pyca_get_time(pv, &dbr->tchrval, count);
@@ -254,6 +403,7 @@ static const void* _pyca_event_process(capv* pv,
     break;
   case DBR_CTRL_ENUM:
     _pyca_get_ctrl_enum(pv, &dbr->cenmval, count);
+    _pyca_setitem(pv->data, "enum_str", _pyca_get_enum_str(pv, &dbr->cenmval, count));
     break;
   case DBR_CTRL_CHAR:
     _pyca_get_ctrl_long(pv, &dbr->cchrval, count);
@@ -276,6 +426,42 @@ static const void* _pyca_event_process(capv* pv,
   return buffer;
 }
 
+// Decode only the control data of a DBR_CTRL event into the data
+// dictionary of pv, as sent by DBE_PROPERTY subscriptions
+static const void* _pyca_ctrl_decode(capv* pv,
+                                     const void* buffer,
+                                     short dbr_type)
+{
+  const db_access_val* dbr = reinterpret_cast<const db_access_val*>(buffer);
+  switch (dbr_type) {
+  case DBR_CTRL_STRING:
+    // Strings have no control data
+    break;
+  case DBR_CTRL_ENUM:
+    _pyca_setitem(pv->data, "no_str", _pyca_get(dbr->cenmval.no_str));
+    _pyca_get_enum_set(pv, &dbr->cenmval);
+    break;
+  case DBR_CTRL_CHAR:
+    _pyca_get_limits(pv, &dbr->cchrval);
+    break;
+  case DBR_CTRL_SHORT:
+    _pyca_get_limits(pv, &dbr->cshrtval);
+    break;
+  case DBR_CTRL_LONG:
+    _pyca_get_limits(pv, &dbr->clngval);
+    break;
+  case DBR_CTRL_FLOAT:
+    _pyca_get_limits_double(pv, &dbr->cfltval);
+    break;
+  case DBR_CTRL_DOUBLE:
+    _pyca_get_limits_double(pv, &dbr->cdblval);
+    break;
+  default:
+    return NULL;
+  }
+  return buffer;
+}
+
 static void* _pyca_adjust_buffer_size(capv* pv,
                                       short dbr_type,
                                       long count,
@@ -332,6 +518,7 @@ static void* _pyca_adjust_buffer_size(capv* pv,
     delete [] pv->getbuffer;
     pv->getbuffer = new char[size];
     pv->getbufsiz = size;
+    pyca_stat_add(pv, PYCA_STAT_REALLOCS, 1);
   }
   return pv->getbuffer;
 }
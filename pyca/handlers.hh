@@ -1,15 +1,167 @@
 #include "p3compat.h"
-// Utility function to pack eventual arguments for callback
-PyObject* pyca_new_cbtuple(PyObject* arg)
+// Native connection table: every capv keeps its connection state,
+// updated by the CA thread without the GIL, and waiters are woken up
+// through a single condition variable.
+static pthread_mutex_t pyca_conn_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pyca_conn_cond = PTHREAD_COND_INITIALIZER;
+
+static void pyca_set_connected(capv* pv, int isconn)
+{
+  pthread_mutex_lock(&pyca_conn_lock);
+  pv->connected = isconn;
+  pthread_cond_broadcast(&pyca_conn_cond);
+  pthread_mutex_unlock(&pyca_conn_lock);
+}
+
+// Native processing of a monitor event, before it is handed to Python.
+// Called by the CA thread without the GIL. Returns true if the event
+// was consumed by the processor of the PV and must not reach Python.
+static bool pyca_monitor_taps(capv* pv, struct event_handler_args& args)
+{
+  pyca_stat_event(pv, args);
+  pyca_latency* latency = pv->latency.load(std::memory_order_acquire);
+  if (latency) {
+    pyca_latency_transport(latency, args);
+  }
+  pyca_history* history = pv->history.load(std::memory_order_acquire);
+  if (history) {
+    pyca_history_record(history, args);
+  }
+  pyca_accum* accum = pv->accum.load(std::memory_order_acquire);
+  if (accum) {
+    pyca_accum_record(accum, args);
+  }
+  pyca_shm_pub* shm = pv->shm.load(std::memory_order_acquire);
+  if (shm) {
+    pyca_shm_publish(shm, args);
+  }
+  pyca_rec_tap* rectap = pv->rectap.load(std::memory_order_acquire);
+  if (rectap) {
+    pyca_rec_tap_record(rectap, args);
+  }
+  pyca_proc* proc = pv->proc.load(std::memory_order_acquire);
+  if (proc) {
+    return pyca_proc_run(proc, PYCA_PROCESSOR_MONITOR, args);
+  }
+  return false;
+}
+
+// Native processing of a get event, same as above
+static void pyca_get_taps(capv* pv, struct event_handler_args& args)
+{
+  pyca_stat_event(pv, args);
+  pyca_proc* proc = pv->proc.load(std::memory_order_acquire);
+  if (proc) {
+    pyca_proc_run(proc, PYCA_PROCESSOR_GET, args);
+  }
+}
+
+// Call a user callback of pv with the arguments arg0 and arg1, either
+// NULL for fewer arguments, whose references are stolen. Its exceptions
+// can't go anywhere, report them.
+static void pyca_call_cb(capv* pv, PyObject* cb, PyObject* arg0, PyObject* arg1 = NULL)
+{
+  pyca_trace_begin(PYCA_TRACE_CALLBACK, pv);
+  unsigned long long start = pyca_stat_now();
+  size_t nargs = arg1 ? 2 : arg0 ? 1 : 0;
+#if PY_VERSION_HEX >= 0x03090000
+  // Arguments on the stack, with a free slot in front for bound methods
+  PyObject* argv[3] = {NULL, arg0, arg1};
+  PyObject* res = PyObject_Vectorcall(cb, argv + 1, nargs | PY_VECTORCALL_ARGUMENTS_OFFSET,
+                                      NULL);
+  Py_XDECREF(arg0);
+  Py_XDECREF(arg1);
+#else
+  PyObject* pytup = PyTuple_New(nargs);
+  if (arg0) {
+    PyTuple_SET_ITEM(pytup, 0, arg0);
+  }
+  if (arg1) {
+    PyTuple_SET_ITEM(pytup, 1, arg1);
+  }
+  PyObject* res = PyObject_Call(cb, pytup, NULL);
+  Py_DECREF(pytup);
+#endif
+  pyca_stat_time(pv, PYCA_STAT_CALLBACK_NS, start);
+  pyca_trace_end(PYCA_TRACE_CALLBACK, pv);
+  if (!res) {
+    pyca_stat_add(pv, PYCA_STAT_CALLBACK_ERRORS, 1);
+    PyErr_WriteUnraisable(cb);
+  }
+  Py_XDECREF(res);
+}
+
+// Dispatch of the events to Python, called with the GIL either by the
+// handlers below or by pyca.dispatch_pending() for deferred events
+static void _pyca_connect_dispatch(capv* pv, long isconn)
+{
+  if (pv->connect_cb && PyCallable_Check(pv->connect_cb)) {
+    PyObject* pyisconn = PyBool_FromLong(isconn);
+    pyca_call_cb(pv, pv->connect_cb, pyisconn);
+  }
+}
+
+static void _pyca_rwaccess_dispatch(capv* pv, long readable, long writeable)
+{
+  if (pv->rwaccess_cb && PyCallable_Check(pv->rwaccess_cb)) {
+    PyObject* pyreadable = PyBool_FromLong(readable);
+    PyObject* pywriteable = PyBool_FromLong(writeable);
+    pyca_call_cb(pv, pv->rwaccess_cb, pyreadable, pywriteable);
+  }
+}
+
+// Decode a monitor or get event and call cb with its status
+static void _pyca_data_dispatch(capv* pv, PyObject* cb, const void* dbr,
+                                short dbr_type, long count, int status)
+{
+  PyObject* pyexc = NULL;
+  if (status == ECA_NORMAL) {
+    if (!_pyca_event_process(pv, dbr, dbr_type, count)) {
+      PyErr_Clear();
+      pyexc = pyca_data_status_msg(ECA_BADTYPE, pv);
+    }
+  } else {
+    pyexc = pyca_data_status_msg(status, pv);
+  }
+  if (cb && PyCallable_Check(cb)) {
+    pyca_call_cb(pv, cb, pyexc);
+  } else {
+    Py_XDECREF(pyexc);
+  }
+}
+
+// Control data goes to the dictionary, where the next value event finds
+// it. .monitor_cb() is left for the values, so that each of its calls
+// is one sample, and failures are reported by the value subscription.
+static void _pyca_property_dispatch(capv* pv, const void* dbr,
+                                    short dbr_type, int status)
 {
-  PyObject* pytup;
-  if (arg) {
-    pytup = PyTuple_New(1);
-    PyTuple_SET_ITEM(pytup, 0, arg);
+  if (status == ECA_NORMAL) {
+    // Bring the dictionary up to date first
+    _pyca_record_sync(pv);
+    _pyca_ctrl_decode(pv, dbr, dbr_type);
+  }
+}
+
+static void _pyca_putevent_dispatch(capv* pv, int status)
+{
+  PyObject* pyexc = NULL;
+  if (status != ECA_NORMAL) {
+    pyexc = pyca_data_status_msg(status, pv);
+  }
+  if (pv->putevt_cb && PyCallable_Check(pv->putevt_cb)) {
+    pyca_call_cb(pv, pv->putevt_cb, pyexc);
   } else {
-    pytup = PyTuple_New(0);
+    Py_XDECREF(pyexc);
+  }
+}
+
+// Completion of an asynchronous get answered without asking the IOC
+static void _pyca_cached_dispatch(capv* pv)
+{
+  if (pv->getevt_cb && PyCallable_Check(pv->getevt_cb)) {
+    pyca_call_cb(pv, pv->getevt_cb, NULL);
   }
-  return pytup;
 }
 
 // Callbacks invoked by EPICS channel access for:
@@ -18,38 +170,52 @@ static void pyca_connection_handler(struct connection_handler_args args)
 {
   capv* pv = reinterpret_cast<capv*>(ca_puser(args.chid));
   long isconn = (args.op == CA_OP_CONN_UP) ? 1 : 0;
-  PyGILState_STATE gstate = PyGILState_Ensure();
-  if (pv->connect_cb && PyCallable_Check(pv->connect_cb)) {
-    PyObject* pyisconn = PyBool_FromLong(isconn);
-    PyObject* pytup = pyca_new_cbtuple(pyisconn);
-    PyObject* res = PyObject_Call(pv->connect_cb, pytup, NULL);
-    Py_XDECREF(res);
-    Py_DECREF(pytup);
+  pyca_trace_begin(PYCA_TRACE_CONNECT, pv);
+  pyca_set_connected(pv, isconn);
+  if (pv->enums) {
+    // The strings may change while the IOC is away
+    pyca_enums_invalidate(pv->enums);
   }
-  PyGILState_Release(gstate);
+  // Without connect_cb there is nobody to notify, don't bother taking
+  // the GIL
+  if (pv->connect_cb &&
+      !pyca_defer(PYCA_DEFER_CONNECT, pv, isconn, 0, NULL, 0, 0)) {
+    PyGILState_STATE gstate = pyca_gil_ensure(pv);
+    _pyca_connect_dispatch(pv, isconn);
+    PyGILState_Release(gstate);
+  }
+  pyca_trace_end(PYCA_TRACE_CONNECT, pv);
 }
 
 // - monitor data events
 static void pyca_monitor_handler(struct event_handler_args args)
 {
   capv* pv = reinterpret_cast<capv*>(args.usr);
-  PyGILState_STATE gstate = PyGILState_Ensure();
-  PyObject* pyexc = NULL;
-  if (args.status == ECA_NORMAL) {
-    if (!_pyca_event_process(pv, args.dbr, args.type, args.count)) {
-      pyexc = pyca_data_status_msg(ECA_BADTYPE, pv);
-    }
-  } else {
-    pyexc = pyca_data_status_msg(args.status, pv);
+  unsigned long long entry = pyca_latency_entry(pv);
+  pyca_trace_begin(PYCA_TRACE_MONITOR, pv);
+  if (!pyca_monitor_taps(pv, args) &&
+      !pyca_defer(PYCA_DEFER_MONITOR, pv, args.status, 0,
+                  args.status == ECA_NORMAL ? args.dbr : NULL, args.type, args.count,
+                  entry)) {
+    PyGILState_STATE gstate = pyca_gil_ensure(pv);
+    _pyca_data_dispatch(pv, pv->monitor_cb, args.dbr, args.type, args.count, args.status);
+    pyca_latency_delivered(pv, entry);
+    PyGILState_Release(gstate);
   }
-  if (pv->monitor_cb && PyCallable_Check(pv->monitor_cb)) {
-    PyObject* pytup = pyca_new_cbtuple(pyexc);
-    PyObject* res = PyObject_Call(pv->monitor_cb, pytup, NULL);
-    Py_XDECREF(res);
-    Py_DECREF(pytup);
-  } else {
-    Py_XDECREF(pyexc);
+  pyca_trace_end(PYCA_TRACE_MONITOR, pv);
+}
+
+// - control data events of DBE_PROPERTY subscriptions, which only
+//   refresh the cached control data of the PV
+static void pyca_property_handler(struct event_handler_args args)
+{
+  capv* pv = reinterpret_cast<capv*>(args.usr);
+  if (pyca_defer(PYCA_DEFER_PROPERTY, pv, args.status, 0,
+                 args.status == ECA_NORMAL ? args.dbr : NULL, args.type, args.count)) {
+    return;
   }
+  PyGILState_STATE gstate = pyca_gil_ensure(pv);
+  _pyca_property_dispatch(pv, args.dbr, args.type, args.status);
   PyGILState_Release(gstate);
 }
 
@@ -58,17 +224,11 @@ static void pyca_access_rights_handler(struct access_rights_handler_args args)
     capv* pv = reinterpret_cast<capv*>(ca_puser(args.chid));
     long readable = args.ar.read_access;
     long writeable = args.ar.write_access;
-    PyGILState_STATE gstate = PyGILState_Ensure();
-    if (pv->rwaccess_cb && PyCallable_Check(pv->rwaccess_cb)) {
-      PyObject* pyreadable = PyBool_FromLong(readable);
-      PyObject* pywriteable = PyBool_FromLong(writeable);
-      PyObject* rwtup = PyTuple_New(2);
-      PyTuple_SET_ITEM(rwtup, 0, pyreadable);
-      PyTuple_SET_ITEM(rwtup, 1, pywriteable);
-      PyObject* res = PyObject_Call(pv->rwaccess_cb, rwtup, NULL);
-      Py_XDECREF(res);
-      Py_DECREF(rwtup);
+    if (pyca_defer(PYCA_DEFER_RWACCESS, pv, readable, writeable, NULL, 0, 0)) {
+      return;
     }
+    PyGILState_STATE gstate = pyca_gil_ensure(pv);
+    _pyca_rwaccess_dispatch(pv, readable, writeable);
     PyGILState_Release(gstate);
 }
 
@@ -76,42 +236,114 @@ static void pyca_access_rights_handler(struct access_rights_handler_args args)
 static void pyca_getevent_handler(struct event_handler_args args)
 {
   capv* pv = reinterpret_cast<capv*>(args.usr);
-  PyGILState_STATE gstate = PyGILState_Ensure();
-  PyObject* pyexc = NULL;
-  if (args.status == ECA_NORMAL) {
-    if (!_pyca_event_process(pv, args.dbr, args.type, args.count)) {
-      pyexc = pyca_data_status_msg(ECA_BADTYPE, pv);
-    }
-  } else {
-    pyexc = pyca_data_status_msg(args.status, pv);
-  }
-  if (pv->getevt_cb && PyCallable_Check(pv->getevt_cb)) {
-    PyObject* pytup = pyca_new_cbtuple(pyexc);
-    PyObject* res = PyObject_Call(pv->getevt_cb, pytup, NULL);
-    Py_XDECREF(res);
-    Py_DECREF(pytup);
-  } else {
-    Py_XDECREF(pyexc);
+  pyca_trace_begin(PYCA_TRACE_GET, pv);
+  pyca_get_taps(pv, args);
+  if (!pyca_defer(PYCA_DEFER_GET, pv, args.status, 0,
+                  args.status == ECA_NORMAL ? args.dbr : NULL, args.type, args.count)) {
+    PyGILState_STATE gstate = pyca_gil_ensure(pv);
+    _pyca_data_dispatch(pv, pv->getevt_cb, args.dbr, args.type, args.count, args.status);
+    PyGILState_Release(gstate);
   }
-  PyGILState_Release(gstate);
+  pyca_trace_end(PYCA_TRACE_GET, pv);
 }
 
 // - put data events
 static void pyca_putevent_handler(struct event_handler_args args)
 {
   capv* pv = reinterpret_cast<capv*>(args.usr);
-  PyGILState_STATE gstate = PyGILState_Ensure();
-  PyObject* pyexc = NULL;
-  if (args.status != ECA_NORMAL) {
-    pyexc = pyca_data_status_msg(args.status, pv);
+  pyca_trace_begin(PYCA_TRACE_PUT, pv);
+  if (!pyca_defer(PYCA_DEFER_PUT, pv, args.status, 0, NULL, 0, 0)) {
+    PyGILState_STATE gstate = pyca_gil_ensure(pv);
+    _pyca_putevent_dispatch(pv, args.status);
+    PyGILState_Release(gstate);
   }
-  if (pv->putevt_cb && PyCallable_Check(pv->putevt_cb)) {
-    PyObject* pytup = pyca_new_cbtuple(pyexc);
-    PyObject* res = PyObject_Call(pv->putevt_cb, pytup, NULL);
-    Py_XDECREF(res);
-    Py_DECREF(pytup);
-  } else {
-    Py_XDECREF(pyexc);
+  pyca_trace_end(PYCA_TRACE_PUT, pv);
+}
+
+// Dispatch a deferred event, with the GIL
+static void _pyca_deferred_dispatch(pyca_deferred* deferred)
+{
+  capv* pv = deferred->pv;
+  switch (deferred->kind) {
+  case PYCA_DEFER_CONNECT:
+    _pyca_connect_dispatch(pv, deferred->status);
+    break;
+  case PYCA_DEFER_RWACCESS:
+    _pyca_rwaccess_dispatch(pv, deferred->status, deferred->arg);
+    break;
+  case PYCA_DEFER_MONITOR:
+    _pyca_data_dispatch(pv, pv->monitor_cb, deferred->dbr, deferred->dbr_type,
+                        deferred->count, deferred->status);
+    pyca_latency_delivered(pv, deferred->entry);
+    break;
+  case PYCA_DEFER_PROPERTY:
+    _pyca_property_dispatch(pv, deferred->dbr, deferred->dbr_type, deferred->status);
+    break;
+  case PYCA_DEFER_GET:
+    _pyca_data_dispatch(pv, pv->getevt_cb, deferred->dbr, deferred->dbr_type,
+                        deferred->count, deferred->status);
+    break;
+  case PYCA_DEFER_PUT:
+    _pyca_putevent_dispatch(pv, deferred->status);
+    break;
+  case PYCA_DEFER_CACHED:
+    _pyca_cached_dispatch(pv);
+    break;
   }
+}
+
+// Dispatcher thread: runs the deferred events in batches, taking the
+// GIL once per batch. Its thread state is created once and kept, and it
+// is attached to the CA context like the CA threads running callbacks.
+static void* pyca_dispatcher_run(void* arg)
+{
+  pyca_dispatcher* dispatcher = reinterpret_cast<pyca_dispatcher*>(arg);
+  if (dispatcher->context) {
+    ca_attach_context(dispatcher->context);
+  }
+  PyGILState_STATE gstate = PyGILState_Ensure();
+  PyThreadState* tstate = PyEval_SaveThread();
+  unsigned long count;
+  pyca_notice* notices;
+  while ((notices = pyca_dispatcher_take(dispatcher, &count))) {
+    // Without the GIL, the PVs of the batch may be cleared meanwhile:
+    // the wait is traced without a PV, and accounted to the first one
+    // still there
+    pyca_trace_begin(PYCA_TRACE_GIL_WAIT, NULL);
+    unsigned long long start = pyca_stat_now();
+    PyEval_RestoreThread(tstate);
+    pyca_trace_end(PYCA_TRACE_GIL_WAIT, NULL);
+    bool waited = false;
+    unsigned long dispatched = 0;
+    for (pyca_notice* notice=notices; notice; notice=notice->next) {
+      pyca_deferred* deferred = reinterpret_cast<pyca_deferred*>(notice);
+      if (!deferred->pv) {
+        continue;
+      }
+      if (!waited) {
+        pyca_stat_time(deferred->pv, PYCA_STAT_GIL_WAIT_NS, start);
+        waited = true;
+      }
+      _pyca_deferred_dispatch(deferred);
+      dispatched++;
+    }
+    pthread_mutex_lock(&dispatcher->lock);
+    dispatcher->taken = 0;
+    pthread_mutex_unlock(&dispatcher->lock);
+    // Counted before callers can see the effects of the batch
+    dispatcher->batches++;
+    dispatcher->dispatched += dispatched;
+    tstate = PyEval_SaveThread();
+    while (notices) {
+      pyca_deferred* deferred = reinterpret_cast<pyca_deferred*>(notices);
+      notices = notices->next;
+      pyca_deferred_release(deferred);
+    }
+  }
+  PyEval_RestoreThread(tstate);
   PyGILState_Release(gstate);
+  if (dispatcher->context) {
+    ca_detach_context();
+  }
+  return NULL;
 }
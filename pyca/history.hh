@@ -0,0 +1,124 @@
+#include "p3compat.h"
+// Fixed capacity history of the monitor events of a PV.
+//
+// The monitor handlers record every update in the ring of the PV, in
+// the CA thread and without the GIL, before anything is decoded into
+// Python objects. Values, timestamps, status and severity are stored in
+// contiguous typed arrays, so reading the history back only wraps or
+// copies these arrays into numpy arrays.
+#include <atomic>
+
+// Storage of a history, owned by a capsule so that numpy views handed
+// out to Python keep it alive after the PV moved to a new storage
+struct pyca_history_data {
+  short type;           // DBR value type (DBR_STRING ... DBR_DOUBLE)
+  long nelm;            // elements per sample
+  unsigned elsize;      // bytes per element
+  long capacity;        // samples
+  char* values;         // capacity x nelm elements
+  dbr_ulong_t* secs;
+  dbr_ulong_t* nsec;
+  dbr_short_t* status;
+  dbr_short_t* severity;
+};
+
+// History state of a PV, allocated once and kept for the PV lifetime
+struct pyca_history {
+  pthread_mutex_t lock;
+  pyca_history_data* data;
+  PyObject* pydata;     // capsule owning data
+  long head;            // next sample to write
+  long size;            // samples stored
+  unsigned long total;  // samples recorded since started
+  unsigned long skipped;// events of another type than the history
+  int active;           // recording
+};
+
+static void pyca_history_data_delete(pyca_history_data* data)
+{
+  delete [] data->values;
+  delete [] data->secs;
+  delete [] data->nsec;
+  delete [] data->status;
+  delete [] data->severity;
+  delete data;
+}
+
+static void pyca_history_data_free(PyObject* capsule)
+{
+  pyca_history_data_delete(reinterpret_cast<pyca_history_data*>(
+    PyCapsule_GetPointer(capsule, "pyca.history")));
+}
+
+// Allocate a storage for capacity samples of nelm elements of type
+static PyObject* pyca_history_data_new(short type, long nelm, long capacity)
+{
+  pyca_history_data* data = new pyca_history_data;
+  data->type = type;
+  data->nelm = nelm;
+  data->elsize = dbr_value_size[type];
+  data->capacity = capacity;
+  data->values = new char[(size_t)capacity * nelm * data->elsize];
+  data->secs = new dbr_ulong_t[capacity];
+  data->nsec = new dbr_ulong_t[capacity];
+  data->status = new dbr_short_t[capacity];
+  data->severity = new dbr_short_t[capacity];
+  PyObject* capsule = PyCapsule_New(data, "pyca.history", pyca_history_data_free);
+  if (!capsule) {
+    pyca_history_data_delete(data);
+  }
+  return capsule;
+}
+
+static pyca_history* pyca_history_new()
+{
+  pyca_history* history = new pyca_history;
+  pthread_mutex_init(&history->lock, NULL);
+  history->data = 0;
+  history->pydata = 0;
+  history->head = 0;
+  history->size = 0;
+  history->total = 0;
+  history->skipped = 0;
+  history->active = 0;
+  return history;
+}
+
+// Record a monitor event. Called by the CA thread without the GIL.
+static void pyca_history_record(pyca_history* history, struct event_handler_args& args)
+{
+  if (args.status != ECA_NORMAL || !args.dbr) {
+    return;
+  }
+  pthread_mutex_lock(&history->lock);
+  pyca_history_data* data = history->data;
+  if (!history->active || !data) {
+    pthread_mutex_unlock(&history->lock);
+    return;
+  }
+  if (args.type % (LAST_TYPE+1) != data->type) {
+    history->skipped++;
+    pthread_mutex_unlock(&history->lock);
+    return;
+  }
+  long slot = history->head;
+  size_t nbytes = (size_t)data->nelm * data->elsize;
+  size_t count = args.count < data->nelm ? args.count : data->nelm;
+  char* dst = data->values + slot * nbytes;
+  memcpy(dst, dbr_value_ptr(args.dbr, args.type), count * data->elsize);
+  if (count * data->elsize < nbytes) {
+    memset(dst + count * data->elsize, 0, nbytes - count * data->elsize);
+  }
+  pyca_dbr_meta meta;
+  _pyca_dbr_meta(args.dbr, args.type, &meta);
+  data->status[slot] = meta.status;
+  data->severity[slot] = meta.severity;
+  data->secs[slot] = meta.secs;
+  data->nsec[slot] = meta.nsec;
+  history->head = (slot + 1) % data->capacity;
+  if (history->size < data->capacity) {
+    history->size++;
+  }
+  history->total++;
+  pthread_mutex_unlock(&history->lock);
+}
@@ -0,0 +1,189 @@
+#include "p3compat.h"
+// Latency histograms of the monitor events of a PV.
+//
+// Two latencies are measured per subscription: transport, from the IOC
+// time stamp of a DBR_TIME event to the entry of the CA callback (so it
+// includes the clock offset between the IOC and this host), and
+// delivery, from the entry of the CA callback to the return of
+// monitor_cb, run directly or deferred. Both go into log-linear
+// histograms of nanoseconds in the style of HdrHistogram: exact below
+// 64 ns, then 32 buckets per power of two, which bounds the error of a
+// percentile to about 3% over the whole 64 bit range. Histograms are
+// fixed size, so they can be merged by adding their buckets.
+#include <atomic>
+#include <stdint.h>
+#include <time.h>
+
+#define PYCA_HIST_SUB_BITS 5
+#define PYCA_HIST_SUB      (1 << PYCA_HIST_SUB_BITS)
+#define PYCA_HIST_BUCKETS  (2*PYCA_HIST_SUB + (64 - PYCA_HIST_SUB_BITS - 1)*PYCA_HIST_SUB)
+
+struct pyca_hist {
+  uint64_t count;
+  uint64_t min;
+  uint64_t max;
+  double sum;
+  uint64_t buckets[PYCA_HIST_BUCKETS];
+};
+
+static void pyca_hist_clear(pyca_hist* hist)
+{
+  memset(hist, 0, sizeof(*hist));
+}
+
+static inline int pyca_hist_index(uint64_t value)
+{
+  if (value < 2*PYCA_HIST_SUB) {
+    return (int)value;
+  }
+  int msb = 63 - __builtin_clzll(value);
+  int shift = msb - PYCA_HIST_SUB_BITS;
+  int top = (int)(value >> shift);
+  return 2*PYCA_HIST_SUB + (shift - 1)*PYCA_HIST_SUB + (top - PYCA_HIST_SUB);
+}
+
+// Smallest value and width of a bucket
+static inline void pyca_hist_bucket(int index, uint64_t* low, uint64_t* width)
+{
+  if (index < 2*PYCA_HIST_SUB) {
+    *low = index;
+    *width = 1;
+    return;
+  }
+  int shift = (index - 2*PYCA_HIST_SUB) / PYCA_HIST_SUB + 1;
+  uint64_t top = (index - 2*PYCA_HIST_SUB) % PYCA_HIST_SUB + PYCA_HIST_SUB;
+  *low = top << shift;
+  *width = (uint64_t)1 << shift;
+}
+
+static inline void pyca_hist_add(pyca_hist* hist, uint64_t value)
+{
+  if (!hist->count || value < hist->min) {
+    hist->min = value;
+  }
+  if (value > hist->max) {
+    hist->max = value;
+  }
+  hist->count++;
+  hist->sum += value;
+  hist->buckets[pyca_hist_index(value)]++;
+}
+
+static void pyca_hist_merge(pyca_hist* hist, const pyca_hist* other)
+{
+  if (!other->count) {
+    return;
+  }
+  if (!hist->count || other->min < hist->min) {
+    hist->min = other->min;
+  }
+  if (other->max > hist->max) {
+    hist->max = other->max;
+  }
+  hist->count += other->count;
+  hist->sum += other->sum;
+  for (int i=0; i<PYCA_HIST_BUCKETS; i++) {
+    hist->buckets[i] += other->buckets[i];
+  }
+}
+
+// Value below which lie percent % of the values: the middle of the
+// bucket of this rank, within the extremes. hist must not be empty.
+static uint64_t pyca_hist_percentile(const pyca_hist* hist, double percent)
+{
+  uint64_t rank = (uint64_t)ceil(percent / 100.0 * hist->count);
+  if (rank < 1) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (int i=0; i<PYCA_HIST_BUCKETS; i++) {
+    seen += hist->buckets[i];
+    if (seen >= rank) {
+      uint64_t low, width;
+      pyca_hist_bucket(i, &low, &width);
+      uint64_t value = low + (width - 1) / 2;
+      if (value < hist->min) {
+        return hist->min;
+      }
+      return value > hist->max ? hist->max : value;
+    }
+  }
+  return hist->max;
+}
+
+// Latency measurements of a PV, allocated once and kept for the PV
+// lifetime
+struct pyca_latency {
+  pthread_mutex_t lock;
+  std::atomic<int> active; // checked without the lock first
+  pyca_hist transport;
+  pyca_hist delivery;
+  unsigned long skewed; // events stamped in the future, counted as 0
+};
+
+static pyca_latency* pyca_latency_new()
+{
+  pyca_latency* latency = new pyca_latency;
+  pthread_mutex_init(&latency->lock, NULL);
+  latency->active = 0;
+  pyca_hist_clear(&latency->transport);
+  pyca_hist_clear(&latency->delivery);
+  latency->skewed = 0;
+  return latency;
+}
+
+static void pyca_latency_free(pyca_latency* latency)
+{
+  pthread_mutex_destroy(&latency->lock);
+  delete latency;
+}
+
+// Record the transport latency of a monitor event. Called by the CA
+// thread without the GIL.
+static void pyca_latency_transport(pyca_latency* latency, struct event_handler_args& args)
+{
+  if (!latency->active || args.status != ECA_NORMAL || !args.dbr ||
+      !dbr_type_is_TIME(args.type)) {
+    return;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  const struct dbr_time_short* dbr = reinterpret_cast<const struct dbr_time_short*>(args.dbr);
+  // EPICS time stamps count from 1990
+  int64_t stamp = ((int64_t)dbr->stamp.secPastEpoch + 7305 * 86400LL) * 1000000000LL +
+    dbr->stamp.nsec;
+  int64_t elapsed = ((int64_t)now.tv_sec * 1000000000LL + now.tv_nsec) - stamp;
+  pthread_mutex_lock(&latency->lock);
+  if (latency->active) {
+    if (elapsed < 0) {
+      latency->skewed++;
+      elapsed = 0;
+    }
+    pyca_hist_add(&latency->transport, (uint64_t)elapsed);
+  }
+  pthread_mutex_unlock(&latency->lock);
+}
+
+// Monotonic time of the entry of a CA callback for pv, 0 unless its
+// latency is measured
+static inline unsigned long long pyca_latency_entry(capv* pv)
+{
+  pyca_latency* latency = pv->latency.load(std::memory_order_acquire);
+  return latency && latency->active ? pyca_stat_now() : 0;
+}
+
+// Record the delivery latency of an event which entered the CA callback
+// at entry
+static inline void pyca_latency_delivered(capv* pv, unsigned long long entry)
+{
+  pyca_latency* latency = pv->latency.load(std::memory_order_acquire);
+  if (!entry || !latency) {
+    return;
+  }
+  unsigned long long elapsed = pyca_stat_now() - entry;
+  pthread_mutex_lock(&latency->lock);
+  if (latency->active) {
+    pyca_hist_add(&latency->delivery, elapsed);
+  }
+  pthread_mutex_unlock(&latency->lock);
+}
@@ -0,0 +1,105 @@
+#include "p3compat.h"
+// File descriptor that becomes readable when completions are pending.
+//
+// The CA thread pushes completed operations on the list of a notifier
+// without the GIL, and writes to its descriptor only when the list was
+// empty, so an event loop watching the descriptor is woken up once per
+// batch of completions. The loop drains the descriptor, then the list.
+// Linux uses an eventfd, other systems the two ends of a pipe.
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#include <fcntl.h>
+#include <unistd.h>
+
+struct pyca_notice {
+  pyca_notice* next;
+};
+
+struct pyca_notifier {
+  int rfd;              // readable when notices are pending
+  int wfd;              // same as rfd for an eventfd
+  pthread_mutex_t lock;
+  pyca_notice* first;   // pending notices, in completion order
+  pyca_notice* last;
+  int signaled;         // rfd is readable or about to be
+};
+
+static pyca_notifier* pyca_notifier_new()
+{
+  int fds[2];
+#ifdef __linux__
+  fds[0] = fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fds[0] < 0) {
+    return NULL;
+  }
+#else
+  if (pipe(fds) < 0) {
+    return NULL;
+  }
+  for (int i=0; i<2; i++) {
+    fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+  }
+#endif
+  pyca_notifier* notifier = new pyca_notifier;
+  notifier->rfd = fds[0];
+  notifier->wfd = fds[1];
+  pthread_mutex_init(&notifier->lock, NULL);
+  notifier->first = 0;
+  notifier->last = 0;
+  notifier->signaled = 0;
+  return notifier;
+}
+
+static void pyca_notifier_free(pyca_notifier* notifier)
+{
+  close(notifier->rfd);
+  if (notifier->wfd != notifier->rfd) {
+    close(notifier->wfd);
+  }
+  pthread_mutex_destroy(&notifier->lock);
+  delete notifier;
+}
+
+// Queue a notice and make the descriptor readable. Called from any
+// thread, without the GIL.
+static void pyca_notifier_post(pyca_notifier* notifier, pyca_notice* notice)
+{
+  notice->next = 0;
+  pthread_mutex_lock(&notifier->lock);
+  if (notifier->last) {
+    notifier->last->next = notice;
+  } else {
+    notifier->first = notice;
+  }
+  notifier->last = notice;
+  bool wake = !notifier->signaled;
+  notifier->signaled = 1;
+  pthread_mutex_unlock(&notifier->lock);
+  if (wake) {
+#ifdef __linux__
+    uint64_t one = 1;
+#else
+    char one = 1;
+#endif
+    ssize_t written = write(notifier->wfd, &one, sizeof(one));
+    (void)written; // a full pipe is readable already
+  }
+}
+
+// Take all the pending notices, oldest first. The descriptor is drained
+// before the list is taken, so notices posted meanwhile signal it again.
+static pyca_notice* pyca_notifier_take(pyca_notifier* notifier)
+{
+  char buf[64];
+  while (read(notifier->rfd, buf, sizeof(buf)) > 0) {
+  }
+  pthread_mutex_lock(&notifier->lock);
+  pyca_notice* notices = notifier->first;
+  notifier->first = 0;
+  notifier->last = 0;
+  notifier->signaled = 0;
+  pthread_mutex_unlock(&notifier->lock);
+  return notices;
+}
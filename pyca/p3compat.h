@@ -11,6 +11,7 @@
 #define PyString_FromString PyUnicode_FromString
 #define PyString_Check      PyUnicode_Check
 #define PyString_FromFormat PyUnicode_FromFormat
+#define PyString_FromStringAndSize PyUnicode_FromStringAndSize
 // This should suffice, as long as we don't call this twice and try to hold onto both!
 static char *PyString_AsString(PyObject *o)
 {
@@ -0,0 +1,103 @@
+#include "p3compat.h"
+// Native processors of version 2, see pyca_processor.h.
+//
+// The processor of a capv is published in a pyca_proc slot, allocated
+// the first time one is set. The CA thread calls it under the lock of
+// the slot, without the GIL, so that replacing the processor only has
+// to take the lock to know that the old one is no longer running.
+#include "pyca_processor.h"
+
+struct pyca_proc {
+  pthread_mutex_t lock;         // held while the processor runs
+  pyca_processor* processor;    // NULL if none
+  char* name;                   // PV name handed to the processor
+  PyObject* capsule;            // owner of processor, guarded by the GIL
+};
+
+static pyca_proc* pyca_proc_new(const char* name)
+{
+  pyca_proc* proc = new pyca_proc;
+  pthread_mutex_init(&proc->lock, NULL);
+  proc->processor = 0;
+  proc->name = strdup(name ? name : "");
+  proc->capsule = 0;
+  return proc;
+}
+
+static void pyca_proc_free(pyca_proc* proc)
+{
+  Py_XDECREF(proc->capsule);
+  free(proc->name);
+  pthread_mutex_destroy(&proc->lock);
+  delete proc;
+}
+
+// Processor of a capsule, NULL with an exception set if the capsule is
+// not a processor of a supported version
+static pyca_processor* _pyca_proc_check(PyObject* capsule)
+{
+  pyca_processor* processor = reinterpret_cast<pyca_processor*>(
+    PyCapsule_GetPointer(capsule, PYCA_PROCESSOR_CAPSULE));
+  if (!processor) {
+    return NULL;
+  }
+  if (processor->version != PYCA_PROCESSOR_VERSION || !processor->process) {
+    PyErr_Format(PyExc_ValueError, "unsupported processor version %d",
+                 processor->version);
+    return NULL;
+  }
+  return processor;
+}
+
+// Replace the processor, with the GIL. capsule may be NULL.
+static void pyca_proc_set(pyca_proc* proc, PyObject* capsule, pyca_processor* processor)
+{
+  Py_XINCREF(capsule);
+  PyObject* old = proc->capsule;
+  proc->capsule = capsule;
+  // The running processor may be waiting for the GIL
+  Py_BEGIN_ALLOW_THREADS
+  pthread_mutex_lock(&proc->lock);
+  proc->processor = processor;
+  pthread_mutex_unlock(&proc->lock);
+  Py_END_ALLOW_THREADS
+  // The old processor can't be running any more
+  Py_XDECREF(old);
+}
+
+// Run the processor of an event. Called by the CA thread without the
+// GIL. Returns true if the event was consumed.
+static bool pyca_proc_run(pyca_proc* proc, int kind, struct event_handler_args& args)
+{
+  pyca_processor_event event;
+  event.kind = kind;
+  event.name = proc->name;
+  event.castatus = args.status;
+  event.dbr_type = args.type;
+  event.count = args.count;
+  event.dbr = 0;
+  event.value = 0;
+  event.size = 0;
+  event.status = 0;
+  event.severity = 0;
+  event.secs = 0;
+  event.nsec = 0;
+  if (args.status == ECA_NORMAL && args.dbr) {
+    event.dbr = args.dbr;
+    event.value = dbr_value_ptr(args.dbr, args.type);
+    event.size = dbr_value_size[args.type];
+    pyca_dbr_meta meta;
+    _pyca_dbr_meta(args.dbr, args.type, &meta);
+    event.status = meta.status;
+    event.severity = meta.severity;
+    event.secs = meta.secs;
+    event.nsec = meta.nsec;
+  }
+  int result = PYCA_PROCESSOR_PASS;
+  pthread_mutex_lock(&proc->lock);
+  if (proc->processor) {
+    result = proc->processor->process(&event, proc->processor->context);
+  }
+  pthread_mutex_unlock(&proc->lock);
+  return kind == PYCA_PROCESSOR_MONITOR && result == PYCA_PROCESSOR_CONSUME;
+}
@@ -57,6 +57,7 @@ void _pyca_put_value(capv* pv, PyObject* pyvalue, T** buf, long count)
     delete [] pv->putbuffer;
     pv->putbuffer = new char[size];
     pv->putbufsiz = size;
+    pyca_stat_add(pv, PYCA_STAT_REALLOCS, 1);
   }
   T* buffer = reinterpret_cast<T*>(pv->putbuffer);
   if (count == 1) {
@@ -108,11 +109,65 @@ void _pyca_put_value(capv* pv, PyObject* pyvalue, T** buf, long count)
       *buf = buffer;
 }
 
+// Values of pyvalue as a C contiguous array of the numpy type of
+// dbr_type: the object itself if it already is one, otherwise a single
+// vectorized cast or conversion of the whole buffer or sequence. Returns
+// a new reference, NULL without exception if pyvalue is a scalar.
+static PyArrayObject* _pyca_put_array(PyObject* pyvalue, short dbr_type)
+{
+  if (!PyArray_Check(pyvalue) && !PyObject_CheckBuffer(pyvalue) &&
+      (!PySequence_Check(pyvalue) || PyString_Check(pyvalue))) {
+    return NULL;
+  }
+  PyObject* arr = PyArray_FROM_OTF(pyvalue, _numpy_dbr_type(dbr_type),
+                                   NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+  return reinterpret_cast<PyArrayObject*>(arr);
+}
+
+// Buffer holding count values of pyvalue for a put of dbr_type. Numeric
+// arrays, buffers and sequences are sent from their own memory, or from
+// their converted copy, which *pykeep references until the put is
+// issued; count is reduced to their length. Other values are copied
+// into the put buffer of pv. Returns NULL if pyvalue can't be converted,
+// or with count 0 if it is empty.
 static const void* _pyca_put_buffer(capv* pv,
                                     PyObject* pyvalue,
                                     short &dbr_type, // We may change DBF_ENUM to DBF_STRING
-                                    long count)
+                                    int &count,
+                                    PyObject** pykeep)
 {
+  *pykeep = NULL;
+  if (dbr_type != DBR_STRING &&
+      !(dbr_type == DBR_ENUM && PyString_Check(pyvalue))) {
+    PyArrayObject* arr = _pyca_put_array(pyvalue, dbr_type);
+    if (arr) {
+      if (PyArray_SIZE(arr) < count) {
+        count = PyArray_SIZE(arr);
+      }
+      *pykeep = reinterpret_cast<PyObject*>(arr);
+      return count ? PyArray_DATA(arr) : NULL;
+    }
+    if (PyErr_Occurred()) {
+      PyErr_Clear();
+      return NULL;
+    }
+    // A scalar only sets the first element
+    count = 1;
+  } else if (PyList_Check(pyvalue)) {
+    pyvalue = PyList_AsTuple(pyvalue);
+    if (!pyvalue) {
+      PyErr_Clear();
+      return NULL;
+    }
+    *pykeep = pyvalue;
+  }
+  if (PyTuple_Check(pyvalue)) {
+    int tcnt = PyTuple_GET_SIZE(pyvalue);
+    if (tcnt < count)
+      count = tcnt;
+    if (count == 0)
+      return NULL;
+  }
   const void* buffer;
   switch (dbr_type) {
   case DBR_ENUM:
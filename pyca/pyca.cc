@@ -12,14 +12,250 @@
 #include <pthread.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
 
 #include "p3compat.h"
 #include "pyca.hh"
+#include "enums.hh"
+#include "trace.hh"
+#include "stats.hh"
 #include "getfunctions.hh"
+#include "rawbuf.hh"
+#include "record.hh"
 #include "putfunctions.hh"
+#include "completion.hh"
+#include "history.hh"
+#include "accum.hh"
+#include "shm.hh"
+#include "recorder.hh"
+#include "processor.hh"
+#include "latency.hh"
+#include "notify.hh"
+#include "deferred.hh"
 #include "handlers.hh"
+#include "evqueue.hh"
+#include "replay.hh"
+#ifdef IS_PY3K
+#include "aio.hh"
+#endif
 
 extern "C" {
+    // Latency histogram, a copy of the histogram of a PV or the merge of
+    // several. Values are returned in seconds.
+    struct histogram {
+        PyObject_HEAD
+        pyca_hist* hist;
+    };
+
+    static PyObject* histogram_new(PyTypeObject* type, PyObject* args, PyObject* kwds)
+    {
+        static const char* kwlist[] = {NULL};
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, ":histogram", (char**)kwlist)) {
+            return NULL;
+        }
+        histogram* self = reinterpret_cast<histogram*>(type->tp_alloc(type, 0));
+        if (!self) {
+            return NULL;
+        }
+        self->hist = new pyca_hist;
+        pyca_hist_clear(self->hist);
+        return reinterpret_cast<PyObject*>(self);
+    }
+
+    static void histogram_dealloc(PyObject* self)
+    {
+        delete reinterpret_cast<histogram*>(self)->hist;
+        Py_TYPE(self)->tp_free(self);
+    }
+
+    // Seconds of a value in nanoseconds
+    static PyObject* _pyca_histogram_seconds(uint64_t ns)
+    {
+        return PyFloat_FromDouble(ns * 1e-9);
+    }
+
+    static PyObject* _pyca_histogram_percentile(pyca_hist* hist, PyObject* pyval)
+    {
+        double percent = PyFloat_AsDouble(pyval);
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+        if (percent < 0 || percent > 100) {
+            pyca_raise_pyexc("percentile", "percentile not between 0 and 100");
+        }
+        if (!hist->count) {
+            Py_RETURN_NONE;
+        }
+        return _pyca_histogram_seconds(pyca_hist_percentile(hist, percent));
+    }
+
+    // Value below which lie the given percentage of the values, None if
+    // the histogram is empty
+    static PyObject* histogram_percentile(PyObject* self, PyObject* pyval)
+    {
+        return _pyca_histogram_percentile(reinterpret_cast<histogram*>(self)->hist, pyval);
+    }
+
+    // List of the values of a sequence of percentiles
+    static PyObject* histogram_percentiles(PyObject* self, PyObject* pyseq)
+    {
+        PyObject* pyfast = PySequence_Fast(pyseq, "percentiles must be a sequence");
+        if (!pyfast) {
+            return NULL;
+        }
+        Py_ssize_t n = PySequence_Fast_GET_SIZE(pyfast);
+        PyObject* pylist = PyList_New(n);
+        for (Py_ssize_t i=0; pylist && i<n; i++) {
+            PyObject* pyvalue = _pyca_histogram_percentile(
+                reinterpret_cast<histogram*>(self)->hist,
+                PySequence_Fast_GET_ITEM(pyfast, i));
+            if (!pyvalue) {
+                Py_CLEAR(pylist);
+                break;
+            }
+            PyList_SET_ITEM(pylist, i, pyvalue);
+        }
+        Py_DECREF(pyfast);
+        return pylist;
+    }
+
+    // Add the values of another histogram to this one
+    static PyObject* histogram_merge(PyObject* self, PyObject* pyother)
+    {
+        if (!PyObject_TypeCheck(pyother, Py_TYPE(self))) {
+            pyca_raise_pyexc("merge", "not a pyca.histogram");
+        }
+        pyca_hist_merge(reinterpret_cast<histogram*>(self)->hist,
+                        reinterpret_cast<histogram*>(pyother)->hist);
+        Py_RETURN_NONE;
+    }
+
+    // List of (low, high, count) of the buckets holding values
+    static PyObject* histogram_buckets(PyObject* self, PyObject*)
+    {
+        pyca_hist* hist = reinterpret_cast<histogram*>(self)->hist;
+        PyObject* pylist = PyList_New(0);
+        for (int i=0; pylist && i<PYCA_HIST_BUCKETS; i++) {
+            if (!hist->buckets[i]) {
+                continue;
+            }
+            uint64_t low, width;
+            pyca_hist_bucket(i, &low, &width);
+            PyObject* pybucket = Py_BuildValue("(ddK)", low * 1e-9, (low + width) * 1e-9,
+                                               (unsigned long long)hist->buckets[i]);
+            if (!pybucket || PyList_Append(pylist, pybucket) < 0) {
+                Py_XDECREF(pybucket);
+                Py_CLEAR(pylist);
+                break;
+            }
+            Py_DECREF(pybucket);
+        }
+        return pylist;
+    }
+
+    static PyObject* histogram_get_count(PyObject* self, void*)
+    {
+        return PyLong_FromUnsignedLongLong(reinterpret_cast<histogram*>(self)->hist->count);
+    }
+
+    static PyObject* histogram_get_min(PyObject* self, void*)
+    {
+        pyca_hist* hist = reinterpret_cast<histogram*>(self)->hist;
+        if (!hist->count) {
+            Py_RETURN_NONE;
+        }
+        return _pyca_histogram_seconds(hist->min);
+    }
+
+    static PyObject* histogram_get_max(PyObject* self, void*)
+    {
+        pyca_hist* hist = reinterpret_cast<histogram*>(self)->hist;
+        if (!hist->count) {
+            Py_RETURN_NONE;
+        }
+        return _pyca_histogram_seconds(hist->max);
+    }
+
+    static PyObject* histogram_get_mean(PyObject* self, void*)
+    {
+        pyca_hist* hist = reinterpret_cast<histogram*>(self)->hist;
+        if (!hist->count) {
+            Py_RETURN_NONE;
+        }
+        return PyFloat_FromDouble(hist->sum / hist->count * 1e-9);
+    }
+
+    static PyMethodDef histogram_methods[] = {
+        {"percentile", histogram_percentile, METH_O},
+        {"percentiles", histogram_percentiles, METH_O},
+        {"merge", histogram_merge, METH_O},
+        {"buckets", histogram_buckets, METH_NOARGS},
+        {NULL,  NULL},
+    };
+
+    static PyGetSetDef histogram_getset[] = {
+        {(char*)"count", histogram_get_count, NULL, (char*)"count", NULL},
+        {(char*)"min", histogram_get_min, NULL, (char*)"min", NULL},
+        {(char*)"max", histogram_get_max, NULL, (char*)"max", NULL},
+        {(char*)"mean", histogram_get_mean, NULL, (char*)"mean", NULL},
+        {NULL},
+    };
+
+    static PyTypeObject histogram_type = {
+        PyVarObject_HEAD_INIT(0, 0)
+        "pyca.histogram",
+        sizeof(histogram),
+        0,
+        histogram_dealloc,                      /* tp_dealloc */
+        0,                                      /* tp_print */
+        0,                                      /* tp_getattr */
+        0,                                      /* tp_setattr */
+        0,                                      /* tp_compare */
+        0,                                      /* tp_repr */
+        0,                                      /* tp_as_number */
+        0,                                      /* tp_as_sequence */
+        0,                                      /* tp_as_mapping */
+        0,                                      /* tp_hash */
+        0,                                      /* tp_call */
+        0,                                      /* tp_str */
+        0,                                      /* tp_getattro */
+        0,                                      /* tp_setattro */
+        0,                                      /* tp_as_buffer */
+        Py_TPFLAGS_DEFAULT,                     /* tp_flags */
+        0,                                      /* tp_doc */
+        0,                                      /* tp_traverse */
+        0,                                      /* tp_clear */
+        0,                                      /* tp_richcompare */
+        0,                                      /* tp_weaklistoffset */
+        0,                                      /* tp_iter */
+        0,                                      /* tp_iternext */
+        histogram_methods,                      /* tp_methods */
+        0,                                      /* tp_members */
+        histogram_getset,                       /* tp_getset */
+        0,                                      /* tp_base */
+        0,                                      /* tp_dict */
+        0,                                      /* tp_descr_get */
+        0,                                      /* tp_descr_set */
+        0,                                      /* tp_dictoffset */
+        0,                                      /* tp_init */
+        0,                                      /* tp_alloc */
+        histogram_new,                          /* tp_new */
+    };
+
+    // New empty histogram
+    static PyObject* _pyca_histogram_new()
+    {
+        PyObject* pyargs = PyTuple_New(0);
+        if (!pyargs) {
+            return NULL;
+        }
+        PyObject* pyhist = histogram_new(&histogram_type, pyargs, NULL);
+        Py_DECREF(pyargs);
+        return pyhist;
+    }
+
     //
     // Python methods for channel access PV types
     //
@@ -42,6 +278,37 @@ extern "C" {
         Py_RETURN_NONE;
     }
 
+    // Drop the deferred events of a PV whose channel is cleared, see
+    // deferred.hh: no callback runs for them any more
+    static void _pyca_deferred_forget(capv* pv)
+    {
+        pyca_notifier* notifier = pyca_deferred_fd;
+        if (notifier) {
+            pthread_mutex_lock(&notifier->lock);
+            pyca_deferred_forget(notifier->first, pv);
+            pthread_mutex_unlock(&notifier->lock);
+        }
+        pyca_deferred_forget(pyca_deferred_taken.first, pv);
+        pyca_dispatcher* dispatcher = pyca_dispatcher_thread;
+        if (dispatcher) {
+            pthread_mutex_lock(&dispatcher->lock);
+            pyca_deferred_forget(dispatcher->first, pv);
+            pyca_deferred_forget(dispatcher->taken, pv);
+            pthread_mutex_unlock(&dispatcher->lock);
+        }
+    }
+
+    // Forget that the PV's subscription feeds the event queue, and the
+    // events it left there. The subscription must be cleared already.
+    static void _pyca_unqueue(capv* pv)
+    {
+        if (pv->queued) {
+            pv->queued = 0;
+            pyca_queued_subscriptions--;
+            pyca_evqueue_forget(pyca_events, pv);
+        }
+    }
+
     static PyObject* clear_channel(PyObject* self, PyObject*)
     {
         capv* pv = reinterpret_cast<capv*>(self);
@@ -55,28 +322,61 @@ extern "C" {
         if (result != ECA_NORMAL) {
             pyca_raise_caexc_pv("ca_clear_channel", result, pv);
         }
+        // Clearing the channel cleared its subscriptions
         pv->cid = 0;
+        pv->eid = 0;
+        pv->propeid = 0;
+        pyca_set_connected(pv, 0);
+        _pyca_unqueue(pv);
+        _pyca_deferred_forget(pv);
+#ifdef IS_PY3K
+        _pyca_async_close(pv);
+#endif
         Py_RETURN_NONE;
     }
 
-    static PyObject* subscribe_channel(PyObject* self, PyObject* args)
+    // Select the DBR type used to read a connected channel
+    static short _pyca_read_type(capv* pv, short type, bool ctrl)
+    {
+        short dbr_type = ctrl ?
+            dbf_type_to_DBR_CTRL(type) : // Asks IOC to send status+time+limits+value
+            dbf_type_to_DBR_TIME(type);  // Asks IOC to send status+time+value
+        if (dbr_type_is_ENUM(dbr_type) && pv->string_enum)
+            dbr_type = ctrl ? DBR_CTRL_STRING : DBR_TIME_STRING;
+        return dbr_type;
+    }
+
+    static PyObject* subscribe_channel(PyObject* self, PyObject* args, PyObject* kwds)
     {
         capv* pv = reinterpret_cast<capv*>(self);
         PyObject* pyctrl;
         PyObject* pymsk;
         PyObject* pycnt = NULL;
-
-        if (!PyArg_ParseTuple(args, "OO|O:subscribe", &pymsk, &pyctrl, &pycnt) ||
+        PyObject* pyqueued = Py_False;
+        PyObject* pyconflate = Py_False;
+        PyObject* pycache = Py_False;
+        static const char* kwlist[] = {"mask", "ctrl", "count", "queued", "conflate",
+                                       "cache_ctrl", NULL};
+
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|OOOO:subscribe", (char**)kwlist,
+                                         &pymsk, &pyctrl, &pycnt, &pyqueued, &pyconflate,
+                                         &pycache) ||
             !PyInt_Check(pymsk) ||
             !PyBool_Check(pyctrl) ||
             (pycnt && pycnt != Py_None && !PyInt_Check(pycnt))) {
             pyca_raise_pyexc_pv("subscribe_channel", "error parsing arguments", pv);
         }
+        bool conflate = PyObject_IsTrue(pyconflate);
+        bool queued = conflate || PyObject_IsTrue(pyqueued);
+        bool cache = PyObject_IsTrue(pycache);
 
         if (pv->simulated != Py_None) {
-            if (pyctrl == Py_True) {
+            if (pyctrl == Py_True || cache) {
                 pyca_raise_pyexc_pv("subscribe_channel", "Can't get control info on simulated PV", pv);
             }
+            if (queued) {
+                pyca_raise_pyexc_pv("subscribe_channel", "Can't queue events of simulated PV", pv);
+            }
             if (pycnt && pycnt != Py_None)
                 pv->count = PyInt_AsLong(pycnt);
             else
@@ -99,23 +399,63 @@ extern "C" {
         if (pv->count == 0 || type == TYPENOTCONN) {
             pyca_raise_caexc_pv("ca_field_type", ECA_DISCONNCHID, pv);
         }
-        short dbr_type = (Py_True == pyctrl) ?
-            dbf_type_to_DBR_CTRL(type) : // Asks IOC to send status+time+limits+value
-            dbf_type_to_DBR_TIME(type);  // Asks IOC to send status+time+value
-        if (dbr_type_is_ENUM(dbr_type) && pv->string_enum)
-            dbr_type = (Py_True == pyctrl) ? DBR_CTRL_STRING : DBR_TIME_STRING;
-
+        // With cached control data, values come as DBR_TIME and the
+        // control data only when it changes
+        short dbr_type = _pyca_read_type(pv, type, Py_True == pyctrl && !cache);
+
+        caEventCallBackFunc* handler = pyca_monitor_handler;
+        if (queued) {
+            if (!pyca_events) {
+                pyca_events = pyca_evqueue_new(pyca_evqueue_default_capacity,
+                                               PYCA_DROP_NEWEST);
+            }
+            handler = pyca_queued_monitor_handler;
+            if (conflate) {
+                if (!pv->latest) {
+                    pv->latest = pyca_latest_new();
+                }
+                handler = pyca_conflated_monitor_handler;
+            }
+        }
         unsigned long event_mask = PyLong_AsLong(pymsk);
-        int result = ca_create_subscription(dbr_type,
+        int result;
+        bool newprop = false;
+        if (cache && !pv->propeid && type != DBR_STRING) {
+            // Subscribed first so that its initial event, which fetches
+            // the control data, comes before the first value
+            result = ca_create_subscription(dbf_type_to_DBR_CTRL(type),
+                                            1,
+                                            cid,
+                                            DBE_PROPERTY,
+                                            pyca_property_handler,
+                                            pv,
+                                            &pv->propeid);
+            if (result != ECA_NORMAL) {
+                pv->propeid = 0;
+                pyca_raise_caexc_pv("ca_create_subscription", result, pv);
+            }
+            newprop = true;
+        }
+        result = ca_create_subscription(dbr_type,
                                             pv->count,
                                             cid,
                                             event_mask,
-                                            pyca_monitor_handler,
+                                            handler,
                                             pv,
                                             &pv->eid);
         if (result != ECA_NORMAL) {
+            // Without a value subscription behind it, the control data
+            // subscription would call monitor_cb on its own
+            if (newprop) {
+                ca_clear_subscription(pv->propeid);
+                pv->propeid = 0;
+            }
             pyca_raise_caexc_pv("ca_create_subscription", result, pv);
         }
+        if (queued) {
+            pv->queued = 1;
+            pyca_queued_subscriptions++;
+        }
         Py_RETURN_NONE;
     }
 
@@ -136,7 +476,16 @@ extern "C" {
             }
             pv->eid = 0;
         }
+        eid = pv->propeid;
+        if (eid) {
+            ca_clear_subscription(eid);
+            pv->propeid = 0;
+        }
         PyEval_RestoreThread(state);
+        _pyca_unqueue(pv);
+#ifdef IS_PY3K
+        _pyca_async_close(pv);
+#endif
         Py_RETURN_NONE;
     }
 
@@ -173,8 +522,20 @@ extern "C" {
         if (!dbr_type_is_ENUM(dbf_type_to_DBR(type))) {
             pyca_raise_pyexc_pv("get_enum_strings", "channel is not ENUM type", pv);
         }
-        int result;
         double timeout = PyFloat_AsDouble(pytmo);
+        PyObject* pystrs = pyca_enums_tuple(pv->enums);
+        if (pystrs) {
+            // Fetched since the channel connected, no need to ask again,
+            // but asynchronous callers still wait for getevt_cb
+            Py_INCREF(pystrs);
+            _pyca_setitem(pv->data, "enum_set", pystrs);
+            if (timeout < 0 &&
+                !pyca_defer(PYCA_DEFER_CACHED, pv, ECA_NORMAL, 0, NULL, 0, 0)) {
+                _pyca_cached_dispatch(pv);
+            }
+            Py_RETURN_NONE;
+        }
+        int result;
         if (timeout < 0) {
           result = ca_array_get_callback(DBR_GR_ENUM,
                                          1,
@@ -247,11 +608,7 @@ extern "C" {
         if (pv->count == 0 || type == TYPENOTCONN) {
             pyca_raise_caexc_pv("ca_field_type", ECA_DISCONNCHID, pv);
         }
-        short dbr_type = (Py_True == pyctrl) ?
-            dbf_type_to_DBR_CTRL(type) : // Asks IOC to send status+time+limits+value
-            dbf_type_to_DBR_TIME(type);  // Asks IOC to send status+time+value
-        if (dbr_type_is_ENUM(dbr_type) && pv->string_enum)
-            dbr_type = (Py_True == pyctrl) ? DBR_CTRL_STRING : DBR_TIME_STRING;
+        short dbr_type = _pyca_read_type(pv, type, Py_True == pyctrl);
         double timeout = PyFloat_AsDouble(pytmo);
         if (timeout < 0) {
             int result = ca_array_get_callback(dbr_type,
@@ -262,6 +619,30 @@ extern "C" {
             if (result != ECA_NORMAL) {
                 pyca_raise_caexc_pv("ca_array_get_callback", result, pv);
             }
+        } else if (PyObject_IsTrue(pv->sync_callback)) {
+            pyca_batch* batch = pyca_batch_new(1);
+            pyca_request* req = &batch->requests[0];
+            req->pv = pv;
+            pyca_batch_issued(req);
+            int result = ca_array_get_callback(dbr_type,
+                                               pv->count,
+                                               cid,
+                                               pyca_batch_get_handler,
+                                               req);
+            if (result != ECA_NORMAL) {
+                pyca_request_failed(req, result);
+            } else {
+                result = pyca_request_wait(req, timeout);
+            }
+            if (result == ECA_NORMAL &&
+                !_pyca_event_process(pv, req->buffer, req->dbr_type, req->count)) {
+                pyca_batch_release(batch);
+                pyca_raise_pyexc_pv("get_data", "un-handled type", pv);
+            }
+            pyca_batch_release(batch);
+            if (result != ECA_NORMAL) {
+                pyca_raise_caexc_pv("ca_array_get_callback", result, pv);
+            }
         } else {
             void* buffer = _pyca_adjust_buffer_size(pv, dbr_type, pv->count, 0);
             if (!buffer) {
@@ -306,17 +687,12 @@ extern "C" {
         if (count == 0 || type == TYPENOTCONN) {
             pyca_raise_caexc_pv("ca_field_type", ECA_DISCONNCHID, pv);
         }
-        if (count > 1) {
-            if (PyTuple_Check(pyval)) {
-                int tcnt = PyTuple_GET_SIZE(pyval);
-                if (tcnt < count)
-                    count = tcnt;
-            }
-        }
         short dbr_type = dbf_type_to_DBR(type);
-        const void* buffer = _pyca_put_buffer(pv, pyval, dbr_type, count);
+        PyObject* pykeep;
+        const void* buffer = _pyca_put_buffer(pv, pyval, dbr_type, count, &pykeep);
         if (!buffer) {
-            pyca_raise_pyexc_pv("put_data", "un-handled type", pv);
+            Py_XDECREF(pykeep);
+            pyca_raise_pyexc_pv("put_data", count ? "un-handled type" : "empty value", pv);
         }
         double timeout = PyFloat_AsDouble(pytmo);
         if (timeout < 0) {
@@ -326,6 +702,29 @@ extern "C" {
                                                buffer,
                                                pyca_putevent_handler,
                                                pv);
+            // Channel access has copied the values
+            Py_XDECREF(pykeep);
+            if (result != ECA_NORMAL) {
+                pyca_raise_caexc_pv("ca_array_put_callback", result, pv);
+            }
+        } else if (PyObject_IsTrue(pv->sync_callback)) {
+            pyca_batch* batch = pyca_batch_new(1);
+            pyca_request* req = &batch->requests[0];
+            req->pv = pv;
+            pyca_batch_issued(req);
+            int result = ca_array_put_callback(dbr_type,
+                                               count,
+                                               cid,
+                                               buffer,
+                                               pyca_batch_put_handler,
+                                               req);
+            Py_XDECREF(pykeep);
+            if (result != ECA_NORMAL) {
+                pyca_request_failed(req, result);
+            } else {
+                result = pyca_request_wait(req, timeout);
+            }
+            pyca_batch_release(batch);
             if (result != ECA_NORMAL) {
                 pyca_raise_caexc_pv("ca_array_put_callback", result, pv);
             }
@@ -334,6 +733,7 @@ extern "C" {
                                       count,
                                       cid,
                                       buffer);
+            Py_XDECREF(pykeep);
             if (result != ECA_NORMAL) {
                 pyca_raise_caexc_pv("ca_array_put", result, pv);
             }
@@ -347,188 +747,2065 @@ extern "C" {
         Py_RETURN_NONE;
     }
 
-    static PyObject* host(PyObject* self, PyObject*)
-    {
-        capv* pv = reinterpret_cast<capv*>(self);
-
-        if (!pv->cid) pyca_raise_pyexc_pv("host", "channel is null", pv);
-        return PyString_FromString(ca_host_name(pv->cid));
-    }
-
-    static PyObject* state(PyObject* self, PyObject*)
+#ifdef IS_PY3K
+    // Channel access requests as asyncio awaitables, see aio.hh
+    static PyObject* get_async(PyObject* self, PyObject* args, PyObject* kwds)
     {
         capv* pv = reinterpret_cast<capv*>(self);
+        PyObject* pyctrl = Py_False;
+        PyObject* pycnt = NULL;
+        static const char* kwlist[] = {"ctrl", "count", NULL};
 
-        if (!pv->cid) pyca_raise_pyexc_pv("state", "channel is null", pv);
-        return PyInt_FromLong(ca_state(pv->cid));
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OO:get_async", (char**)kwlist,
+                                         &pyctrl, &pycnt) ||
+            !PyBool_Check(pyctrl) ||
+            (pycnt && pycnt != Py_None && !PyInt_Check(pycnt))) {
+            pyca_raise_pyexc_pv("get_async", "error parsing arguments", pv);
+        }
+        chid cid = pv->cid;
+        if (!cid) {
+            pyca_raise_pyexc_pv("get_async", "channel is null", pv);
+        }
+        pv->count = ca_element_count(cid);
+        if (pycnt && pycnt != Py_None) {
+            int limit = PyInt_AsLong(pycnt);
+            if (limit < pv->count)
+                pv->count = limit;
+        }
+        short type = ca_field_type(cid);
+        if (pv->count == 0 || type == TYPENOTCONN) {
+            pyca_raise_caexc_pv("ca_field_type", ECA_DISCONNCHID, pv);
+        }
+        short dbr_type = _pyca_read_type(pv, type, Py_True == pyctrl);
+        pyca_loop* pl = _pyca_loop_get();
+        if (!pl) {
+            return NULL;
+        }
+        PyObject* future = PyObject_CallMethod(pl->loop, (char*)"create_future", NULL);
+        if (!future) {
+            _pyca_loop_idle(pl);
+            return NULL;
+        }
+        pyca_async_op* op = _pyca_async_op_new(PYCA_ASYNC_GET, pv, pl, future);
+        int result = ca_array_get_callback(dbr_type,
+                                           pv->count,
+                                           cid,
+                                           pyca_async_get_handler,
+                                           op);
+        if (result != ECA_NORMAL) {
+            _pyca_async_op_unref(op);
+            _pyca_loop_idle(pl);
+            pyca_raise_caexc_pv("ca_array_get_callback", result, pv);
+        }
+        _pyca_loop_schedule_flush(pl);
+        Py_INCREF(future);
+        return future;
     }
 
-    static PyObject* count(PyObject* self, PyObject*)
+    static PyObject* put_async(PyObject* self, PyObject* pyval)
     {
         capv* pv = reinterpret_cast<capv*>(self);
-
-        if (!pv->cid) pyca_raise_pyexc_pv("count", "channel is null", pv);
-        return PyInt_FromLong(ca_element_count(pv->cid));
+        chid cid = pv->cid;
+        if (!cid) {
+            pyca_raise_pyexc_pv("put_async", "channel is null", pv);
+        }
+        int count = ca_element_count(cid);
+        short type = ca_field_type(cid);
+        if (count == 0 || type == TYPENOTCONN) {
+            pyca_raise_caexc_pv("ca_field_type", ECA_DISCONNCHID, pv);
+        }
+        short dbr_type = dbf_type_to_DBR(type);
+        PyObject* pykeep;
+        const void* buffer = _pyca_put_buffer(pv, pyval, dbr_type, count, &pykeep);
+        if (!buffer) {
+            Py_XDECREF(pykeep);
+            pyca_raise_pyexc_pv("put_async", count ? "un-handled type" : "empty value", pv);
+        }
+        pyca_loop* pl = _pyca_loop_get();
+        PyObject* future = pl ?
+            PyObject_CallMethod(pl->loop, (char*)"create_future", NULL) : NULL;
+        if (!future) {
+            Py_XDECREF(pykeep);
+            if (pl) {
+                _pyca_loop_idle(pl);
+            }
+            return NULL;
+        }
+        pyca_async_op* op = _pyca_async_op_new(PYCA_ASYNC_PUT, pv, pl, future);
+        int result = ca_array_put_callback(dbr_type,
+                                           count,
+                                           cid,
+                                           buffer,
+                                           pyca_async_put_handler,
+                                           op);
+        Py_XDECREF(pykeep);
+        if (result != ECA_NORMAL) {
+            _pyca_async_op_unref(op);
+            _pyca_loop_idle(pl);
+            pyca_raise_caexc_pv("ca_array_put_callback", result, pv);
+        }
+        _pyca_loop_schedule_flush(pl);
+        Py_INCREF(future);
+        return future;
     }
 
-    static PyObject* type(PyObject* self, PyObject*)
-    {
-        capv* pv = reinterpret_cast<capv*>(self);
-
-        if (!pv->cid) pyca_raise_pyexc_pv("type", "channel is null", pv);
-        return PyString_FromString(dbf_type_to_text(ca_field_type(pv->cid)));
-    }
+    // Asynchronous iterator over the monitor updates of a PV
+    struct capv_updates {
+        PyObject_HEAD
+        capv* pv;
+        pyca_async_op* op;
+    };
 
-    static PyObject* rwaccess(PyObject* self, PyObject*)
+    static PyObject* capv_updates_aiter(PyObject* self)
     {
-        capv* pv = reinterpret_cast<capv*>(self);
-
-        if (!pv->cid) pyca_raise_pyexc_pv("rwaccess", "channel is null", pv);
-        int rw = ca_read_access(pv->cid) ? 1 : 0;
-        rw |= ca_write_access(pv->cid) ? 2 : 0;
-        return PyInt_FromLong(rw);
+        Py_INCREF(self);
+        return self;
     }
 
-    static PyObject* is_string_enum(PyObject* self, PyObject*)
+    // Awaitable of the next update: already resolved if an update came
+    // since the previous one, otherwise resolved by the next update
+    static PyObject* capv_updates_anext(PyObject* self)
     {
-        capv* pv = reinterpret_cast<capv*>(self);
-        return PyBool_FromLong(pv->string_enum);
+        pyca_async_op* op = reinterpret_cast<capv_updates*>(self)->op;
+        if (op->closed) {
+            PyErr_SetNone(PyExc_StopAsyncIteration);
+            return NULL;
+        }
+        if (op->future) {
+            Py_INCREF(op->future);
+            return op->future;
+        }
+        PyObject* future = PyObject_CallMethod(op->loop->loop, (char*)"create_future", NULL);
+        if (!future) {
+            return NULL;
+        }
+        PyObject* exc;
+        PyObject* data = _pyca_async_next(op->pv, &exc);
+        if (data || exc) {
+            _pyca_future_set(future, data, exc);
+        } else {
+            Py_INCREF(future);
+            op->future = future;
+        }
+        return future;
     }
 
-    static PyObject* set_string_enum(PyObject* self, PyObject* pyval)
+    static void capv_updates_dealloc(PyObject* self)
     {
-        capv* pv = reinterpret_cast<capv*>(self);
-
-        if (!PyBool_Check(pyval)) {
-            pyca_raise_pyexc_pv("set_string_enum", "error parsing arguments", pv);
+        capv_updates* updates = reinterpret_cast<capv_updates*>(self);
+        pyca_async_op* op = updates->op;
+        if (updates->pv->asyncmon == op) {
+            // Nobody left to see the updates
+            PyObject* res = unsubscribe_channel(reinterpret_cast<PyObject*>(updates->pv), NULL);
+            if (!res) {
+                PyErr_WriteUnraisable(self);
+            }
+            Py_XDECREF(res);
         }
-        pv->string_enum = (Py_True == pyval);
-        Py_RETURN_NONE;
+        pyca_loop* pl = op->loop;
+        _pyca_async_op_unref(op);
+        _pyca_loop_idle(pl);
+        Py_DECREF(updates->pv);
+        Py_TYPE(self)->tp_free(self);
     }
 
-    static bool numpy_arrays = false;
+    static PyAsyncMethods capv_updates_async = {
+        0,                                      /* am_await */
+        capv_updates_aiter,                     /* am_aiter */
+        capv_updates_anext,                     /* am_anext */
+    };
 
-    // Built-in methods for the capv type
-    static int capv_init(PyObject* self, PyObject* args, PyObject* kwds)
+    static PyTypeObject capv_updates_type = {
+        PyVarObject_HEAD_INIT(0, 0)
+        "pyca.capv_updates",
+        sizeof(capv_updates),
+        0,
+        capv_updates_dealloc,                   /* tp_dealloc */
+        0,                                      /* tp_print */
+        0,                                      /* tp_getattr */
+        0,                                      /* tp_setattr */
+        &capv_updates_async,                    /* tp_as_async */
+        0,                                      /* tp_repr */
+        0,                                      /* tp_as_number */
+        0,                                      /* tp_as_sequence */
+        0,                                      /* tp_as_mapping */
+        0,                                      /* tp_hash */
+        0,                                      /* tp_call */
+        0,                                      /* tp_str */
+        0,                                      /* tp_getattro */
+        0,                                      /* tp_setattro */
+        0,                                      /* tp_as_buffer */
+        Py_TPFLAGS_DEFAULT,                     /* tp_flags */
+    };
+
+    static PyObject* monitor_async(PyObject* self, PyObject* args, PyObject* kwds)
     {
         capv* pv = reinterpret_cast<capv*>(self);
-        if (!PyArg_ParseTuple(args, "O:capv_init", &pv->name) ||
-            !PyString_Check(pv->name)) {
-            pyca_raise_pyexc_int("capv_init", "cannot get PV name", pv);
+        PyObject* pymsk = NULL;
+        PyObject* pyctrl = Py_False;
+        PyObject* pycnt = NULL;
+        static const char* kwlist[] = {"mask", "ctrl", "count", NULL};
+
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OOO:monitor_async", (char**)kwlist,
+                                         &pymsk, &pyctrl, &pycnt) ||
+            (pymsk && !PyInt_Check(pymsk)) ||
+            !PyBool_Check(pyctrl) ||
+            (pycnt && pycnt != Py_None && !PyInt_Check(pycnt))) {
+            pyca_raise_pyexc_pv("monitor_async", "error parsing arguments", pv);
         }
-        Py_INCREF(pv->name);
-        pv->processor = 0;
-        pv->connect_cb = 0;
-        pv->monitor_cb = 0;
-        pv->rwaccess_cb = 0;
-        pv->getevt_cb = 0;
-        pv->putevt_cb = 0;
-        pv->simulated = Py_None;
-        Py_INCREF(pv->simulated);
-        if (numpy_arrays) {
-            pv->use_numpy = Py_True;
+        chid cid = pv->cid;
+        if (!cid) {
+            pyca_raise_pyexc_pv("monitor_async", "channel is null", pv);
+        }
+        if (pv->eid) {
+            pyca_raise_pyexc_pv("monitor_async", "channel is already subscribed", pv);
+        }
+        pv->count = ca_element_count(cid);
+        if (pycnt && pycnt != Py_None) {
+            int limit = PyInt_AsLong(pycnt);
+            if (limit < pv->count)
+                pv->count = limit;
+        }
+        short type = ca_field_type(cid);
+        if (pv->count == 0 || type == TYPENOTCONN) {
+            pyca_raise_caexc_pv("ca_field_type", ECA_DISCONNCHID, pv);
+        }
+        short dbr_type = _pyca_read_type(pv, type, Py_True == pyctrl);
+        unsigned long event_mask = pymsk ?
+            PyLong_AsLong(pymsk) : DBE_VALUE | DBE_LOG | DBE_ALARM;
+        pyca_loop* pl = _pyca_loop_get();
+        if (!pl) {
+            return NULL;
+        }
+        capv_updates* updates = PyObject_New(capv_updates, &capv_updates_type);
+        if (!updates) {
+            _pyca_loop_idle(pl);
+            return NULL;
+        }
+        if (!pv->latest) {
+            pv->latest = pyca_latest_new();
+        }
+        pyca_async_op* op = _pyca_async_op_new(PYCA_ASYNC_MONITOR, pv, pl, NULL);
+        op->refs = 2; // the iterator and the subscription
+        Py_INCREF(pv);
+        updates->pv = pv;
+        updates->op = op;
+        int result = ca_create_subscription(dbr_type,
+                                            pv->count,
+                                            cid,
+                                            event_mask,
+                                            pyca_async_monitor_handler,
+                                            op,
+                                            &pv->eid);
+        if (result != ECA_NORMAL) {
+            pv->eid = 0;
+            op->closed = 1;
+            op->refs = 1;
+            Py_DECREF(updates);
+            pyca_raise_caexc_pv("ca_create_subscription", result, pv);
+        }
+        pv->asyncmon = op;
+        _pyca_loop_schedule_flush(pl);
+        return reinterpret_cast<PyObject*>(updates);
+    }
+#endif
+
+    static PyObject* host(PyObject* self, PyObject*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+
+        if (!pv->cid) pyca_raise_pyexc_pv("host", "channel is null", pv);
+        return PyString_FromString(ca_host_name(pv->cid));
+    }
+
+    static PyObject* state(PyObject* self, PyObject*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+
+        if (!pv->cid) pyca_raise_pyexc_pv("state", "channel is null", pv);
+        return PyInt_FromLong(ca_state(pv->cid));
+    }
+
+    static PyObject* count(PyObject* self, PyObject*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+
+        if (!pv->cid) pyca_raise_pyexc_pv("count", "channel is null", pv);
+        return PyInt_FromLong(ca_element_count(pv->cid));
+    }
+
+    static PyObject* type(PyObject* self, PyObject*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+
+        if (!pv->cid) pyca_raise_pyexc_pv("type", "channel is null", pv);
+        return PyString_FromString(dbf_type_to_text(ca_field_type(pv->cid)));
+    }
+
+    static PyObject* rwaccess(PyObject* self, PyObject*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+
+        if (!pv->cid) pyca_raise_pyexc_pv("rwaccess", "channel is null", pv);
+        int rw = ca_read_access(pv->cid) ? 1 : 0;
+        rw |= ca_write_access(pv->cid) ? 2 : 0;
+        return PyInt_FromLong(rw);
+    }
+
+    static PyObject* is_string_enum(PyObject* self, PyObject*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        return PyBool_FromLong(pv->string_enum);
+    }
+
+    static PyObject* set_string_enum(PyObject* self, PyObject* pyval)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+
+        if (!PyBool_Check(pyval)) {
+            pyca_raise_pyexc_pv("set_string_enum", "error parsing arguments", pv);
+        }
+        pv->string_enum = (Py_True == pyval);
+        Py_RETURN_NONE;
+    }
+
+    // Fill numpy waveform values in place, cycling through depth
+    // preallocated arrays instead of allocating one per event
+    static PyObject* set_array_pool(PyObject* self, PyObject* pydepth)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        if (!PyInt_Check(pydepth) || PyInt_AsLong(pydepth) < 0) {
+            pyca_raise_pyexc_pv("set_array_pool", "error parsing arguments", pv);
+        }
+        long depth = PyInt_AsLong(pydepth);
+        PyObject* arrays = NULL;
+        if (depth) {
+            arrays = PyList_New(depth);
+            if (!arrays) {
+                return NULL;
+            }
+            for (long i=0; i<depth; i++) {
+                Py_INCREF(Py_None);
+                PyList_SET_ITEM(arrays, i, Py_None);
+            }
+        }
+        PyObject* oldarrays = pv->arrays;
+        pv->arrays = arrays;
+        Py_XDECREF(oldarrays);
+        pv->nextarray = 0;
+        pv->userarrays = 0;
+        Py_RETURN_NONE;
+    }
+
+    // Fill numpy waveform values into a user supplied array
+    static PyObject* set_output_array(PyObject* self, PyObject* pyarray)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        PyObject* arrays = NULL;
+        if (pyarray != Py_None) {
+            if (!PyArray_Check(pyarray) ||
+                !PyArray_ISCARRAY(reinterpret_cast<PyArrayObject*>(pyarray))) {
+                pyca_raise_pyexc_pv("set_output_array", "expected a writeable contiguous numpy array", pv);
+            }
+            arrays = PyList_New(1);
+            if (!arrays) {
+                return NULL;
+            }
+            Py_INCREF(pyarray);
+            PyList_SET_ITEM(arrays, 0, pyarray);
+        }
+        PyObject* oldarrays = pv->arrays;
+        pv->arrays = arrays;
+        Py_XDECREF(oldarrays);
+        pv->nextarray = 0;
+        pv->userarrays = 1;
+        Py_RETURN_NONE;
+    }
+
+    // Start recording monitor events in a history of capacity samples,
+    // dropping any previous history
+    static PyObject* history_start(PyObject* self, PyObject* pycapacity)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        if (!PyInt_Check(pycapacity) || PyInt_AsLong(pycapacity) <= 0) {
+            pyca_raise_pyexc_pv("history_start", "error parsing arguments", pv);
+        }
+        chid cid = pv->cid;
+        if (!cid) {
+            pyca_raise_pyexc_pv("history_start", "channel is null", pv);
+        }
+        short type = ca_field_type(cid);
+        long nelm = pv->eid ? pv->count : ca_element_count(cid);
+        if (nelm == 0 || type == TYPENOTCONN) {
+            pyca_raise_caexc_pv("ca_field_type", ECA_DISCONNCHID, pv);
+        }
+        short dbr_type = dbf_type_to_DBR(type);
+        if (dbr_type_is_ENUM(dbr_type) && pv->string_enum) {
+            dbr_type = DBR_STRING;
+        }
+        PyObject* pydata = pyca_history_data_new(dbr_type, nelm, PyInt_AsLong(pycapacity));
+        if (!pydata) {
+            return NULL;
+        }
+        if (!pv->history) {
+            pyca_history* history = pyca_history_new();
+            // The CA thread reads pv->history without locking
+            pv->history.store(history, std::memory_order_release);
+        }
+        pyca_history* history = pv->history;
+        pthread_mutex_lock(&history->lock);
+        PyObject* pyold = history->pydata;
+        history->pydata = pydata;
+        history->data = reinterpret_cast<pyca_history_data*>(
+            PyCapsule_GetPointer(pydata, "pyca.history"));
+        history->head = 0;
+        history->size = 0;
+        history->total = 0;
+        history->skipped = 0;
+        history->active = 1;
+        pthread_mutex_unlock(&history->lock);
+        Py_XDECREF(pyold);
+        Py_RETURN_NONE;
+    }
+
+    // Stop recording, the history is kept
+    static PyObject* history_stop(PyObject* self, PyObject*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        pyca_history* history = pv->history;
+        if (history) {
+            pthread_mutex_lock(&history->lock);
+            history->active = 0;
+            pthread_mutex_unlock(&history->lock);
+        }
+        Py_RETURN_NONE;
+    }
+
+    // Forget the recorded samples. Arrays previously returned by
+    // history_get() may be views on the storage, in which case a new
+    // storage is used so that they are not overwritten.
+    static PyObject* history_clear(PyObject* self, PyObject*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        pyca_history* history = pv->history;
+        if (!history || !history->pydata) {
+            Py_RETURN_NONE;
+        }
+        PyObject* pydata = NULL;
+        if (Py_REFCNT(history->pydata) > 1) {
+            pyca_history_data* data = history->data;
+            pydata = pyca_history_data_new(data->type, data->nelm, data->capacity);
+            if (!pydata) {
+                return NULL;
+            }
+        }
+        pthread_mutex_lock(&history->lock);
+        PyObject* pyold = NULL;
+        if (pydata) {
+            pyold = history->pydata;
+            history->pydata = pydata;
+            history->data = reinterpret_cast<pyca_history_data*>(
+                PyCapsule_GetPointer(pydata, "pyca.history"));
+        }
+        history->head = 0;
+        history->size = 0;
+        pthread_mutex_unlock(&history->lock);
+        Py_XDECREF(pyold);
+        Py_RETURN_NONE;
+    }
+
+    // Numpy array of n samples of count elements of typenum, a
+    // read-only view on buffer owned by pybase if given, otherwise a
+    // new array
+    static PyObject* _pyca_history_array(int typenum, long n, long count,
+                                         char* buffer, PyObject* pybase)
+    {
+        npy_intp dims[2] = {n, count};
+        int nd = count > 1 ? 2 : 1;
+        int itemsize = typenum == NPY_STRING ? MAX_STRING_SIZE : 0;
+        PyObject* pyarr;
+        if (pybase) {
+            pyarr = PyArray_New(&PyArray_Type, nd, dims, typenum, NULL,
+                                buffer, itemsize, NPY_ARRAY_CARRAY_RO, NULL);
+            Py_INCREF(pybase);
+            if (pyarr &&
+                PyArray_SetBaseObject(reinterpret_cast<PyArrayObject*>(pyarr), pybase) < 0) {
+                Py_DECREF(pyarr);
+                return NULL;
+            } else if (!pyarr) {
+                Py_DECREF(pybase);
+            }
         } else {
-            pv->use_numpy = Py_False;
+            pyarr = PyArray_New(&PyArray_Type, nd, dims, typenum, NULL,
+                                NULL, itemsize, 0, NULL);
         }
-        Py_INCREF(pv->use_numpy);
-        pv->cid = 0;
-        pv->getbuffer = 0;
-        pv->getbufsiz = 0;
-        pv->putbuffer = 0;
-        pv->putbufsiz = 0;
-        pv->eid = 0;
-        return 0;
+        return pyarr;
     }
 
-    static void capv_dealloc(PyObject* self)
+    // Copy or wrap n samples of size bytes starting at slot first of
+    // the ring of capacity samples at buffer, in chronological order
+    static PyObject* _pyca_history_samples(int typenum, long count, size_t size,
+                                           void* buffer, long capacity,
+                                           long first, long n, PyObject* pybase)
+    {
+        char* src = reinterpret_cast<char*>(buffer);
+        if (first + n <= capacity && pybase) {
+            return _pyca_history_array(typenum, n, count, src + first * size, pybase);
+        }
+        PyObject* pyarr = _pyca_history_array(typenum, n, count, NULL, NULL);
+        if (pyarr) {
+            char* dst = reinterpret_cast<char*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(pyarr)));
+            long part = first + n <= capacity ? n : capacity - first;
+            memcpy(dst, src + first * size, part * size);
+            memcpy(dst + part * size, src, (n - part) * size);
+        }
+        return pyarr;
+    }
+
+    // Return the recorded samples, oldest first, as a dictionary of
+    // numpy arrays. While the history is not full these are read-only
+    // views on the native storage, otherwise contiguous copies.
+    static PyObject* history_get(PyObject* self, PyObject*)
     {
         capv* pv = reinterpret_cast<capv*>(self);
-        Py_XDECREF(pv->data);
-        Py_XDECREF(pv->name);
-        Py_XDECREF(pv->processor);
-        Py_XDECREF(pv->connect_cb);
-        Py_XDECREF(pv->monitor_cb);
-        Py_XDECREF(pv->rwaccess_cb);
-        Py_XDECREF(pv->getevt_cb);
-        Py_XDECREF(pv->putevt_cb);
-        Py_XDECREF(pv->simulated);
-        Py_XDECREF(pv->use_numpy);
-        if (pv->cid) {
-            ca_clear_channel(pv->cid);
-            pv->cid = 0;
+        pyca_history* history = pv->history;
+        if (!history || !history->pydata) {
+            pyca_raise_pyexc_pv("history_get", "history not started", pv);
+        }
+        PyObject* pydict = PyDict_New();
+        if (!pydict) {
+            return NULL;
+        }
+        // The CA thread records without the GIL, so holding both here
+        // can't deadlock
+        pthread_mutex_lock(&history->lock);
+        pyca_history_data* data = history->data;
+        long n = history->size;
+        long capacity = data->capacity;
+        long first = (history->head - n + capacity) % capacity;
+        // Views only on samples which won't be overwritten
+        PyObject* pybase = n < capacity ? history->pydata : NULL;
+        _pyca_setitem(pydict, "value",
+                      _pyca_history_samples(_numpy_dbr_type(data->type), data->nelm,
+                                            (size_t)data->nelm * data->elsize,
+                                            data->values, capacity, first, n, pybase));
+        _pyca_setitem(pydict, "secs",
+                      _pyca_history_samples(NPY_UINT32, 1, sizeof(dbr_ulong_t),
+                                            data->secs, capacity, first, n, pybase));
+        _pyca_setitem(pydict, "nsec",
+                      _pyca_history_samples(NPY_UINT32, 1, sizeof(dbr_ulong_t),
+                                            data->nsec, capacity, first, n, pybase));
+        _pyca_setitem(pydict, "status",
+                      _pyca_history_samples(NPY_INT16, 1, sizeof(dbr_short_t),
+                                            data->status, capacity, first, n, pybase));
+        _pyca_setitem(pydict, "severity",
+                      _pyca_history_samples(NPY_INT16, 1, sizeof(dbr_short_t),
+                                            data->severity, capacity, first, n, pybase));
+        _pyca_setitem(pydict, "total", PyLong_FromUnsignedLong(history->total));
+        pthread_mutex_unlock(&history->lock);
+        if (PyErr_Occurred()) {
+            Py_DECREF(pydict);
+            return NULL;
+        }
+        return pydict;
+    }
+
+    // Start accumulating statistics of the monitor events, keeping
+    // those accumulated so far
+    static PyObject* accum_start(PyObject* self, PyObject*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        pyca_accum* accum = pv->accum;
+        if (!accum) {
+            accum = pyca_accum_new();
+            // The CA thread reads pv->accum without locking
+            pv->accum.store(accum, std::memory_order_release);
+        }
+        pthread_mutex_lock(&accum->lock);
+        accum->active = 1;
+        pthread_mutex_unlock(&accum->lock);
+        Py_RETURN_NONE;
+    }
+
+    static PyObject* accum_stop(PyObject* self, PyObject*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        pyca_accum* accum = pv->accum;
+        if (accum) {
+            pthread_mutex_lock(&accum->lock);
+            accum->active = 0;
+            pthread_mutex_unlock(&accum->lock);
+        }
+        Py_RETURN_NONE;
+    }
+
+    static PyObject* accum_reset(PyObject* self, PyObject*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        pyca_accum* accum = pv->accum;
+        if (accum) {
+            pthread_mutex_lock(&accum->lock);
+            accum->count = 0;
+            pthread_mutex_unlock(&accum->lock);
+        }
+        Py_RETURN_NONE;
+    }
+
+    // Float for scalars, numpy array of nelm doubles otherwise
+    static PyObject* _pyca_accum_value(const double* values, long nelm, double scale, bool root)
+    {
+        if (nelm == 1) {
+            double value = values[0] * scale;
+            return PyFloat_FromDouble(root ? sqrt(value) : value);
+        }
+        npy_intp dims[1] = {nelm};
+        PyObject* pyarr = PyArray_EMPTY(1, dims, NPY_FLOAT64, 0);
+        if (pyarr) {
+            double* dst = reinterpret_cast<double*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(pyarr)));
+            for (long i=0; i<nelm; i++) {
+                double value = values[i] * scale;
+                dst[i] = root ? sqrt(value) : value;
+            }
+        }
+        return pyarr;
+    }
+
+    // Return the statistics accumulated so far with the same keys as
+    // psp's monitor_get(): mean, std (population), num and err (the
+    // standard error of the mean), as well as var, min and max
+    static PyObject* accum_get(PyObject* self, PyObject*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        pyca_accum* accum = pv->accum;
+        if (!accum) {
+            pyca_raise_pyexc_pv("accum_get", "statistics not started", pv);
+        }
+        PyObject* pydict = PyDict_New();
+        if (!pydict) {
+            return NULL;
+        }
+        pthread_mutex_lock(&accum->lock);
+        unsigned long count = accum->count;
+        _pyca_setitem(pydict, "num", PyLong_FromUnsignedLong(count));
+        if (count == 0) {
+            _pyca_setitem(pydict, "mean", PyFloat_FromDouble(NAN));
+            _pyca_setitem(pydict, "var", PyFloat_FromDouble(NAN));
+            _pyca_setitem(pydict, "std", PyFloat_FromDouble(NAN));
+            _pyca_setitem(pydict, "err", PyFloat_FromDouble(NAN));
+            _pyca_setitem(pydict, "min", PyFloat_FromDouble(NAN));
+            _pyca_setitem(pydict, "max", PyFloat_FromDouble(NAN));
+        } else {
+            long nelm = accum->nelm;
+            _pyca_setitem(pydict, "mean", _pyca_accum_value(accum->mean, nelm, 1, false));
+            _pyca_setitem(pydict, "var", _pyca_accum_value(accum->m2, nelm, 1.0/count, false));
+            _pyca_setitem(pydict, "std", _pyca_accum_value(accum->m2, nelm, 1.0/count, true));
+            _pyca_setitem(pydict, "err", _pyca_accum_value(accum->m2, nelm, 1.0/count/count, true));
+            _pyca_setitem(pydict, "min", _pyca_accum_value(accum->min, nelm, 1, false));
+            _pyca_setitem(pydict, "max", _pyca_accum_value(accum->max, nelm, 1, false));
+        }
+        pthread_mutex_unlock(&accum->lock);
+        if (PyErr_Occurred()) {
+            Py_DECREF(pydict);
+            return NULL;
+        }
+        return pydict;
+    }
+
+    static PyObject* latency_start(PyObject* self, PyObject*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        pyca_latency* latency = pv->latency;
+        if (!latency) {
+            latency = pyca_latency_new();
+            // The CA thread reads pv->latency without locking
+            pv->latency.store(latency, std::memory_order_release);
+        }
+        pthread_mutex_lock(&latency->lock);
+        latency->active = 1;
+        pthread_mutex_unlock(&latency->lock);
+        Py_RETURN_NONE;
+    }
+
+    static PyObject* latency_stop(PyObject* self, PyObject*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        pyca_latency* latency = pv->latency;
+        if (latency) {
+            pthread_mutex_lock(&latency->lock);
+            latency->active = 0;
+            pthread_mutex_unlock(&latency->lock);
+        }
+        Py_RETURN_NONE;
+    }
+
+    static PyObject* latency_reset(PyObject* self, PyObject*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        pyca_latency* latency = pv->latency;
+        if (latency) {
+            pthread_mutex_lock(&latency->lock);
+            pyca_hist_clear(&latency->transport);
+            pyca_hist_clear(&latency->delivery);
+            latency->skewed = 0;
+            pthread_mutex_unlock(&latency->lock);
+        }
+        Py_RETURN_NONE;
+    }
+
+    // Return copies of the 'transport' and 'delivery' histograms as
+    // pyca.histogram objects, and the number of events time stamped in
+    // the future ('skewed')
+    static PyObject* latency_get(PyObject* self, PyObject*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        pyca_latency* latency = pv->latency;
+        if (!latency) {
+            pyca_raise_pyexc_pv("latency_get", "latency not started", pv);
+        }
+        PyObject* pytransport = _pyca_histogram_new();
+        PyObject* pydelivery = _pyca_histogram_new();
+        if (!pytransport || !pydelivery) {
+            Py_XDECREF(pytransport);
+            Py_XDECREF(pydelivery);
+            return NULL;
+        }
+        unsigned long skewed;
+        pthread_mutex_lock(&latency->lock);
+        pyca_hist_merge(reinterpret_cast<histogram*>(pytransport)->hist, &latency->transport);
+        pyca_hist_merge(reinterpret_cast<histogram*>(pydelivery)->hist, &latency->delivery);
+        skewed = latency->skewed;
+        pthread_mutex_unlock(&latency->lock);
+        PyObject* pydict = PyDict_New();
+        if (!pydict) {
+            Py_DECREF(pytransport);
+            Py_DECREF(pydelivery);
+            return NULL;
+        }
+        _pyca_setitem(pydict, "transport", pytransport);
+        _pyca_setitem(pydict, "delivery", pydelivery);
+        _pyca_setitem(pydict, "skewed", PyLong_FromUnsignedLong(skewed));
+        return pydict;
+    }
+
+    // Publish the monitor events in a shared memory ring of slots
+    // updates, sized for the current subscription
+    static PyObject* shm_publish(PyObject* self, PyObject* args, PyObject* kwds)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        const char* name;
+        long nslots = 8;
+        static const char* kwlist[] = {"name", "slots", NULL};
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|l:shm_publish", (char**)kwlist,
+                                         &name, &nslots) ||
+            nslots <= 0 || !name[0]) {
+            pyca_raise_pyexc_pv("shm_publish", "error parsing arguments", pv);
+        }
+        chid cid = pv->cid;
+        if (!cid) {
+            pyca_raise_pyexc_pv("shm_publish", "channel is null", pv);
+        }
+        short type = ca_field_type(cid);
+        long nelm = pv->eid ? pv->count : ca_element_count(cid);
+        if (nelm == 0 || type == TYPENOTCONN) {
+            pyca_raise_caexc_pv("ca_field_type", ECA_DISCONNCHID, pv);
+        }
+        short dbr_type = dbf_type_to_DBR(type);
+        if (dbr_type_is_ENUM(dbr_type) && pv->string_enum) {
+            dbr_type = DBR_STRING;
+        }
+        if (!pv->shm) {
+            pyca_shm_pub* pub = pyca_shm_pub_new();
+            // The CA thread reads pv->shm without locking
+            pv->shm.store(pub, std::memory_order_release);
+        }
+        pyca_shm_pub_stop(pv->shm);
+        pyca_shm_map* map = pyca_shm_create(name, dbr_type, nelm, nslots);
+        if (!map) {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, name);
+            return NULL;
+        }
+        pyca_shm_pub* pub = pv->shm;
+        pthread_mutex_lock(&pub->lock);
+        pub->path = pyca_shm_name(name);
+        pub->skipped = 0;
+        pub->map = map;
+        pthread_mutex_unlock(&pub->lock);
+        Py_RETURN_NONE;
+    }
+
+    // Stop publishing and remove the shared memory segment
+    static PyObject* shm_stop(PyObject* self, PyObject*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        if (pv->shm) {
+            pyca_shm_pub_stop(pv->shm);
+        }
+        Py_RETURN_NONE;
+    }
+
+    // Counters of the event path of the PV, reset to 0 if reset is True
+    static PyObject* capv_stats(PyObject* self, PyObject* args, PyObject* kwds)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        PyObject* pyreset = Py_False;
+        static const char* kwlist[] = {"reset", NULL};
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:stats", (char**)kwlist, &pyreset)) {
+            pyca_raise_pyexc_pv("stats", "error parsing arguments", pv);
+        }
+        return pyca_stats_dict(pv->stats, PyObject_IsTrue(pyreset));
+    }
+
+    // Switch record mode on or off
+    static PyObject* set_record(PyObject* self, PyObject* pyval)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        if (!PyBool_Check(pyval)) {
+            pyca_raise_pyexc_pv("set_record", "error parsing arguments", pv);
+        }
+        if (pyval == Py_True) {
+            if (!pv->record) {
+                pv->record = pyca_record_new();
+            }
+        } else if (pv->record) {
+            _pyca_record_sync(pv);
+            pyca_record_free(pv->record);
+            pv->record = 0;
+        }
+        Py_RETURN_NONE;
+    }
+
+    static PyObject* is_record(PyObject* self, PyObject*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        return PyBool_FromLong(pv->record != 0);
+    }
+
+    // Keep a raw copy of the events for the buffer protocol, see
+    // rawbuf.hh
+    static PyObject* set_buffer(PyObject* self, PyObject* pyval)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        if (!PyBool_Check(pyval)) {
+            pyca_raise_pyexc_pv("set_buffer", "error parsing arguments", pv);
+        }
+        pv->keepraw = pyval == Py_True;
+        if (!pv->keepraw) {
+            // Views of the last event keep it alive
+            pyca_raw_detach(pv);
+        }
+        Py_RETURN_NONE;
+    }
+
+    static PyObject* is_buffer(PyObject* self, PyObject*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        return PyBool_FromLong(pv->keepraw);
+    }
+
+    // Properties of the capv type
+    static PyObject* capv_get_data(PyObject* self, void*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        _pyca_record_sync(pv);
+        Py_INCREF(pv->data);
+        return pv->data;
+    }
+
+    static int capv_set_data(PyObject* self, PyObject* pyval, void*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        if (!pyval || !PyDict_Check(pyval)) {
+            PyErr_SetString(PyExc_TypeError, "data must be a dictionary");
+            return -1;
+        }
+        if (pv->record) {
+            pv->record->stale = 0;
+        }
+        Py_INCREF(pyval);
+        Py_DECREF(pv->data);
+        pv->data = pyval;
+        return 0;
+    }
+
+    static PyObject* capv_get_generation(PyObject* self, void*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        return PyLong_FromUnsignedLong(pv->generation);
+    }
+
+    // A processor is either a capsule of version 2, run natively by the
+    // CA thread, or an older one, run when the value is decoded. None
+    // removes it.
+    static PyObject* capv_get_processor(PyObject* self, void*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        pyca_proc* proc = pv->proc;
+        PyObject* processor = proc && proc->capsule ?
+            proc->capsule : pv->processor;
+        if (!processor) {
+            processor = Py_None;
+        }
+        Py_INCREF(processor);
+        return processor;
+    }
+
+    static int capv_set_processor(PyObject* self, PyObject* pyval, void*)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        pyca_processor* processor = 0;
+        if (pyval && PyCapsule_IsValid(pyval, PYCA_PROCESSOR_CAPSULE)) {
+            processor = _pyca_proc_check(pyval);
+            if (!processor) {
+                return -1;
+            }
+            if (!pv->proc) {
+                pyca_proc* proc = pyca_proc_new(PyString_AsString(pv->name));
+                // Publish the slot after it is initialized
+                pv->proc.store(proc, std::memory_order_release);
+            }
+        }
+        if (pv->proc) {
+            pyca_proc_set(pv->proc, processor ? pyval : NULL, processor);
+        }
+        Py_CLEAR(pv->processor);
+        if (pyval && pyval != Py_None && !processor) {
+            Py_INCREF(pyval);
+            pv->processor = pyval;
+        }
+        return 0;
+    }
+
+    static PyObject* capv_get_field(PyObject* self, void* closure)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        return _pyca_field_get(pv, static_cast<int>(reinterpret_cast<intptr_t>(closure)));
+    }
+
+    static bool numpy_arrays = false;
+    static bool sync_callbacks = false;
+
+    // Built-in methods for the capv type
+    static int capv_init(PyObject* self, PyObject* args, PyObject* kwds)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        if (!pv->stats) {
+            pv->stats = pyca_stats_new();
+        }
+        if (!PyArg_ParseTuple(args, "O:capv_init", &pv->name) ||
+            !PyString_Check(pv->name)) {
+            pyca_raise_pyexc_int("capv_init", "cannot get PV name", pv);
+        }
+        Py_INCREF(pv->name);
+        pv->tracename = pyca_trace_name(pv->name);
+        if (!pv->tracename) {
+            return -1;
+        }
+        pv->processor = 0;
+        pv->proc = 0;
+        pv->connect_cb = 0;
+        pv->monitor_cb = 0;
+        pv->rwaccess_cb = 0;
+        pv->getevt_cb = 0;
+        pv->putevt_cb = 0;
+        pv->simulated = Py_None;
+        Py_INCREF(pv->simulated);
+        if (numpy_arrays) {
+            pv->use_numpy = Py_True;
+        } else {
+            pv->use_numpy = Py_False;
+        }
+        Py_INCREF(pv->use_numpy);
+        if (sync_callbacks) {
+            pv->sync_callback = Py_True;
+        } else {
+            pv->sync_callback = Py_False;
+        }
+        Py_INCREF(pv->sync_callback);
+        pv->cid = 0;
+        pv->getbuffer = 0;
+        pv->getbufsiz = 0;
+        pv->putbuffer = 0;
+        pv->putbufsiz = 0;
+        pv->eid = 0;
+        pv->propeid = 0;
+        pv->connected = 0;
+        pv->queued = 0;
+        pv->latest = 0;
+        pv->arrays = 0;
+        pv->nextarray = 0;
+        pv->userarrays = 0;
+        pv->history = 0;
+        pv->accum = 0;
+        pv->shm = 0;
+        pv->rectap = 0;
+        pv->record = 0;
+        pv->enums = 0;
+        pv->asyncmon = 0;
+        pv->asyncops = 0;
+        pv->raw = 0;
+        pv->keepraw = 0;
+        pv->generation = 0;
+        pv->latency = 0;
+        return 0;
+    }
+
+    static void capv_dealloc(PyObject* self)
+    {
+        capv* pv = reinterpret_cast<capv*>(self);
+        Py_XDECREF(pv->data);
+        Py_XDECREF(pv->name);
+        Py_XDECREF(pv->processor);
+        Py_XDECREF(pv->connect_cb);
+        Py_XDECREF(pv->monitor_cb);
+        Py_XDECREF(pv->rwaccess_cb);
+        Py_XDECREF(pv->getevt_cb);
+        Py_XDECREF(pv->putevt_cb);
+        Py_XDECREF(pv->simulated);
+        Py_XDECREF(pv->use_numpy);
+        Py_XDECREF(pv->sync_callback);
+        Py_XDECREF(pv->arrays);
+        if (pv->cid) {
+            ca_clear_channel(pv->cid);
+            pv->cid = 0;
+        }
+        _pyca_unqueue(pv);
+        _pyca_deferred_forget(pv);
+        if (pv->getbuffer) {
+            delete [] pv->getbuffer;
+            pv->getbuffer = 0;
+            pv->getbufsiz = 0;
+        }
+        if (pv->putbuffer) {
+            delete [] pv->putbuffer;
+            pv->putbuffer = 0;
+            pv->putbufsiz = 0;
+        }
+        if (pv->latest) {
+            // Not left on the dirty lists of the event queue
+            if (pyca_events) {
+                pyca_evqueue_unlink_dirty(pyca_events, pv);
+            }
+            pyca_latest_free(pv->latest);
+            pv->latest = 0;
+        }
+        pyca_history* history = pv->history;
+        if (history) {
+            Py_XDECREF(history->pydata);
+            pthread_mutex_destroy(&history->lock);
+            delete history;
+            pv->history = 0;
+        }
+        pyca_accum* accum = pv->accum;
+        if (accum) {
+            pyca_accum_free_arrays(accum);
+            pthread_mutex_destroy(&accum->lock);
+            delete accum;
+            pv->accum = 0;
+        }
+        if (pv->shm) {
+            pyca_shm_pub_free(pv->shm);
+            pv->shm = 0;
+        }
+        if (pv->rectap) {
+            // Recorders own a reference, pv is no longer recorded
+            pyca_rec_tap_free(pv->rectap);
+            pv->rectap = 0;
+        }
+        if (pv->record) {
+            pyca_record_free(pv->record);
+            pv->record = 0;
+        }
+        if (pv->enums) {
+            pyca_enums_free(pv->enums);
+            pv->enums = 0;
+        }
+        if (pv->proc) {
+            pyca_proc_free(pv->proc);
+            pv->proc = 0;
+        }
+        if (pv->latency) {
+            pyca_latency_free(pv->latency);
+            pv->latency = 0;
+        }
+        // Views of the last event keep it alive
+        pyca_raw_detach(pv);
+        delete pv->stats;
+        pv->stats = 0;
+        self->ob_type->tp_free(self);
+    }
+
+    static PyObject* capv_new(PyTypeObject* type, PyObject* args, PyObject* kwds)
+    {
+        PyObject* self = type->tp_alloc(type, 0);
+        capv* pv = reinterpret_cast<capv*>(self);
+        if (!pv) {
+            pyca_raise_pyexc("capv_new", "cannot allocate new PV");
+        }
+        pv->data = PyDict_New();
+        if (!pv->data) {
+            pyca_raise_pyexc("capv_new", "cannot allocate dictionary for new PV");
+        }
+        Py_INCREF(pv);
+        return self;
+    }
+
+    // Register capv methods
+    static PyMethodDef capv_methods[] = {
+        {"create_channel", create_channel, METH_NOARGS},
+        {"clear_channel", clear_channel, METH_NOARGS},
+        {"subscribe_channel", (PyCFunction)subscribe_channel, METH_VARARGS | METH_KEYWORDS},
+        {"unsubscribe_channel", unsubscribe_channel, METH_NOARGS},
+        {"get_data", get_data, METH_VARARGS},
+        {"put_data", put_data, METH_VARARGS},
+#ifdef IS_PY3K
+        {"get_async", (PyCFunction)get_async, METH_VARARGS | METH_KEYWORDS},
+        {"put_async", put_async, METH_O},
+        {"monitor_async", (PyCFunction)monitor_async, METH_VARARGS | METH_KEYWORDS},
+#endif
+        {"host", host, METH_NOARGS},
+        {"state", state, METH_NOARGS},
+        {"count", count, METH_NOARGS},
+        {"type", type, METH_NOARGS},
+        {"rwaccess", rwaccess, METH_NOARGS},
+        {"replace_access_rights_event", replace_access_rights_event, METH_NOARGS},
+        {"set_string_enum", set_string_enum, METH_O},
+        {"is_string_enum", is_string_enum, METH_NOARGS},
+        {"get_enum_strings", get_enum_strings, METH_O},
+        {"set_array_pool", set_array_pool, METH_O},
+        {"set_output_array", set_output_array, METH_O},
+        {"history_start", history_start, METH_O},
+        {"history_stop", history_stop, METH_NOARGS},
+        {"history_clear", history_clear, METH_NOARGS},
+        {"history_get", history_get, METH_NOARGS},
+        {"accum_start", accum_start, METH_NOARGS},
+        {"accum_stop", accum_stop, METH_NOARGS},
+        {"accum_reset", accum_reset, METH_NOARGS},
+        {"accum_get", accum_get, METH_NOARGS},
+        {"shm_publish", (PyCFunction)shm_publish, METH_VARARGS|METH_KEYWORDS},
+        {"shm_stop", shm_stop, METH_NOARGS},
+        {"latency_start", latency_start, METH_NOARGS},
+        {"latency_stop", latency_stop, METH_NOARGS},
+        {"latency_reset", latency_reset, METH_NOARGS},
+        {"latency_get", latency_get, METH_NOARGS},
+        {"stats", (PyCFunction)capv_stats, METH_VARARGS|METH_KEYWORDS},
+        {"set_record", set_record, METH_O},
+        {"is_record", is_record, METH_NOARGS},
+        {"set_buffer", set_buffer, METH_O},
+        {"is_buffer", is_buffer, METH_NOARGS},
+        {NULL,  NULL},
+    };
+
+    // Register capv members
+    static PyMemberDef capv_members[] = {
+        {"name", T_OBJECT_EX, offsetof(capv, name), 0, "name"},
+        {"connect_cb", T_OBJECT_EX, offsetof(capv, connect_cb), 0, "connect_cb"},
+        {"monitor_cb", T_OBJECT_EX, offsetof(capv, monitor_cb), 0, "monitor_cb"},
+        {"rwaccess_cb", T_OBJECT_EX, offsetof(capv, rwaccess_cb), 0, "rwaccess_cb"},
+        {"getevt_cb", T_OBJECT_EX, offsetof(capv, getevt_cb), 0, "getevt_cb"},
+        {"putevt_cb", T_OBJECT_EX, offsetof(capv, putevt_cb), 0, "putevt_cb"},
+        {"simulated", T_OBJECT_EX, offsetof(capv, simulated), 0, "simulated"},
+        {"use_numpy", T_OBJECT_EX, offsetof(capv, use_numpy), 0, "use_numpy"},
+        {"sync_callback", T_OBJECT_EX, offsetof(capv, sync_callback), 0, "sync_callback"},
+        {NULL}
+    };
+
+    // Register capv properties
+#define PYCA_FIELD_GETSET(field) \
+    {(char*)pyca_field_names[field], capv_get_field, NULL, \
+     (char*)pyca_field_names[field], reinterpret_cast<void*>(field)}
+    static PyGetSetDef capv_getset[] = {
+        {(char*)"data", capv_get_data, capv_set_data, (char*)"data", NULL},
+        {(char*)"processor", capv_get_processor, capv_set_processor,
+         (char*)"processor", NULL},
+        {(char*)"generation", capv_get_generation, NULL,
+         (char*)"generation", NULL},
+        PYCA_FIELD_GETSET(PYCA_STATUS),
+        PYCA_FIELD_GETSET(PYCA_SEVERITY),
+        PYCA_FIELD_GETSET(PYCA_SECS),
+        PYCA_FIELD_GETSET(PYCA_NSEC),
+        PYCA_FIELD_GETSET(PYCA_VALUE),
+        PYCA_FIELD_GETSET(PYCA_UNITS),
+        PYCA_FIELD_GETSET(PYCA_PRECISION),
+        PYCA_FIELD_GETSET(PYCA_NO_STR),
+        PYCA_FIELD_GETSET(PYCA_DISPLAY_LLIM),
+        PYCA_FIELD_GETSET(PYCA_DISPLAY_HLIM),
+        PYCA_FIELD_GETSET(PYCA_WARN_LLIM),
+        PYCA_FIELD_GETSET(PYCA_WARN_HLIM),
+        PYCA_FIELD_GETSET(PYCA_ALARM_LLIM),
+        PYCA_FIELD_GETSET(PYCA_ALARM_HLIM),
+        PYCA_FIELD_GETSET(PYCA_CTRL_LLIM),
+        PYCA_FIELD_GETSET(PYCA_CTRL_HLIM),
+        PYCA_FIELD_GETSET(PYCA_ENUM_STR),
+        {NULL},
+    };
+#undef PYCA_FIELD_GETSET
+
+    // The buffer protocol exports the value of the last event
+    static PyBufferProcs capv_as_buffer = {
+#ifndef IS_PY3K
+        0,                                      /* bf_getreadbuffer */
+        0,                                      /* bf_getwritebuffer */
+        0,                                      /* bf_getsegcount */
+        0,                                      /* bf_getcharbuffer */
+#endif
+        pyca_raw_getbuffer,                     /* bf_getbuffer */
+        pyca_raw_releasebuffer,                 /* bf_releasebuffer */
+    };
+
+    static PyTypeObject capv_type = {
+        PyObject_HEAD_INIT(0)
+#ifndef IS_PY3K
+        0,
+#endif
+        "pyca.capv",
+        sizeof(capv),
+        0,
+        capv_dealloc,                           /* tp_dealloc */
+        0,                                      /* tp_print */
+        0,                                      /* tp_getattr */
+        0,                                      /* tp_setattr */
+        0,                                      /* tp_compare */
+        0,                                      /* tp_repr */
+        0,                                      /* tp_as_number */
+        0,                                      /* tp_as_sequence */
+        0,                                      /* tp_as_mapping */
+        0,                                      /* tp_hash */
+        0,                                      /* tp_call */
+        0,                                      /* tp_str */
+        0,                                      /* tp_getattro */
+        0,                                      /* tp_setattro */
+        &capv_as_buffer,                        /* tp_as_buffer */
+#ifdef IS_PY3K
+        Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /* tp_flags */
+#else
+        Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_NEWBUFFER,
+#endif
+        0,                                      /* tp_doc */
+        0,                                      /* tp_traverse */
+        0,                                      /* tp_clear */
+        0,                                      /* tp_richcompare */
+        0,                                      /* tp_weaklistoffset */
+        0,                                      /* tp_iter */
+        0,                                      /* tp_iternext */
+        capv_methods,                           /* tp_methods */
+        capv_members,                           /* tp_members */
+        capv_getset,                            /* tp_getset */
+        0,                                      /* tp_base */
+        0,                                      /* tp_dict */
+        0,                                      /* tp_descr_get */
+        0,                                      /* tp_descr_set */
+        0,                                      /* tp_dictoffset */
+        capv_init,                              /* tp_init */
+        0,                                      /* tp_alloc */
+        capv_new,                               /* tp_new */
+    };
+
+    // Reader of the shared memory ring of a publishing capv, possibly
+    // in another process
+    struct shm_reader {
+        PyObject_HEAD
+        pyca_shm_map* map;
+    };
+
+    static PyObject* shm_reader_new(PyTypeObject* type, PyObject* args, PyObject* kwds)
+    {
+        const char* name;
+        static const char* kwlist[] = {"name", NULL};
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "s:shm_reader", (char**)kwlist, &name)) {
+            return NULL;
+        }
+        pyca_shm_map* map = pyca_shm_attach(name);
+        if (!map) {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, name);
+            return NULL;
+        }
+        shm_reader* reader = reinterpret_cast<shm_reader*>(type->tp_alloc(type, 0));
+        if (!reader) {
+            pyca_shm_unmap(map);
+            return NULL;
+        }
+        reader->map = map;
+        return reinterpret_cast<PyObject*>(reader);
+    }
+
+    static void shm_reader_dealloc(PyObject* self)
+    {
+        shm_reader* reader = reinterpret_cast<shm_reader*>(self);
+        // Views of the slots own a reference to the reader
+        if (reader->map) {
+            pyca_shm_unmap(reader->map);
+        }
+        Py_TYPE(self)->tp_free(self);
+    }
+
+    // Return an update, the latest by default, as a dictionary with its
+    // 'update' number, 'secs', 'nsec', 'status', 'severity' and 'value',
+    // a read-only view of the slot unless copy is True. Returns None if
+    // the update is not in the ring.
+    static PyObject* shm_reader_get(PyObject* self, PyObject* args, PyObject* kwds)
+    {
+        shm_reader* reader = reinterpret_cast<shm_reader*>(self);
+        pyca_shm_map* map = reader->map;
+        PyObject* pyupdate = Py_None;
+        PyObject* pycopy = Py_False;
+        static const char* kwlist[] = {"update", "copy", NULL};
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OO:get", (char**)kwlist,
+                                         &pyupdate, &pycopy)) {
+            return NULL;
+        }
+        uint64_t update;
+        if (pyupdate == Py_None) {
+            update = map->header->head.load(std::memory_order_acquire);
+        } else {
+            update = PyLong_AsUnsignedLongLong(pyupdate);
+            if (PyErr_Occurred()) {
+                return NULL;
+            }
+        }
+        pyca_shm_header* header = map->header;
+        int typenum = _numpy_dbr_type(header->dbr_type);
+        bool copy = PyObject_IsTrue(pycopy);
+        pyca_shm_meta meta;
+        PyObject* pyvalue = NULL;
+        if (copy) {
+            // Copy the largest value, the array is shrunk to its count
+            pyvalue = _pyca_history_array(typenum, header->nelm, 1, NULL, NULL);
+            if (!pyvalue) {
+                return NULL;
+            }
+            char* dst = PyArray_BYTES(reinterpret_cast<PyArrayObject*>(pyvalue));
+            if (!pyca_shm_read(map, update, &meta, dst)) {
+                Py_DECREF(pyvalue);
+                Py_RETURN_NONE;
+            }
+            if (meta.count < header->nelm) {
+                PyObject* pyfull = pyvalue;
+                pyvalue = PySequence_GetSlice(pyfull, 0, meta.count);
+                Py_DECREF(pyfull);
+                if (!pyvalue) {
+                    return NULL;
+                }
+            }
+        } else {
+            if (!pyca_shm_read(map, update, &meta, NULL)) {
+                Py_RETURN_NONE;
+            }
+            char* src = pyca_shm_value_of(pyca_shm_slot_of(map, update));
+            pyvalue = _pyca_history_array(typenum, meta.count, 1, src, self);
+            if (!pyvalue) {
+                return NULL;
+            }
+        }
+        PyObject* pydict = PyDict_New();
+        if (!pydict) {
+            Py_DECREF(pyvalue);
+            return NULL;
+        }
+        _pyca_setitem(pydict, "update", PyLong_FromUnsignedLongLong(update));
+        _pyca_setitem(pydict, "secs", PyLong_FromUnsignedLong(meta.secs));
+        _pyca_setitem(pydict, "nsec", PyLong_FromUnsignedLong(meta.nsec));
+        _pyca_setitem(pydict, "status", PyInt_FromLong(meta.status));
+        _pyca_setitem(pydict, "severity", PyInt_FromLong(meta.severity));
+        _pyca_setitem(pydict, "value", pyvalue);
+        return pydict;
+    }
+
+    // Whether the slot of an update still holds it, to be called after
+    // using a view returned by get()
+    static PyObject* shm_reader_valid(PyObject* self, PyObject* pyupdate)
+    {
+        shm_reader* reader = reinterpret_cast<shm_reader*>(self);
+        uint64_t update = PyLong_AsUnsignedLongLong(pyupdate);
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+        return PyBool_FromLong(pyca_shm_valid(reader->map, update));
+    }
+
+    static PyObject* shm_reader_get_head(PyObject* self, void*)
+    {
+        shm_reader* reader = reinterpret_cast<shm_reader*>(self);
+        return PyLong_FromUnsignedLongLong(
+            reader->map->header->head.load(std::memory_order_acquire));
+    }
+
+    static PyObject* shm_reader_get_slots(PyObject* self, void*)
+    {
+        shm_reader* reader = reinterpret_cast<shm_reader*>(self);
+        return PyInt_FromLong(reader->map->header->nslots);
+    }
+
+    static PyObject* shm_reader_get_nelm(PyObject* self, void*)
+    {
+        shm_reader* reader = reinterpret_cast<shm_reader*>(self);
+        return PyInt_FromLong(reader->map->header->nelm);
+    }
+
+    static PyMethodDef shm_reader_methods[] = {
+        {"get", (PyCFunction)shm_reader_get, METH_VARARGS|METH_KEYWORDS},
+        {"valid", shm_reader_valid, METH_O},
+        {NULL,  NULL},
+    };
+
+    static PyGetSetDef shm_reader_getset[] = {
+        {(char*)"head", shm_reader_get_head, NULL, (char*)"head", NULL},
+        {(char*)"slots", shm_reader_get_slots, NULL, (char*)"slots", NULL},
+        {(char*)"nelm", shm_reader_get_nelm, NULL, (char*)"nelm", NULL},
+        {NULL},
+    };
+
+    static PyTypeObject shm_reader_type = {
+        PyVarObject_HEAD_INIT(0, 0)
+        "pyca.shm_reader",
+        sizeof(shm_reader),
+        0,
+        shm_reader_dealloc,                     /* tp_dealloc */
+        0,                                      /* tp_print */
+        0,                                      /* tp_getattr */
+        0,                                      /* tp_setattr */
+        0,                                      /* tp_compare */
+        0,                                      /* tp_repr */
+        0,                                      /* tp_as_number */
+        0,                                      /* tp_as_sequence */
+        0,                                      /* tp_as_mapping */
+        0,                                      /* tp_hash */
+        0,                                      /* tp_call */
+        0,                                      /* tp_str */
+        0,                                      /* tp_getattro */
+        0,                                      /* tp_setattro */
+        0,                                      /* tp_as_buffer */
+        Py_TPFLAGS_DEFAULT,                     /* tp_flags */
+        0,                                      /* tp_doc */
+        0,                                      /* tp_traverse */
+        0,                                      /* tp_clear */
+        0,                                      /* tp_richcompare */
+        0,                                      /* tp_weaklistoffset */
+        0,                                      /* tp_iter */
+        0,                                      /* tp_iternext */
+        shm_reader_methods,                     /* tp_methods */
+        0,                                      /* tp_members */
+        shm_reader_getset,                      /* tp_getset */
+        0,                                      /* tp_base */
+        0,                                      /* tp_dict */
+        0,                                      /* tp_descr_get */
+        0,                                      /* tp_descr_set */
+        0,                                      /* tp_dictoffset */
+        0,                                      /* tp_init */
+        0,                                      /* tp_alloc */
+        shm_reader_new,                         /* tp_new */
+    };
+
+    // Recorder of the monitor events of a set of capv into a file
+    struct recorder {
+        PyObject_HEAD
+        pyca_recorder* rec;
+        PyObject* pvs;      // tuple of the recorded capv
+        int closed;
+    };
+
+    static PyObject* recorder_new(PyTypeObject* type, PyObject* args, PyObject* kwds)
+    {
+        const char* path;
+        PyObject* pyseq;
+        Py_ssize_t chunk_size = 1 << 20;
+        double flush_interval = 1.0;
+        static const char* kwlist[] = {"path", "pvs", "chunk_size", "flush_interval", NULL};
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "sO|nd:recorder", (char**)kwlist,
+                                         &path, &pyseq, &chunk_size, &flush_interval)) {
+            return NULL;
+        }
+        if (chunk_size <= 0 || flush_interval <= 0) {
+            pyca_raise_pyexc("recorder", "error parsing arguments");
+        }
+        PyObject* pvs = PySequence_Tuple(pyseq);
+        if (!pvs) {
+            return NULL;
+        }
+        int npvs = PyTuple_GET_SIZE(pvs);
+        pyca_rec_pvdesc* descs = new pyca_rec_pvdesc[npvs > 0 ? npvs : 1];
+        char** names = new char*[npvs > 0 ? npvs : 1];
+        int nnames = 0;
+        const char* reason = 0;
+        for (int i=0; i<npvs && !reason; i++) {
+            PyObject* pyobj = PyTuple_GET_ITEM(pvs, i);
+            if (!PyObject_TypeCheck(pyobj, &capv_type)) {
+                reason = "not a capv";
+                break;
+            }
+            for (int j=0; j<i && !reason; j++) {
+                if (PyTuple_GET_ITEM(pvs, j) == pyobj) {
+                    reason = "PV is given twice";
+                }
+            }
+            if (reason) {
+                break;
+            }
+            capv* pv = reinterpret_cast<capv*>(pyobj);
+            short type = pv->cid ? ca_field_type(pv->cid) : TYPENOTCONN;
+            long nelm = pv->eid ? pv->count : (pv->cid ? ca_element_count(pv->cid) : 0);
+            if (nelm == 0 || type == TYPENOTCONN) {
+                reason = "PV is not connected";
+                break;
+            }
+            pyca_rec_tap* rectap = pv->rectap;
+            if (rectap && rectap->recorder) {
+                reason = "PV is already recorded";
+                break;
+            }
+            short dbr_type = dbf_type_to_DBR(type);
+            if (dbr_type_is_ENUM(dbr_type) && pv->string_enum) {
+                dbr_type = DBR_STRING;
+            }
+            names[nnames++] = strdup(PyString_AsString(pv->name));
+            descs[i].dbr_type = dbr_type;
+            descs[i].namelen = strlen(names[i]);
+            descs[i].nelm = nelm;
+            descs[i].elsize = dbr_value_size[dbr_type];
+            descs[i].record_size = pyca_rec_pad(sizeof(pyca_rec_record) +
+                                                nelm * descs[i].elsize);
+        }
+        pyca_recorder* rec = 0;
+        if (!reason) {
+            rec = pyca_recorder_new(path, descs, names, npvs, chunk_size, flush_interval);
+            if (!rec) {
+                PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+            }
+        }
+        for (int i=0; i<nnames; i++) {
+            free(names[i]);
+        }
+        delete [] names;
+        delete [] descs;
+        if (!rec) {
+            Py_DECREF(pvs);
+            if (reason) {
+                pyca_raise_pyexc("recorder", reason);
+            }
+            return NULL;
+        }
+        recorder* self = reinterpret_cast<recorder*>(type->tp_alloc(type, 0));
+        if (!self) {
+            pyca_recorder_close(rec);
+            pyca_recorder_free(rec);
+            Py_DECREF(pvs);
+            return NULL;
+        }
+        self->rec = rec;
+        self->pvs = pvs;
+        self->closed = 0;
+        for (int i=0; i<npvs; i++) {
+            capv* pv = reinterpret_cast<capv*>(PyTuple_GET_ITEM(pvs, i));
+            if (!pv->rectap) {
+                pyca_rec_tap* tap = pyca_rec_tap_new();
+                // The CA thread reads pv->rectap without locking
+                pv->rectap.store(tap, std::memory_order_release);
+            }
+            pyca_rec_tap_set(pv->rectap, rec, i);
+        }
+        return reinterpret_cast<PyObject*>(self);
+    }
+
+    // Stop recording, write the pending updates and close the file
+    static PyObject* recorder_close(PyObject* self, PyObject*)
+    {
+        recorder* r = reinterpret_cast<recorder*>(self);
+        if (r->closed) {
+            Py_RETURN_NONE;
+        }
+        r->closed = 1;
+        for (Py_ssize_t i=0; i<PyTuple_GET_SIZE(r->pvs); i++) {
+            capv* pv = reinterpret_cast<capv*>(PyTuple_GET_ITEM(r->pvs, i));
+            pyca_rec_tap_set(pv->rectap, NULL, 0);
+        }
+        pyca_recorder* rec = r->rec;
+        Py_BEGIN_ALLOW_THREADS
+        pyca_recorder_close(rec);
+        Py_END_ALLOW_THREADS
+        if (rec->error) {
+            errno = rec->error;
+            return PyErr_SetFromErrno(PyExc_OSError);
+        }
+        Py_RETURN_NONE;
+    }
+
+    static void recorder_dealloc(PyObject* self)
+    {
+        recorder* r = reinterpret_cast<recorder*>(self);
+        PyObject* res = recorder_close(self, NULL);
+        if (!res) {
+            PyErr_WriteUnraisable(self);
+        }
+        Py_XDECREF(res);
+        pyca_recorder_free(r->rec);
+        Py_DECREF(r->pvs);
+        Py_TYPE(self)->tp_free(self);
+    }
+
+    // Return the numbers of updates 'recorded' and 'dropped' so far,
+    // and of 'chunks' and 'bytes' written to the file
+    static PyObject* recorder_stats(PyObject* self, PyObject*)
+    {
+        recorder* r = reinterpret_cast<recorder*>(self);
+        pyca_recorder* rec = r->rec;
+        pthread_mutex_lock(&rec->lock);
+        unsigned long records = rec->records;
+        unsigned long dropped = rec->dropped;
+        unsigned long chunks = rec->chunks;
+        unsigned long long bytes = rec->bytes;
+        pthread_mutex_unlock(&rec->lock);
+        PyObject* pydict = PyDict_New();
+        if (!pydict) {
+            return NULL;
+        }
+        _pyca_setitem(pydict, "recorded", PyLong_FromUnsignedLong(records));
+        _pyca_setitem(pydict, "dropped", PyLong_FromUnsignedLong(dropped));
+        _pyca_setitem(pydict, "chunks", PyLong_FromUnsignedLong(chunks));
+        _pyca_setitem(pydict, "bytes", PyLong_FromUnsignedLongLong(bytes));
+        return pydict;
+    }
+
+    static PyMethodDef recorder_methods[] = {
+        {"close", recorder_close, METH_NOARGS},
+        {"stats", recorder_stats, METH_NOARGS},
+        {NULL,  NULL},
+    };
+
+    static PyTypeObject recorder_type = {
+        PyVarObject_HEAD_INIT(0, 0)
+        "pyca.recorder",
+        sizeof(recorder),
+        0,
+        recorder_dealloc,                       /* tp_dealloc */
+        0,                                      /* tp_print */
+        0,                                      /* tp_getattr */
+        0,                                      /* tp_setattr */
+        0,                                      /* tp_compare */
+        0,                                      /* tp_repr */
+        0,                                      /* tp_as_number */
+        0,                                      /* tp_as_sequence */
+        0,                                      /* tp_as_mapping */
+        0,                                      /* tp_hash */
+        0,                                      /* tp_call */
+        0,                                      /* tp_str */
+        0,                                      /* tp_getattro */
+        0,                                      /* tp_setattro */
+        0,                                      /* tp_as_buffer */
+        Py_TPFLAGS_DEFAULT,                     /* tp_flags */
+        0,                                      /* tp_doc */
+        0,                                      /* tp_traverse */
+        0,                                      /* tp_clear */
+        0,                                      /* tp_richcompare */
+        0,                                      /* tp_weaklistoffset */
+        0,                                      /* tp_iter */
+        0,                                      /* tp_iternext */
+        recorder_methods,                       /* tp_methods */
+        0,                                      /* tp_members */
+        0,                                      /* tp_getset */
+        0,                                      /* tp_base */
+        0,                                      /* tp_dict */
+        0,                                      /* tp_descr_get */
+        0,                                      /* tp_descr_set */
+        0,                                      /* tp_dictoffset */
+        0,                                      /* tp_init */
+        0,                                      /* tp_alloc */
+        recorder_new,                           /* tp_new */
+    };
+
+    // Memory mapped file written by a recorder
+    struct recording {
+        PyObject_HEAD
+        pyca_rec_file* file;
+    };
+
+    static PyObject* recording_new(PyTypeObject* type, PyObject* args, PyObject* kwds)
+    {
+        const char* path;
+        static const char* kwlist[] = {"path", NULL};
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "s:recording", (char**)kwlist, &path)) {
+            return NULL;
+        }
+        pyca_rec_file* file = pyca_rec_file_open(path);
+        if (!file) {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+            return NULL;
+        }
+        recording* self = reinterpret_cast<recording*>(type->tp_alloc(type, 0));
+        if (!self) {
+            pyca_rec_file_close(file);
+            return NULL;
+        }
+        self->file = file;
+        return reinterpret_cast<PyObject*>(self);
+    }
+
+    static void recording_dealloc(PyObject* self)
+    {
+        recording* r = reinterpret_cast<recording*>(self);
+        if (r->file) {
+            pyca_rec_file_close(r->file);
+        }
+        Py_TYPE(self)->tp_free(self);
+    }
+
+    static PyObject* recording_get_names(PyObject* self, void*)
+    {
+        pyca_rec_file* file = reinterpret_cast<recording*>(self)->file;
+        PyObject* pynames = PyTuple_New(file->npvs);
+        for (int i=0; pynames && i<file->npvs; i++) {
+            PyObject* pyname = PyString_FromStringAndSize(file->names[i],
+                                                          file->pvs[i]->namelen);
+            if (!pyname) {
+                Py_CLEAR(pynames);
+                break;
+            }
+            PyTuple_SET_ITEM(pynames, i, pyname);
+        }
+        return pynames;
+    }
+
+    // Return the updates of a PV, given by name or index, as a
+    // dictionary of numpy arrays: 'value' (one row per update for
+    // waveforms), 'count', 'secs', 'nsec', 'status' and 'severity'.
+    // Only the chunk headers and the records of this PV are read.
+    static PyObject* recording_get(PyObject* self, PyObject* pykey)
+    {
+        pyca_rec_file* file = reinterpret_cast<recording*>(self)->file;
+        int index = -1;
+        if (PyString_Check(pykey)) {
+            const char* name = PyString_AsString(pykey);
+            size_t namelen = strlen(name);
+            for (int i=0; i<file->npvs && index<0; i++) {
+                if (file->pvs[i]->namelen == namelen &&
+                    memcmp(file->names[i], name, namelen) == 0) {
+                    index = i;
+                }
+            }
+        } else if (PyInt_Check(pykey)) {
+            index = PyInt_AsLong(pykey);
+        }
+        if (index < 0 || index >= file->npvs) {
+            PyErr_SetObject(PyExc_KeyError, pykey);
+            return NULL;
+        }
+        const pyca_rec_pvdesc* desc = file->pvs[index];
+        long total = 0;
+        for (size_t pos=file->first; ; ) {
+            const pyca_rec_chunkhdr* chunk = pyca_rec_file_chunk(file, pos);
+            if (!chunk) {
+                break;
+            }
+            total += pyca_rec_chunk_index(chunk)[index].count;
+            pos += chunk->size;
+        }
+        int typenum = _numpy_dbr_type(desc->dbr_type);
+        npy_intp dims[1] = {total};
+        PyObject* pyvalue = _pyca_history_array(typenum, total, desc->nelm, NULL, NULL);
+        PyObject* pycount = PyArray_EMPTY(1, dims, NPY_UINT32, 0);
+        PyObject* pysecs = PyArray_EMPTY(1, dims, NPY_UINT32, 0);
+        PyObject* pynsec = PyArray_EMPTY(1, dims, NPY_UINT32, 0);
+        PyObject* pystatus = PyArray_EMPTY(1, dims, NPY_INT16, 0);
+        PyObject* pyseverity = PyArray_EMPTY(1, dims, NPY_INT16, 0);
+        PyObject* pydict = PyDict_New();
+        if (!pyvalue || !pycount || !pysecs || !pynsec || !pystatus ||
+            !pyseverity || !pydict) {
+            Py_XDECREF(pyvalue);
+            Py_XDECREF(pycount);
+            Py_XDECREF(pysecs);
+            Py_XDECREF(pynsec);
+            Py_XDECREF(pystatus);
+            Py_XDECREF(pyseverity);
+            Py_XDECREF(pydict);
+            return NULL;
+        }
+        char* value = PyArray_BYTES(reinterpret_cast<PyArrayObject*>(pyvalue));
+        uint32_t* count = reinterpret_cast<uint32_t*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(pycount)));
+        uint32_t* secs = reinterpret_cast<uint32_t*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(pysecs)));
+        uint32_t* nsec = reinterpret_cast<uint32_t*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(pynsec)));
+        int16_t* status = reinterpret_cast<int16_t*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(pystatus)));
+        int16_t* severity = reinterpret_cast<int16_t*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(pyseverity)));
+        size_t nbytes = (size_t)desc->nelm * desc->elsize;
+        long n = 0;
+        for (size_t pos=file->first; n<total; ) {
+            const pyca_rec_chunkhdr* chunk = pyca_rec_file_chunk(file, pos);
+            if (!chunk) {
+                break;
+            }
+            const pyca_rec_index* idx = &pyca_rec_chunk_index(chunk)[index];
+            const char* src = reinterpret_cast<const char*>(chunk) + idx->offset;
+            for (uint32_t i=0; i<idx->count && n<total; i++, n++) {
+                const pyca_rec_record* record = reinterpret_cast<const pyca_rec_record*>(src);
+                count[n] = record->count;
+                secs[n] = record->secs;
+                nsec[n] = record->nsec;
+                status[n] = record->status;
+                severity[n] = record->severity;
+                memcpy(value + n * nbytes, src + sizeof(pyca_rec_record), nbytes);
+                src += desc->record_size;
+            }
+            pos += chunk->size;
+        }
+        _pyca_setitem(pydict, "value", pyvalue);
+        _pyca_setitem(pydict, "count", pycount);
+        _pyca_setitem(pydict, "secs", pysecs);
+        _pyca_setitem(pydict, "nsec", pynsec);
+        _pyca_setitem(pydict, "status", pystatus);
+        _pyca_setitem(pydict, "severity", pyseverity);
+        return pydict;
+    }
+
+    static PyMethodDef recording_methods[] = {
+        {"get", recording_get, METH_O},
+        {NULL,  NULL},
+    };
+
+    static PyGetSetDef recording_getset[] = {
+        {(char*)"names", recording_get_names, NULL, (char*)"names", NULL},
+        {NULL},
+    };
+
+    static PyTypeObject recording_type = {
+        PyVarObject_HEAD_INIT(0, 0)
+        "pyca.recording",
+        sizeof(recording),
+        0,
+        recording_dealloc,                      /* tp_dealloc */
+        0,                                      /* tp_print */
+        0,                                      /* tp_getattr */
+        0,                                      /* tp_setattr */
+        0,                                      /* tp_compare */
+        0,                                      /* tp_repr */
+        0,                                      /* tp_as_number */
+        0,                                      /* tp_as_sequence */
+        0,                                      /* tp_as_mapping */
+        0,                                      /* tp_hash */
+        0,                                      /* tp_call */
+        0,                                      /* tp_str */
+        0,                                      /* tp_getattro */
+        0,                                      /* tp_setattro */
+        0,                                      /* tp_as_buffer */
+        Py_TPFLAGS_DEFAULT,                     /* tp_flags */
+        0,                                      /* tp_doc */
+        0,                                      /* tp_traverse */
+        0,                                      /* tp_clear */
+        0,                                      /* tp_richcompare */
+        0,                                      /* tp_weaklistoffset */
+        0,                                      /* tp_iter */
+        0,                                      /* tp_iternext */
+        recording_methods,                      /* tp_methods */
+        0,                                      /* tp_members */
+        recording_getset,                       /* tp_getset */
+        0,                                      /* tp_base */
+        0,                                      /* tp_dict */
+        0,                                      /* tp_descr_get */
+        0,                                      /* tp_descr_set */
+        0,                                      /* tp_dictoffset */
+        0,                                      /* tp_init */
+        0,                                      /* tp_alloc */
+        recording_new,                          /* tp_new */
+    };
+
+    // Replay of a recording into simulated capv
+    struct replayer {
+        PyObject_HEAD
+        pyca_replay* replay;
+        PyObject* recording;
+        PyObject* pvs;      // tuple of the replayed capv
+        int joined;
+    };
+
+    static PyObject* replayer_new(PyTypeObject* type, PyObject* args, PyObject* kwds)
+    {
+        PyObject* pyrec;
+        PyObject* pyseq;
+        double rate = 1.0;
+        PyObject* pyloop = Py_False;
+        static const char* kwlist[] = {"recording", "pvs", "rate", "loop", NULL};
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!O|dO:replayer", (char**)kwlist,
+                                         &recording_type, &pyrec, &pyseq, &rate, &pyloop)) {
+            return NULL;
+        }
+        if (rate < 0) {
+            pyca_raise_pyexc("replayer", "error parsing arguments");
+        }
+        pyca_rec_file* file = reinterpret_cast<recording*>(pyrec)->file;
+        PyObject* pvs = PySequence_Tuple(pyseq);
+        if (!pvs) {
+            return NULL;
+        }
+        int npvs = PyTuple_GET_SIZE(pvs);
+        int* index = new int[npvs > 0 ? npvs : 1];
+        const char* reason = 0;
+        for (int i=0; i<npvs && !reason; i++) {
+            PyObject* pyobj = PyTuple_GET_ITEM(pvs, i);
+            if (!PyObject_TypeCheck(pyobj, &capv_type)) {
+                reason = "not a capv";
+                break;
+            }
+            capv* pv = reinterpret_cast<capv*>(pyobj);
+            if (pv->simulated == Py_None) {
+                reason = "PV is not simulated";
+                break;
+            }
+            const char* name = PyString_AsString(pv->name);
+            size_t namelen = strlen(name);
+            index[i] = -1;
+            for (int j=0; j<file->npvs && index[i]<0; j++) {
+                if (file->pvs[j]->namelen == namelen &&
+                    memcmp(file->names[j], name, namelen) == 0) {
+                    index[i] = j;
+                }
+            }
+            if (index[i] < 0) {
+                reason = "PV is not in the recording";
+            }
+        }
+        if (reason) {
+            delete [] index;
+            Py_DECREF(pvs);
+            pyca_raise_pyexc("replayer", reason);
+        }
+        replayer* self = reinterpret_cast<replayer*>(type->tp_alloc(type, 0));
+        if (!self) {
+            delete [] index;
+            Py_DECREF(pvs);
+            return NULL;
+        }
+        pyca_replay* replay = new pyca_replay;
+        pthread_mutex_init(&replay->lock, NULL);
+        pthread_cond_init(&replay->cond, NULL);
+        replay->file = file;
+        replay->npvs = npvs;
+        replay->index = index;
+        replay->pvs = new capv*[npvs > 0 ? npvs : 1];
+        for (int i=0; i<npvs; i++) {
+            replay->pvs[i] = reinterpret_cast<capv*>(PyTuple_GET_ITEM(pvs, i));
+        }
+        replay->rate = rate;
+        replay->loop = PyObject_IsTrue(pyloop);
+        replay->stop = 0;
+        replay->done = 0;
+        replay->replayed = 0;
+        replay->skipped = 0;
+        Py_INCREF(pyrec);
+        self->recording = pyrec;
+        self->pvs = pvs;
+        self->replay = replay;
+        self->joined = 0;
+        int err = pthread_create(&replay->thread, NULL, pyca_replay_run, replay);
+        if (err) {
+            self->joined = 1;
+            replay->done = 1;
+            Py_DECREF(self);
+            errno = err;
+            return PyErr_SetFromErrno(PyExc_OSError);
+        }
+        return reinterpret_cast<PyObject*>(self);
+    }
+
+    // Wait for the end of the replay, the GIL is released since the
+    // replay thread takes it to deliver the updates
+    static void _pyca_replayer_join(replayer* self)
+    {
+        if (!self->joined) {
+            self->joined = 1;
+            Py_BEGIN_ALLOW_THREADS
+            pthread_join(self->replay->thread, NULL);
+            Py_END_ALLOW_THREADS
+        }
+    }
+
+    // Stop the replay and wait for the thread to finish
+    static PyObject* replayer_stop(PyObject* self, PyObject*)
+    {
+        replayer* r = reinterpret_cast<replayer*>(self);
+        r->replay->stop = 1;
+        _pyca_replayer_join(r);
+        Py_RETURN_NONE;
+    }
+
+    // Wait until the whole recording was replayed, at most timeout
+    // seconds if given. Returns whether the replay is over.
+    static PyObject* replayer_wait(PyObject* self, PyObject* args)
+    {
+        replayer* r = reinterpret_cast<replayer*>(self);
+        PyObject* pytmo = Py_None;
+        if (!PyArg_ParseTuple(args, "|O:wait", &pytmo)) {
+            return NULL;
         }
-        if (pv->getbuffer) {
-            delete [] pv->getbuffer;
-            pv->getbuffer = 0;
-            pv->getbufsiz = 0;
+        double timeout = -1;
+        if (pytmo != Py_None) {
+            timeout = PyFloat_AsDouble(pytmo);
+            if (PyErr_Occurred()) {
+                return NULL;
+            }
         }
-        if (pv->putbuffer) {
-            delete [] pv->putbuffer;
-            pv->putbuffer = 0;
-            pv->putbufsiz = 0;
+        pyca_replay* replay = r->replay;
+        int done;
+        Py_BEGIN_ALLOW_THREADS
+        pthread_mutex_lock(&replay->lock);
+        if (timeout < 0) {
+            while (!replay->done) {
+                pthread_cond_wait(&replay->cond, &replay->lock);
+            }
+        } else {
+            struct timespec deadline;
+            pyca_deadline(timeout, &deadline);
+            while (!replay->done &&
+                   pthread_cond_timedwait(&replay->cond, &replay->lock, &deadline) != ETIMEDOUT) {
+            }
         }
-        self->ob_type->tp_free(self);
+        done = replay->done;
+        pthread_mutex_unlock(&replay->lock);
+        Py_END_ALLOW_THREADS
+        if (done) {
+            _pyca_replayer_join(r);
+        }
+        return PyBool_FromLong(done);
     }
 
-    static PyObject* capv_new(PyTypeObject* type, PyObject* args, PyObject* kwds)
+    // Return the numbers of records 'replayed' and 'skipped' (the capv
+    // was not subscribed) so far
+    static PyObject* replayer_stats(PyObject* self, PyObject*)
     {
-        PyObject* self = type->tp_alloc(type, 0);
-        capv* pv = reinterpret_cast<capv*>(self);
-        if (!pv) {
-            pyca_raise_pyexc("capv_new", "cannot allocate new PV");
-        }
-        pv->data = PyDict_New();
-        if (!pv->data) {
-            pyca_raise_pyexc("capv_new", "cannot allocate dictionary for new PV");
+        replayer* r = reinterpret_cast<replayer*>(self);
+        PyObject* pydict = PyDict_New();
+        if (!pydict) {
+            return NULL;
         }
-        Py_INCREF(pv);
-        return self;
+        _pyca_setitem(pydict, "replayed", PyLong_FromUnsignedLong(r->replay->replayed.load()));
+        _pyca_setitem(pydict, "skipped", PyLong_FromUnsignedLong(r->replay->skipped.load()));
+        return pydict;
     }
 
-    // Register capv methods
-    static PyMethodDef capv_methods[] = {
-        {"create_channel", create_channel, METH_NOARGS},
-        {"clear_channel", clear_channel, METH_NOARGS},
-        {"subscribe_channel", subscribe_channel, METH_VARARGS},
-        {"unsubscribe_channel", unsubscribe_channel, METH_NOARGS},
-        {"get_data", get_data, METH_VARARGS},
-        {"put_data", put_data, METH_VARARGS},
-        {"host", host, METH_NOARGS},
-        {"state", state, METH_NOARGS},
-        {"count", count, METH_NOARGS},
-        {"type", type, METH_NOARGS},
-        {"rwaccess", rwaccess, METH_NOARGS},
-        {"replace_access_rights_event", replace_access_rights_event, METH_NOARGS},
-        {"set_string_enum", set_string_enum, METH_O},
-        {"is_string_enum", is_string_enum, METH_NOARGS},
-        {"get_enum_strings", get_enum_strings, METH_O},
-        {NULL,  NULL},
-    };
+    static void replayer_dealloc(PyObject* self)
+    {
+        replayer* r = reinterpret_cast<replayer*>(self);
+        pyca_replay* replay = r->replay;
+        replay->stop = 1;
+        _pyca_replayer_join(r);
+        delete [] replay->index;
+        delete [] replay->pvs;
+        pthread_cond_destroy(&replay->cond);
+        pthread_mutex_destroy(&replay->lock);
+        delete replay;
+        Py_DECREF(r->pvs);
+        Py_DECREF(r->recording);
+        Py_TYPE(self)->tp_free(self);
+    }
 
-    // Register capv members
-    static PyMemberDef capv_members[] = {
-        {"name", T_OBJECT_EX, offsetof(capv, name), 0, "name"},
-        {"data", T_OBJECT_EX, offsetof(capv, data), 0, "data"},
-        {"processor", T_OBJECT_EX, offsetof(capv, processor), 0, "processor"},
-        {"connect_cb", T_OBJECT_EX, offsetof(capv, connect_cb), 0, "connect_cb"},
-        {"monitor_cb", T_OBJECT_EX, offsetof(capv, monitor_cb), 0, "monitor_cb"},
-        {"rwaccess_cb", T_OBJECT_EX, offsetof(capv, rwaccess_cb), 0, "rwaccess_cb"},
-        {"getevt_cb", T_OBJECT_EX, offsetof(capv, getevt_cb), 0, "getevt_cb"},
-        {"putevt_cb", T_OBJECT_EX, offsetof(capv, putevt_cb), 0, "putevt_cb"},
-        {"simulated", T_OBJECT_EX, offsetof(capv, simulated), 0, "simulated"},
-        {"use_numpy", T_OBJECT_EX, offsetof(capv, use_numpy), 0, "use_numpy"},
-        {NULL}
+    static PyMethodDef replayer_methods[] = {
+        {"stop", replayer_stop, METH_NOARGS},
+        {"wait", replayer_wait, METH_VARARGS},
+        {"stats", replayer_stats, METH_NOARGS},
+        {NULL,  NULL},
     };
 
-    static PyTypeObject capv_type = {
-        PyObject_HEAD_INIT(0)
-#ifndef IS_PY3K
-        0,
-#endif
-        "pyca.capv",
-        sizeof(capv),
+    static PyTypeObject replayer_type = {
+        PyVarObject_HEAD_INIT(0, 0)
+        "pyca.replayer",
+        sizeof(replayer),
         0,
-        capv_dealloc,                           /* tp_dealloc */
+        replayer_dealloc,                       /* tp_dealloc */
         0,                                      /* tp_print */
         0,                                      /* tp_getattr */
         0,                                      /* tp_setattr */
@@ -543,7 +2820,7 @@ extern "C" {
         0,                                      /* tp_getattro */
         0,                                      /* tp_setattro */
         0,                                      /* tp_as_buffer */
-        Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /* tp_flags */
+        Py_TPFLAGS_DEFAULT,                     /* tp_flags */
         0,                                      /* tp_doc */
         0,                                      /* tp_traverse */
         0,                                      /* tp_clear */
@@ -551,17 +2828,17 @@ extern "C" {
         0,                                      /* tp_weaklistoffset */
         0,                                      /* tp_iter */
         0,                                      /* tp_iternext */
-        capv_methods,                           /* tp_methods */
-        capv_members,                           /* tp_members */
+        replayer_methods,                       /* tp_methods */
+        0,                                      /* tp_members */
         0,                                      /* tp_getset */
         0,                                      /* tp_base */
         0,                                      /* tp_dict */
         0,                                      /* tp_descr_get */
         0,                                      /* tp_descr_set */
         0,                                      /* tp_dictoffset */
-        capv_init,                              /* tp_init */
+        0,                                      /* tp_init */
         0,                                      /* tp_alloc */
-        capv_new,                               /* tp_new */
+        replayer_new,                           /* tp_new */
     };
 
     // Module functions
@@ -664,6 +2941,772 @@ extern "C" {
         Py_RETURN_NONE;
     }
 
+    static PyObject* set_sync_callback(PyObject*, PyObject* cb) {
+        if (!PyBool_Check(cb)) {
+            pyca_raise_pyexc("set_sync_callback", "error parsing arguments");
+        }
+        sync_callbacks = PyObject_IsTrue(cb);
+        Py_RETURN_NONE;
+    }
+
+    // Check that pypvs is a sequence of capv, returns a new reference
+    static PyObject* _pyca_pv_sequence(PyObject* pypvs, const char* function)
+    {
+        PyObject* pyseq = PySequence_Fast(pypvs, "expected a sequence of PVs");
+        if (!pyseq) {
+            return NULL;
+        }
+        Py_ssize_t npvs = PySequence_Fast_GET_SIZE(pyseq);
+        for (Py_ssize_t i=0; i<npvs; i++) {
+            if (!PyObject_TypeCheck(PySequence_Fast_GET_ITEM(pyseq, i), &capv_type)) {
+                Py_DECREF(pyseq);
+                pyca_raise_pyexc(function, "sequence item is not a PV");
+            }
+        }
+        return pyseq;
+    }
+
+    // Create the channels for many PVs and flush once. Returns a list
+    // with None for each PV whose channel was created (or already
+    // existed) or the error message otherwise.
+    static PyObject* create_channels(PyObject*, PyObject* pypvs) {
+        PyObject* pyseq = _pyca_pv_sequence(pypvs, "create_channels");
+        if (!pyseq) {
+            return NULL;
+        }
+        Py_ssize_t npvs = PySequence_Fast_GET_SIZE(pyseq);
+        PyObject* pyres = PyList_New(npvs);
+        if (!pyres) {
+            Py_DECREF(pyseq);
+            return NULL;
+        }
+        const int capriority = 10;
+        for (Py_ssize_t i=0; i<npvs; i++) {
+            PyObject* self = PySequence_Fast_GET_ITEM(pyseq, i);
+            capv* pv = reinterpret_cast<capv*>(self);
+            PyObject* pyexc = NULL;
+            if (!pv->cid) {
+                int result = ca_create_channel(PyString_AsString(pv->name),
+                                               pyca_connection_handler,
+                                               self,
+                                               capriority,
+                                               &pv->cid);
+                if (result != ECA_NORMAL) {
+                    pv->cid = 0;
+                    pyexc = pyca_data_status_msg(result, pv);
+                }
+            }
+            if (!pyexc) {
+                Py_INCREF(Py_None);
+                pyexc = Py_None;
+            }
+            PyList_SET_ITEM(pyres, i, pyexc);
+        }
+        ca_flush_io();
+        Py_DECREF(pyseq);
+        return pyres;
+    }
+
+    // Wait with the GIL released until every PV is connected or the
+    // timeout expires, using the connection table maintained by the CA
+    // thread. Returns the list of names of the PVs still unconnected.
+    static PyObject* wait_connected(PyObject*, PyObject* args) {
+        PyObject* pypvs;
+        PyObject* pytmo;
+        if (!PyArg_ParseTuple(args, "OO:wait_connected", &pypvs, &pytmo) ||
+            !PyFloat_Check(pytmo)) {
+            pyca_raise_pyexc("wait_connected", "error parsing arguments");
+        }
+        PyObject* pyseq = _pyca_pv_sequence(pypvs, "wait_connected");
+        if (!pyseq) {
+            return NULL;
+        }
+        Py_ssize_t npvs = PySequence_Fast_GET_SIZE(pyseq);
+        capv** pvs = reinterpret_cast<capv**>(PySequence_Fast_ITEMS(pyseq));
+        double timeout = PyFloat_AsDouble(pytmo);
+        Py_BEGIN_ALLOW_THREADS
+        struct timespec deadline;
+        pyca_deadline(timeout, &deadline);
+        // Connections mostly come in, so resume the scan where it stopped
+        // and only go over the whole list again once it looks complete
+        Py_ssize_t first = 0;
+        pthread_mutex_lock(&pyca_conn_lock);
+        for (;;) {
+            while (first < npvs && pvs[first]->connected) {
+                first++;
+            }
+            if (first == npvs) {
+                first = 0;
+                while (first < npvs && pvs[first]->connected) {
+                    first++;
+                }
+                if (first == npvs) {
+                    break;
+                }
+            }
+            if (timeout <= 0 ||
+                pthread_cond_timedwait(&pyca_conn_cond, &pyca_conn_lock, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        pthread_mutex_unlock(&pyca_conn_lock);
+        Py_END_ALLOW_THREADS
+        PyObject* pyres = PyList_New(0);
+        pthread_mutex_lock(&pyca_conn_lock);
+        for (Py_ssize_t i=0; pyres && i<npvs; i++) {
+            if (!pvs[i]->connected && PyList_Append(pyres, pvs[i]->name) < 0) {
+                Py_CLEAR(pyres);
+            }
+        }
+        pthread_mutex_unlock(&pyca_conn_lock);
+        Py_DECREF(pyseq);
+        return pyres;
+    }
+
+    // Configure the event queue used by queued subscriptions. The
+    // overflow policy can be changed at any time, the capacity only
+    // while no queued subscription exists (pending events are dropped).
+    static PyObject* set_event_queue(PyObject*, PyObject* args) {
+        long capacity;
+        int policy = PYCA_DROP_NEWEST;
+        if (!PyArg_ParseTuple(args, "l|i:set_event_queue", &capacity, &policy) ||
+            capacity <= 0 ||
+            (policy != PYCA_DROP_NEWEST && policy != PYCA_DROP_OLDEST)) {
+            pyca_raise_pyexc("set_event_queue", "error parsing arguments");
+        }
+        if (pyca_events &&
+            pyca_evqueue_slots(capacity) == pyca_evqueue_capacity(pyca_events)) {
+            pyca_events->policy.store(policy);
+            Py_RETURN_NONE;
+        }
+        if (pyca_queued_subscriptions || (pyca_events && pyca_events->waiters.load())) {
+            pyca_raise_pyexc("set_event_queue", "can't resize event queue while in use");
+        }
+        if (pyca_events) {
+            pyca_evqueue_free(pyca_events);
+        }
+        pyca_events = pyca_evqueue_new(capacity, policy);
+        Py_RETURN_NONE;
+    }
+
+    // Decode one drained event into pv->data and append the
+    // (pv, data, exception) tuple to pyres
+    static int _pyca_poll_event(PyObject* pyres, capv* pv, const void* buffer,
+                                short dbr_type, long count, int status)
+    {
+        PyObject* pyexc = NULL;
+        if (status == ECA_NORMAL) {
+            if (!_pyca_event_process(pv, buffer, dbr_type, count)) {
+                PyErr_Clear();
+                pyexc = pyca_data_status_msg(ECA_BADTYPE, pv);
+            }
+        } else {
+            pyexc = pyca_data_status_msg(status, pv);
+        }
+        if (!pyexc) {
+            Py_INCREF(Py_None);
+            pyexc = Py_None;
+        }
+        _pyca_record_sync(pv);
+        PyObject* pydata = PyDict_Copy(pv->data);
+        if (!pydata) {
+            Py_DECREF(pyexc);
+            return -1;
+        }
+        PyObject* pyev = Py_BuildValue("(ONN)", pv, pydata, pyexc);
+        if (!pyev) {
+            return -1;
+        }
+        int result = PyList_Append(pyres, pyev);
+        Py_DECREF(pyev);
+        return result;
+    }
+
+    // Drain up to max_events queued monitor events, decoding them all
+    // under a single GIL acquisition. Each PV's data is updated as it
+    // would be before its monitor_cb is called, and a snapshot of it is
+    // returned with the event. Conflated PVs come first, with their
+    // latest event only. If there is no event, wait up to timeout
+    // seconds with the GIL released for the first one.
+    static PyObject* poll_events(PyObject*, PyObject* args) {
+        long max_events;
+        double timeout = 0;
+        if (!PyArg_ParseTuple(args, "l|d:poll_events", &max_events, &timeout) ||
+            max_events <= 0) {
+            pyca_raise_pyexc("poll_events", "error parsing arguments");
+        }
+        PyObject* pyres = PyList_New(0);
+        if (!pyres || !pyca_events) {
+            return pyres;
+        }
+        pyca_evqueue* q = pyca_events;
+        while (PyList_GET_SIZE(pyres) < max_events) {
+            capv* pv = pyca_evqueue_next_dirty(q);
+            if (pv) {
+                pyca_latest* latest = pv->latest;
+                short dbr_type;
+                long count;
+                int status;
+                if (pyca_latest_take(latest, &dbr_type, &count, &status) &&
+                    _pyca_poll_event(pyres, pv, latest->spare, dbr_type, count, status) < 0) {
+                    Py_DECREF(pyres);
+                    return NULL;
+                }
+                continue;
+            }
+            pyca_event* ev = pyca_evqueue_claim_pop(q);
+            if (!ev) {
+                if (PyList_GET_SIZE(pyres) || timeout <= 0) {
+                    break;
+                }
+                bool ready;
+                Py_BEGIN_ALLOW_THREADS
+                    ready = pyca_evqueue_wait(q, timeout);
+                Py_END_ALLOW_THREADS
+                if (!ready) {
+                    break;
+                }
+                continue;
+            }
+            capv* evpv = ev->pv.load();
+            if (!evpv) {
+                // Its PV was unsubscribed
+                pyca_evqueue_release(q, ev);
+                continue;
+            }
+            int result = _pyca_poll_event(pyres, evpv, ev->buffer,
+                                          ev->dbr_type, ev->count, ev->status);
+            pyca_evqueue_release(q, ev);
+            if (result < 0) {
+                Py_DECREF(pyres);
+                return NULL;
+            }
+        }
+        return pyres;
+    }
+
+    // Counters of the event queue
+    static PyObject* event_queue_stats(PyObject*, PyObject*) {
+        pyca_evqueue* q = pyca_events;
+        if (!q) {
+            return Py_BuildValue("{s:k,s:k,s:k,s:k,s:k,s:i}",
+                                 "capacity", 0ul, "pending", 0ul,
+                                 "queued", 0ul, "dropped", 0ul, "conflated", 0ul,
+                                 "policy", (int)PYCA_DROP_NEWEST);
+        }
+        return Py_BuildValue("{s:k,s:k,s:k,s:k,s:k,s:i}",
+                             "capacity", (unsigned long)pyca_evqueue_capacity(q),
+                             "pending", (unsigned long)pyca_evqueue_size(q),
+                             "queued", q->queued.load(),
+                             "dropped", q->dropped.load(),
+                             "conflated", q->conflated.load(),
+                             "policy", q->policy.load());
+    }
+
+    // File descriptor readable when callbacks are pending. Switches the
+    // callbacks to deferred dispatch, see deferred.hh, or back to
+    // dispatch from the CA thread if 'deferred' is False.
+    static PyObject* event_fd(PyObject*, PyObject* args) {
+        PyObject* pydeferred = Py_True;
+        if (!PyArg_ParseTuple(args, "|O:event_fd", &pydeferred)) {
+            return NULL;
+        }
+        if (!pyca_deferred_fd) {
+            pyca_deferred_fd = pyca_notifier_new();
+            if (!pyca_deferred_fd) {
+                return PyErr_SetFromErrno(PyExc_OSError);
+            }
+        }
+        pyca_deferred_notifier.store(PyObject_IsTrue(pydeferred) ? pyca_deferred_fd : NULL,
+                                     std::memory_order_release);
+        return PyInt_FromLong(pyca_deferred_fd->rfd);
+    }
+
+    // Run the pending callbacks on the calling thread, in the order
+    // their events arrived. Returns how many were run.
+    static PyObject* dispatch_pending(PyObject*, PyObject*) {
+        // Events deferred before switching back are still pending
+        pyca_notifier* notifier = pyca_deferred_fd;
+        long dispatched = 0;
+        if (notifier) {
+            pyca_deferred_append(&pyca_deferred_taken, pyca_notifier_take(notifier));
+            pyca_deferred* deferred;
+            while ((deferred = pyca_deferred_pop(&pyca_deferred_taken))) {
+                // Unless its PV was cleared meanwhile
+                if (deferred->pv) {
+                    _pyca_deferred_dispatch(deferred);
+                    dispatched++;
+                }
+                pyca_deferred_release(deferred);
+            }
+        }
+        return PyInt_FromLong(dispatched);
+    }
+
+    // Hand the deferred callbacks to a native dispatcher thread, see
+    // deferred.hh, or change its batching if it is running
+    static PyObject* dispatcher_start(PyObject*, PyObject* args, PyObject* kwds) {
+        long batch = 256;
+        double max_latency = 0.001;
+        static const char* kwlist[] = {"batch", "max_latency", NULL};
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|ld:dispatcher_start", (char**)kwlist,
+                                         &batch, &max_latency)) {
+            return NULL;
+        }
+        if (batch < 1) {
+            pyca_raise_pyexc("dispatcher_start", "batch must be at least 1");
+        }
+        if (max_latency < 0) {
+            pyca_raise_pyexc("dispatcher_start", "max_latency must not be negative");
+        }
+        if (!pyca_dispatcher_thread) {
+            pyca_dispatcher_thread = pyca_dispatcher_new();
+        }
+        pyca_dispatcher* dispatcher = pyca_dispatcher_thread;
+        pthread_mutex_lock(&dispatcher->lock);
+        dispatcher->batch = batch;
+        dispatcher->max_latency = max_latency;
+        bool start = dispatcher->stop;
+        dispatcher->stop = 0;
+        if (start) {
+            dispatcher->context = has_proc_context() ? get_proc_context() :
+                                                       ca_current_context();
+        }
+        pthread_mutex_unlock(&dispatcher->lock);
+        if (!start) {
+            // Running, a waiting batch may be complete now
+            pthread_cond_signal(&dispatcher->cond);
+            Py_RETURN_NONE;
+        }
+        int err = pthread_create(&dispatcher->thread, NULL, pyca_dispatcher_run, dispatcher);
+        if (err) {
+            pthread_mutex_lock(&dispatcher->lock);
+            dispatcher->stop = 1;
+            pthread_mutex_unlock(&dispatcher->lock);
+            errno = err;
+            return PyErr_SetFromErrno(PyExc_OSError);
+        }
+        pyca_deferred_dispatcher.store(dispatcher, std::memory_order_release);
+        Py_RETURN_NONE;
+    }
+
+    // Stop the dispatcher thread once it has run the callbacks of the
+    // events it took. Further events go back to pyca.event_fd() or to
+    // the CA thread.
+    static PyObject* dispatcher_stop(PyObject*, PyObject*) {
+        pyca_dispatcher* dispatcher = pyca_deferred_dispatcher.load();
+        if (!dispatcher) {
+            Py_RETURN_NONE;
+        }
+        if (pthread_equal(pthread_self(), dispatcher->thread)) {
+            pyca_raise_pyexc("dispatcher_stop", "can't stop the dispatcher from its callbacks");
+        }
+        // Only one caller joins the thread
+        if (!pyca_deferred_dispatcher.exchange(NULL)) {
+            Py_RETURN_NONE;
+        }
+        pthread_mutex_lock(&dispatcher->lock);
+        dispatcher->stop = 1;
+        pthread_mutex_unlock(&dispatcher->lock);
+        pthread_cond_signal(&dispatcher->cond);
+        Py_BEGIN_ALLOW_THREADS
+        pthread_join(dispatcher->thread, NULL);
+        Py_END_ALLOW_THREADS
+        Py_RETURN_NONE;
+    }
+
+    static PyObject* dispatcher_stats(PyObject*, PyObject*) {
+        pyca_dispatcher* dispatcher = pyca_dispatcher_thread;
+        if (!dispatcher) {
+            return Py_BuildValue("{s:O,s:k,s:d,s:k,s:k,s:k}",
+                                 "running", Py_False, "batch", 0ul, "max_latency", 0.0,
+                                 "pending", 0ul, "batches", 0ul, "dispatched", 0ul);
+        }
+        pthread_mutex_lock(&dispatcher->lock);
+        PyObject* pyrunning = dispatcher->stop ? Py_False : Py_True;
+        unsigned long batch = dispatcher->batch;
+        double max_latency = dispatcher->max_latency;
+        unsigned long pending = dispatcher->pending;
+        pthread_mutex_unlock(&dispatcher->lock);
+        return Py_BuildValue("{s:O,s:k,s:d,s:k,s:k,s:k}",
+                             "running", pyrunning, "batch", batch,
+                             "max_latency", max_latency, "pending", pending,
+                             "batches", dispatcher->batches.load(),
+                             "dispatched", dispatcher->dispatched.load());
+    }
+
+    // Counters of the event path of all the PVs, reset to 0 if reset is
+    // True; the counters of each PV are not reset
+    static PyObject* stats(PyObject*, PyObject* args, PyObject* kwds) {
+        PyObject* pyreset = Py_False;
+        static const char* kwlist[] = {"reset", NULL};
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:stats", (char**)kwlist, &pyreset)) {
+            pyca_raise_pyexc("stats", "error parsing arguments");
+        }
+        return pyca_stats_dict(&pyca_global_stats, PyObject_IsTrue(pyreset));
+    }
+
+    // Start recording trace events into a ring of capacity records,
+    // dropping the events of a previous trace. The ring is allocated by
+    // the first call and keeps its capacity.
+    static PyObject* trace_start(PyObject*, PyObject* args, PyObject* kwds) {
+        long capacity = 65536;
+        static const char* kwlist[] = {"capacity", NULL};
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|l:trace_start", (char**)kwlist, &capacity) ||
+            capacity <= 0) {
+            pyca_raise_pyexc("trace_start", "error parsing arguments");
+        }
+        pyca_trace* trace = pyca_tracer.load(std::memory_order_acquire);
+        if (!trace) {
+            trace = pyca_trace_new(capacity);
+            if (!trace) {
+                return PyErr_NoMemory();
+            }
+            pyca_tracer.store(trace, std::memory_order_release);
+        } else if ((uint64_t)capacity != trace->capacity) {
+            pyca_raise_pyexc("trace_start", "the trace ring has another capacity");
+        }
+        trace->start.store(trace->head.load());
+        trace->active.store(1);
+        Py_RETURN_NONE;
+    }
+
+    // Stop recording trace events, they are kept until the next start
+    static PyObject* trace_stop(PyObject*, PyObject*) {
+        pyca_trace* trace = pyca_tracer.load(std::memory_order_acquire);
+        if (trace) {
+            trace->active.store(0);
+        }
+        Py_RETURN_NONE;
+    }
+
+    // Write the events of the trace ring to path in the Chrome trace
+    // event format. Returns the number of events written.
+    static PyObject* dump_trace(PyObject*, PyObject* args) {
+        const char* path;
+        if (!PyArg_ParseTuple(args, "s:dump_trace", &path)) {
+            return NULL;
+        }
+        pyca_trace* trace = pyca_tracer.load(std::memory_order_acquire);
+        uint64_t n = 0;
+        pyca_trace_rec* recs = 0;
+        if (trace) {
+            recs = new (std::nothrow) pyca_trace_rec[trace->capacity];
+            if (!recs) {
+                return PyErr_NoMemory();
+            }
+            n = pyca_trace_snapshot(trace, recs);
+        }
+        int err = 0;
+        Py_BEGIN_ALLOW_THREADS
+        FILE* file = fopen(path, "w");
+        if (!file || pyca_trace_write_json(file, recs, n) < 0) {
+            err = errno ? errno : EIO;
+        }
+        if (file && fclose(file) != 0 && !err) {
+            err = errno;
+        }
+        Py_END_ALLOW_THREADS
+        delete [] recs;
+        if (err) {
+            errno = err;
+            return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        }
+        return PyLong_FromUnsignedLongLong(n);
+    }
+
+    static double _pyca_bench_now()
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec + now.tv_nsec * 1e-9;
+    }
+
+    // Benchmark hook: process iterations times an event of dbr_type with
+    // count zeroed elements for pv, as its monitor handler would with the
+    // GIL. Returns the elapsed seconds. Used by test/bench_pyca.py.
+    static PyObject* _bench_event(PyObject*, PyObject* args) {
+        PyObject* pyobj;
+        int dbr_type;
+        long count;
+        long iterations;
+        if (!PyArg_ParseTuple(args, "O!ill:_bench_event", &capv_type, &pyobj,
+                              &dbr_type, &count, &iterations) ||
+            dbr_type < DBR_STRING || dbr_type > DBR_CTRL_DOUBLE ||
+            count <= 0 || iterations <= 0) {
+            pyca_raise_pyexc("_bench_event", "error parsing arguments");
+        }
+        capv* pv = reinterpret_cast<capv*>(pyobj);
+        unsigned size = dbr_size_n(dbr_type, count);
+        char* buffer = new char[size];
+        memset(buffer, 0, size);
+        double start = _pyca_bench_now();
+        for (long i=0; i<iterations; i++) {
+            if (!_pyca_event_process(pv, buffer, dbr_type, count)) {
+                delete [] buffer;
+                pyca_raise_pyexc_pv("_bench_event", "DBR type not handled", pv);
+            }
+        }
+        double elapsed = _pyca_bench_now() - start;
+        delete [] buffer;
+        return PyFloat_FromDouble(elapsed);
+    }
+
+    // Benchmark hook: convert value iterations times into the buffer of
+    // a put of count elements of dbr_type for pv, without sending it.
+    // Returns the elapsed seconds.
+    static PyObject* _bench_put(PyObject*, PyObject* args) {
+        PyObject* pyobj;
+        PyObject* pyvalue;
+        int dbr_type;
+        int count;
+        long iterations;
+        if (!PyArg_ParseTuple(args, "O!Oiil:_bench_put", &capv_type, &pyobj,
+                              &pyvalue, &dbr_type, &count, &iterations) ||
+            dbr_type < DBR_STRING || dbr_type > DBR_DOUBLE ||
+            count <= 0 || iterations <= 0) {
+            pyca_raise_pyexc("_bench_put", "error parsing arguments");
+        }
+        capv* pv = reinterpret_cast<capv*>(pyobj);
+        double start = _pyca_bench_now();
+        for (long i=0; i<iterations; i++) {
+            short type = dbr_type;
+            int n = count;
+            PyObject* pykeep;
+            const void* buffer = _pyca_put_buffer(pv, pyvalue, type, n, &pykeep);
+            Py_XDECREF(pykeep);
+            if (!buffer) {
+                pyca_raise_pyexc_pv("_bench_put", "value can't be converted", pv);
+            }
+        }
+        return PyFloat_FromDouble(_pyca_bench_now() - start);
+    }
+
+    // Issue gets for many PVs, flush once and wait once for all replies.
+    // Returns a list with None for each PV updated successfully or the
+    // error message (as passed to the get callbacks) otherwise.
+    static PyObject* get_many(PyObject*, PyObject* args, PyObject* kwds) {
+        static const char* kwlist[] = {"pvs", "control", "timeout", "count", NULL};
+        PyObject* pypvs;
+        PyObject* pyctrl;
+        PyObject* pytmo;
+        PyObject* pycnt = NULL;
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOO|O:get_many", const_cast<char**>(kwlist),
+                                         &pypvs, &pyctrl, &pytmo, &pycnt) ||
+            !PyBool_Check(pyctrl) ||
+            !PyFloat_Check(pytmo) ||
+            (pycnt && pycnt != Py_None && !PyInt_Check(pycnt))) {
+            pyca_raise_pyexc("get_many", "error parsing arguments");
+        }
+        PyObject* pyseq = _pyca_pv_sequence(pypvs, "get_many");
+        if (!pyseq) {
+            return NULL;
+        }
+        Py_ssize_t npvs = PySequence_Fast_GET_SIZE(pyseq);
+        PyObject* pyres = PyList_New(npvs);
+        if (!pyres) {
+            Py_DECREF(pyseq);
+            return NULL;
+        }
+        bool ctrl = Py_True == pyctrl;
+        double timeout = PyFloat_AsDouble(pytmo);
+        pyca_batch* batch = pyca_batch_new(npvs);
+        for (Py_ssize_t i=0; i<npvs; i++) {
+            capv* pv = reinterpret_cast<capv*>(PySequence_Fast_GET_ITEM(pyseq, i));
+            PyObject* pyexc = NULL;
+            if (pv->simulated != Py_None) {
+                pyexc = PyString_FromString("get_many: can't get simulated PV");
+            } else if (!pv->cid) {
+                pyexc = PyString_FromString("get_many: channel is null");
+            } else {
+                short type = ca_field_type(pv->cid);
+                int count = ca_element_count(pv->cid);
+                if (pycnt && pycnt != Py_None) {
+                    int limit = PyInt_AsLong(pycnt);
+                    if (limit < count)
+                        count = limit;
+                }
+                if (count == 0 || type == TYPENOTCONN) {
+                    pyexc = pyca_data_status_msg(ECA_DISCONNCHID, pv);
+                } else {
+                    pyca_request* req = &batch->requests[i];
+                    req->pv = pv;
+                    pv->count = count;
+                    pyca_batch_issued(req);
+                    int result = ca_array_get_callback(_pyca_read_type(pv, type, ctrl),
+                                                       count,
+                                                       pv->cid,
+                                                       pyca_batch_get_handler,
+                                                       req);
+                    if (result != ECA_NORMAL) {
+                        pyca_request_failed(req, result);
+                        req->pv = 0;
+                        pyexc = pyca_data_status_msg(result, pv);
+                    }
+                }
+            }
+            PyList_SET_ITEM(pyres, i, pyexc);
+        }
+        int result = ca_flush_io();
+        Py_BEGIN_ALLOW_THREADS
+            pyca_batch_wait(batch, timeout);
+        Py_END_ALLOW_THREADS
+        for (Py_ssize_t i=0; i<npvs; i++) {
+            pyca_request* req = &batch->requests[i];
+            capv* pv = req->pv;
+            if (!pv) {
+                continue;
+            }
+            PyObject* pyexc = NULL;
+            if (!pyca_request_done(req)) {
+                pyexc = pyca_data_status_msg(result == ECA_NORMAL ? ECA_TIMEOUT : result, pv);
+            } else if (req->status != ECA_NORMAL) {
+                pyexc = pyca_data_status_msg(req->status, pv);
+            } else if (!_pyca_event_process(pv, req->buffer, req->dbr_type, req->count)) {
+                PyErr_Clear();
+                pyexc = pyca_data_status_msg(ECA_BADTYPE, pv);
+            }
+            PyList_SET_ITEM(pyres, i, pyexc);
+        }
+        pyca_batch_release(batch);
+        for (Py_ssize_t i=0; i<npvs; i++) {
+            if (!PyList_GET_ITEM(pyres, i)) {
+                Py_INCREF(Py_None);
+                PyList_SET_ITEM(pyres, i, Py_None);
+            }
+        }
+        Py_DECREF(pyseq);
+        return pyres;
+    }
+
+    // Issue puts for many PVs and flush once. With wait_complete, the
+    // puts are issued with completion callbacks and the call waits once
+    // for all of them. Returns a list with None for each successful put
+    // or the error message otherwise.
+    static PyObject* put_many(PyObject*, PyObject* args, PyObject* kwds) {
+        static const char* kwlist[] = {"pvs", "values", "timeout", "wait_complete", NULL};
+        PyObject* pypvs;
+        PyObject* pyvals;
+        PyObject* pytmo;
+        PyObject* pywait = Py_False;
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOO|O:put_many", const_cast<char**>(kwlist),
+                                         &pypvs, &pyvals, &pytmo, &pywait) ||
+            !PyFloat_Check(pytmo) ||
+            !PyBool_Check(pywait)) {
+            pyca_raise_pyexc("put_many", "error parsing arguments");
+        }
+        PyObject* pyseq = _pyca_pv_sequence(pypvs, "put_many");
+        if (!pyseq) {
+            return NULL;
+        }
+        PyObject* pyvalseq = PySequence_Fast(pyvals, "put_many expects a sequence of values");
+        if (!pyvalseq) {
+            Py_DECREF(pyseq);
+            return NULL;
+        }
+        Py_ssize_t npvs = PySequence_Fast_GET_SIZE(pyseq);
+        if (PySequence_Fast_GET_SIZE(pyvalseq) != npvs) {
+            Py_DECREF(pyseq);
+            Py_DECREF(pyvalseq);
+            pyca_raise_pyexc("put_many", "number of values doesn't match number of PVs");
+        }
+        PyObject* pyres = PyList_New(npvs);
+        if (!pyres) {
+            Py_DECREF(pyseq);
+            Py_DECREF(pyvalseq);
+            return NULL;
+        }
+        bool wait = Py_True == pywait;
+        double timeout = PyFloat_AsDouble(pytmo);
+        pyca_batch* batch = pyca_batch_new(npvs);
+        for (Py_ssize_t i=0; i<npvs; i++) {
+            capv* pv = reinterpret_cast<capv*>(PySequence_Fast_GET_ITEM(pyseq, i));
+            PyObject* pyval = PySequence_Fast_GET_ITEM(pyvalseq, i);
+            PyObject* pyexc = NULL;
+            chid cid = pv->cid;
+            int count = cid ? ca_element_count(cid) : 0;
+            short type = cid ? ca_field_type(cid) : TYPENOTCONN;
+            if (!cid) {
+                pyexc = PyString_FromString("put_many: channel is null");
+            } else if (count == 0 || type == TYPENOTCONN) {
+                pyexc = pyca_data_status_msg(ECA_DISCONNCHID, pv);
+            } else {
+                short dbr_type = dbf_type_to_DBR(type);
+                PyObject* pykeep;
+                const void* buffer = _pyca_put_buffer(pv, pyval, dbr_type, count, &pykeep);
+                int result;
+                if (!buffer || PyErr_Occurred()) {
+                    PyErr_Clear();
+                    pyexc = PyString_FromString(count ? "put_many: un-handled type" :
+                                                "put_many: empty value");
+                } else if (wait) {
+                    pyca_request* req = &batch->requests[i];
+                    req->pv = pv;
+                    pyca_batch_issued(req);
+                    result = ca_array_put_callback(dbr_type,
+                                                   count,
+                                                   cid,
+                                                   buffer,
+                                                   pyca_batch_put_handler,
+                                                   req);
+                    if (result != ECA_NORMAL) {
+                        pyca_request_failed(req, result);
+                        req->pv = 0;
+                        pyexc = pyca_data_status_msg(result, pv);
+                    }
+                } else {
+                    result = ca_array_put(dbr_type,
+                                          count,
+                                          cid,
+                                          buffer);
+                    if (result != ECA_NORMAL) {
+                        pyexc = pyca_data_status_msg(result, pv);
+                    }
+                }
+                Py_XDECREF(pykeep);
+            }
+            PyList_SET_ITEM(pyres, i, pyexc);
+        }
+        int result = ca_flush_io();
+        if (!wait && result != ECA_NORMAL) {
+            // Nothing tells whether the puts went out
+            pyca_batch_release(batch);
+            Py_DECREF(pyres);
+            Py_DECREF(pyseq);
+            Py_DECREF(pyvalseq);
+            pyca_raise_caexc("ca_flush_io", result);
+        }
+        if (wait) {
+            Py_BEGIN_ALLOW_THREADS
+                pyca_batch_wait(batch, timeout);
+            Py_END_ALLOW_THREADS
+            for (Py_ssize_t i=0; i<npvs; i++) {
+                pyca_request* req = &batch->requests[i];
+                capv* pv = req->pv;
+                if (!pv) {
+                    continue;
+                }
+                PyObject* pyexc = NULL;
+                if (!pyca_request_done(req)) {
+                    pyexc = pyca_data_status_msg(result == ECA_NORMAL ? ECA_TIMEOUT : result, pv);
+                } else if (req->status != ECA_NORMAL) {
+                    pyexc = pyca_data_status_msg(req->status, pv);
+                }
+                PyList_SET_ITEM(pyres, i, pyexc);
+            }
+        }
+        pyca_batch_release(batch);
+        for (Py_ssize_t i=0; i<npvs; i++) {
+            if (!PyList_GET_ITEM(pyres, i)) {
+                Py_INCREF(Py_None);
+                PyList_SET_ITEM(pyres, i, Py_None);
+            }
+        }
+        Py_DECREF(pyseq);
+        Py_DECREF(pyvalseq);
+        return pyres;
+    }
+
     static PyObject* set_numpy(PyObject*, PyObject* np) {
         if (!PyBool_Check(np)) {
             pyca_raise_pyexc("use_numpy", "error parsing arguments");
@@ -682,6 +3725,25 @@ extern "C" {
         {"flush_io", flush_io, METH_NOARGS},
         {"pend_event", pend_event, METH_O},
         {"set_numpy", set_numpy, METH_O},
+        {"set_sync_callback", set_sync_callback, METH_O},
+        {"create_channels", create_channels, METH_O},
+        {"wait_connected", wait_connected, METH_VARARGS},
+        {"get_many", (PyCFunction)get_many, METH_VARARGS | METH_KEYWORDS},
+        {"put_many", (PyCFunction)put_many, METH_VARARGS | METH_KEYWORDS},
+        {"set_event_queue", set_event_queue, METH_VARARGS},
+        {"poll_events", poll_events, METH_VARARGS},
+        {"event_queue_stats", event_queue_stats, METH_NOARGS},
+        {"event_fd", event_fd, METH_VARARGS},
+        {"dispatch_pending", dispatch_pending, METH_NOARGS},
+        {"dispatcher_start", (PyCFunction)dispatcher_start, METH_VARARGS | METH_KEYWORDS},
+        {"dispatcher_stop", dispatcher_stop, METH_NOARGS},
+        {"dispatcher_stats", dispatcher_stats, METH_NOARGS},
+        {"stats", (PyCFunction)stats, METH_VARARGS | METH_KEYWORDS},
+        {"trace_start", (PyCFunction)trace_start, METH_VARARGS | METH_KEYWORDS},
+        {"trace_stop", trace_stop, METH_NOARGS},
+        {"dump_trace", dump_trace, METH_VARARGS},
+        {"_bench_event", _bench_event, METH_VARARGS},
+        {"_bench_put", _bench_put, METH_VARARGS},
         {NULL, NULL}
     };
 
@@ -735,6 +3797,18 @@ extern "C" {
         if (PyType_Ready(&capv_type) < 0) {
             INITERROR;
         }
+        if (PyType_Ready(&shm_reader_type) < 0 ||
+            PyType_Ready(&recorder_type) < 0 ||
+            PyType_Ready(&recording_type) < 0 ||
+            PyType_Ready(&replayer_type) < 0 ||
+            PyType_Ready(&histogram_type) < 0) {
+            INITERROR;
+        }
+#ifdef IS_PY3K
+        if (PyType_Ready(&capv_updates_type) < 0) {
+            INITERROR;
+        }
+#endif
 
 #ifdef IS_PY3K
         PyObject* module = PyModule_Create(&moduledef);
@@ -749,6 +3823,10 @@ extern "C" {
         PyModule_AddIntConstant(module, "DBE_VALUE", DBE_VALUE);
         PyModule_AddIntConstant(module, "DBE_LOG", DBE_LOG);
         PyModule_AddIntConstant(module, "DBE_ALARM", DBE_ALARM);
+        PyModule_AddIntConstant(module, "DBE_PROPERTY", DBE_PROPERTY);
+        // Event queue overflow policies
+        PyModule_AddIntConstant(module, "DROP_NEWEST", PYCA_DROP_NEWEST);
+        PyModule_AddIntConstant(module, "DROP_OLDEST", PYCA_DROP_OLDEST);
         PyObject* s = PyTuple_New(ALARM_NSEV);
         for (unsigned i=0; i<ALARM_NSEV; i++) {
             PyModule_AddIntConstant(module, AlarmSeverityStrings[i], i);
@@ -778,6 +3856,16 @@ extern "C" {
         // Add capv type to this module
         Py_INCREF(&capv_type);
         PyModule_AddObject(module, "capv", (PyObject*)&capv_type);
+        Py_INCREF(&shm_reader_type);
+        PyModule_AddObject(module, "shm_reader", (PyObject*)&shm_reader_type);
+        Py_INCREF(&recorder_type);
+        PyModule_AddObject(module, "recorder", (PyObject*)&recorder_type);
+        Py_INCREF(&recording_type);
+        PyModule_AddObject(module, "recording", (PyObject*)&recording_type);
+        Py_INCREF(&replayer_type);
+        PyModule_AddObject(module, "replayer", (PyObject*)&replayer_type);
+        Py_INCREF(&histogram_type);
+        PyModule_AddObject(module, "histogram", (PyObject*)&histogram_type);
 
         // Add custom exceptions to this module
         pyca_pyexc = PyErr_NewException("pyca.pyexc", NULL, NULL);
@@ -1,10 +1,27 @@
 #include "p3compat.h"
+#include <atomic>
+
+struct pyca_latest;
+struct pyca_history;
+struct pyca_accum;
+struct pyca_record;
+struct pyca_enums;
+struct pyca_async_op;
+struct pyca_proc;
+struct pyca_raw;
+struct pyca_shm_pub;
+struct pyca_rec_tap;
+struct pyca_stats;
+struct pyca_latency;
+
 // Structure to define a channel access PV for python
 struct capv {
   PyObject_HEAD
   PyObject* name;       // PV name
+  const char* tracename;// name in trace records, outlives the capv
   PyObject* data;       // data dictionary
   PyObject* processor;  // user processor function
+  std::atomic<pyca_proc*> proc; // native processor of version 2, or NULL
   PyObject* connect_cb; // connection callback
   PyObject* monitor_cb; // monitor callback
   PyObject* rwaccess_cb;// access rights callback
@@ -12,16 +29,39 @@ struct capv {
   PyObject* putevt_cb;  // event callback
   PyObject* simulated;  // None if real PV, otherwise just simulated.
   PyObject* use_numpy;  // True to use numpy array instead of tuple
+  PyObject* sync_callback; // True to wait on own request instead of ca_pend_io
   chid cid;             // channel access ID
   char* getbuffer;      // buffer for received data
   unsigned getbufsiz;   // received data buffer size
   char* putbuffer;      // buffer for send data
   unsigned putbufsiz;   // send data buffer size
   evid eid;             // monitor subscription
+  evid propeid;         // DBE_PROPERTY subscription of cached control data
   int string_enum;      // Should enum be numeric or string?
   int count;            // How many elements are we monitoring?
   int didget;           // for simulation.
   int didmon;           // for simulation.
+  int connected;        // connection state, guarded by pyca_conn_lock
+  int queued;           // monitor events go to the event queue
+  pyca_latest* latest;  // latest value slot of conflated subscriptions
+  PyObject* arrays;     // list of numpy arrays reused for values, or NULL
+  int nextarray;        // index of the next array to fill
+  int userarrays;       // arrays are supplied by the user, keep them
+  // Native taps read by the CA thread without the GIL: published once
+  // with a release store, cleared only once the channel is gone
+  std::atomic<pyca_history*> history; // history of monitor events, or NULL
+  std::atomic<pyca_accum*> accum;     // statistics of monitor events, or NULL
+  std::atomic<pyca_shm_pub*> shm;     // shared memory publisher, or NULL
+  std::atomic<pyca_rec_tap*> rectap;  // recording of monitor events, or NULL
+  std::atomic<pyca_latency*> latency; // latency histograms, or NULL
+  pyca_record* record;  // last event in record mode, or NULL
+  pyca_enums* enums;    // enum strings, or NULL until first fetched
+  pyca_async_op* asyncmon; // subscription of monitor_async(), or NULL
+  pyca_async_op* asyncops; // get_async() and put_async() in flight
+  pyca_raw* raw;        // copy of the last event, or NULL
+  int keepraw;          // copy events into raw for the buffer protocol
+  unsigned long generation; // events processed
+  pyca_stats* stats;    // counters of the event path
 };
 
 // Possible exceptions
@@ -0,0 +1,77 @@
+/* Native processors of pyca channel access events, version 2.
+ *
+ * A processor is a C function that pyca calls, in the channel access
+ * thread and without the GIL, with every monitor event of a capv and
+ * the events of its gets with a callback (a negative timeout or
+ * get_async()), scalars included. It receives the whole DBR record as
+ * sent by the IOC, its decoded metadata and the context of its plugin,
+ * and may keep monitor events away from Python altogether.
+ *
+ * A plugin hands a processor to pyca as a capsule named
+ * PYCA_PROCESSOR_CAPSULE pointing to a struct pyca_processor, which
+ * must stay valid as long as the capsule lives:
+ *
+ *   static struct pyca_processor proc = {
+ *     PYCA_PROCESSOR_VERSION, 0, my_process, &my_context
+ *   };
+ *   PyObject* capsule = PyCapsule_New(&proc, PYCA_PROCESSOR_CAPSULE, NULL);
+ *
+ * and in Python:
+ *
+ *   pv.processor = plugin.processor()
+ *
+ * Setting the processor of a capv to None or to another object, or
+ * deleting the capv, waits for a running call of the processor to
+ * return, so the capsule destructor may release the context.
+ *
+ * This file is plain C and does not depend on Python or EPICS headers.
+ */
+#ifndef PYCA_PROCESSOR_H
+#define PYCA_PROCESSOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PYCA_PROCESSOR_VERSION 2
+#define PYCA_PROCESSOR_CAPSULE "pyca.processor_v2"
+
+/* Kind of an event */
+#define PYCA_PROCESSOR_MONITOR 0
+#define PYCA_PROCESSOR_GET     1
+
+/* Return values of a processor */
+#define PYCA_PROCESSOR_PASS    0  /* hand the event to Python as usual */
+#define PYCA_PROCESSOR_CONSUME 1  /* drop a monitor event, Python never
+                                     sees it; ignored for get events */
+
+struct pyca_processor_event {
+  int kind;               /* PYCA_PROCESSOR_MONITOR or PYCA_PROCESSOR_GET */
+  const char* name;       /* PV name */
+  int castatus;           /* channel access status, ECA_NORMAL is 1 */
+  short dbr_type;         /* DBR_xxx type of dbr */
+  long count;             /* number of elements */
+  const void* dbr;        /* DBR record, NULL if castatus is an error */
+  const void* value;      /* first element of the value in dbr */
+  unsigned long size;     /* size of an element of the value */
+  int status;             /* alarm status, 0 for plain types */
+  int severity;           /* alarm severity, 0 for plain types */
+  unsigned secs;          /* EPICS time stamp, 0 unless a DBR_TIME type */
+  unsigned nsec;
+};
+
+typedef int (*pyca_process_fn)(const struct pyca_processor_event* event,
+                               void* context);
+
+struct pyca_processor {
+  int version;            /* PYCA_PROCESSOR_VERSION */
+  int flags;              /* reserved, 0 */
+  pyca_process_fn process;
+  void* context;          /* passed to process */
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PYCA_PROCESSOR_H */
@@ -0,0 +1,145 @@
+#include "p3compat.h"
+// Raw copy of the last event of a PV, exported through the buffer
+// protocol.
+//
+// Once enabled with .set_buffer(True), every event processed for a PV is
+// copied as received into a block, and memoryview(pv), numpy.asarray(pv)
+// and the like get a read-only view of the value part of the block,
+// typed after its DBR type. Other PVs pay no copy. The
+// block is overwritten in place while nothing views it; once exported
+// it is kept unchanged for its readers and the next event goes to a
+// new block, the old one being freed with its last export. Each event
+// bumps the generation of the PV, so that a reader can tell whether its
+// view is still the latest value. All of this runs with the GIL.
+
+struct pyca_raw {
+  char* buffer;         // copy of the event
+  unsigned bufsiz;
+  short dbr_type;
+  Py_ssize_t count;     // also the shape of the views
+  Py_ssize_t itemsize;  // also the stride of the views
+  long exports;         // buffer views of this block
+  int detached;         // no longer the block of its PV
+};
+
+static pyca_raw* pyca_raw_new()
+{
+  pyca_raw* raw = new pyca_raw;
+  raw->buffer = 0;
+  raw->bufsiz = 0;
+  raw->dbr_type = -1;
+  raw->count = 0;
+  raw->itemsize = 0;
+  raw->exports = 0;
+  raw->detached = 0;
+  return raw;
+}
+
+static void pyca_raw_free(pyca_raw* raw)
+{
+  delete [] raw->buffer;
+  delete raw;
+}
+
+// Detach the block of pv, which is freed now or by its last release
+static void pyca_raw_detach(capv* pv)
+{
+  pyca_raw* raw = pv->raw;
+  pv->raw = 0;
+  if (raw) {
+    if (raw->exports) {
+      raw->detached = 1;
+    } else {
+      pyca_raw_free(raw);
+    }
+  }
+}
+
+// Copy an event of pv into its block, if enabled
+static void pyca_raw_store(capv* pv, const void* buffer, short dbr_type, long count)
+{
+  pv->generation++;
+  if (!pv->keepraw) {
+    return;
+  }
+  if (pv->raw && pv->raw->exports) {
+    pyca_raw_detach(pv);
+  }
+  if (!pv->raw) {
+    pv->raw = pyca_raw_new();
+  }
+  pyca_raw* raw = pv->raw;
+  unsigned size = dbr_size_n(dbr_type, count);
+  if (size > raw->bufsiz) {
+    delete [] raw->buffer;
+    raw->buffer = new char[size];
+    raw->bufsiz = size;
+    pyca_stat_add(pv, PYCA_STAT_REALLOCS, 1);
+  }
+  memcpy(raw->buffer, buffer, size);
+  raw->dbr_type = dbr_type;
+  raw->count = count;
+  raw->itemsize = dbr_value_size[dbr_type];
+}
+
+// struct module format of the value of a DBR type
+static const char* _pyca_raw_format(short dbr_type)
+{
+  switch (dbr_type % (LAST_TYPE+1)) {
+  case DBR_STRING:
+    return "40s";
+  case DBR_ENUM:
+    return "H";
+  case DBR_CHAR:
+    return "B";
+  case DBR_SHORT:
+    return "h";
+  case DBR_LONG:
+    return "i";
+  case DBR_FLOAT:
+    return "f";
+  default:
+    return "d";
+  }
+}
+
+static int pyca_raw_getbuffer(PyObject* self, Py_buffer* view, int flags)
+{
+  capv* pv = reinterpret_cast<capv*>(self);
+  pyca_raw* raw = pv->raw;
+  if (!raw) {
+    PyErr_SetString(PyExc_BufferError, pv->keepraw ? "no value received" :
+                    "the buffer is not enabled, see set_buffer()");
+    view->obj = NULL;
+    return -1;
+  }
+  if (flags & PyBUF_WRITABLE) {
+    PyErr_SetString(PyExc_BufferError, "the value is read-only");
+    view->obj = NULL;
+    return -1;
+  }
+  view->buf = dbr_value_ptr(raw->buffer, raw->dbr_type);
+  view->itemsize = raw->itemsize;
+  view->len = raw->count * raw->itemsize;
+  view->readonly = 1;
+  view->format = (flags & PyBUF_FORMAT) ? (char*)_pyca_raw_format(raw->dbr_type) : NULL;
+  view->ndim = 1;
+  // One dimension: the shape is the element count, the stride the size.
+  // Both live in the block, which outlives the view and its copies.
+  view->shape = (flags & PyBUF_ND) ? &raw->count : NULL;
+  view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? &raw->itemsize : NULL;
+  view->suboffsets = NULL;
+  view->internal = raw;
+  view->obj = self;
+  Py_INCREF(self);
+  raw->exports++;
+  return 0;
+}
+
+static void pyca_raw_releasebuffer(PyObject*, Py_buffer* view)
+{
+  pyca_raw* raw = reinterpret_cast<pyca_raw*>(view->internal);
+  if (--raw->exports == 0 && raw->detached) {
+    pyca_raw_free(raw);
+  }
+}
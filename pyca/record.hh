@@ -0,0 +1,292 @@
+#include "p3compat.h"
+// Record representation of the last event of a PV.
+//
+// Decoding an event into the data dictionary creates up to a dozen
+// Python objects and dictionary entries. In record mode, an event is
+// only copied in the record of the PV; its fields are decoded one by one
+// when they are read through the capv properties (status, value,
+// secs...) and the data dictionary is brought up to date only when it
+// is accessed.
+
+enum pyca_field {
+  PYCA_STATUS, PYCA_SEVERITY, PYCA_SECS, PYCA_NSEC, PYCA_VALUE,
+  PYCA_UNITS, PYCA_PRECISION, PYCA_NO_STR,
+  PYCA_DISPLAY_LLIM, PYCA_DISPLAY_HLIM, PYCA_WARN_LLIM, PYCA_WARN_HLIM,
+  PYCA_ALARM_LLIM, PYCA_ALARM_HLIM, PYCA_CTRL_LLIM, PYCA_CTRL_HLIM,
+  PYCA_ENUM_STR,
+  PYCA_NFIELDS
+};
+
+// Keys of the fields in the data dictionary
+static const char* pyca_field_names[PYCA_NFIELDS] = {
+  "status", "severity", "secs", "nsec", "value",
+  "units", "precision", "no_str",
+  "display_llim", "display_hlim", "warn_llim", "warn_hlim",
+  "alarm_llim", "alarm_hlim", "ctrl_llim", "ctrl_hlim",
+  "enum_str"
+};
+
+struct pyca_record {
+  char* buffer;         // copy of the last event
+  unsigned bufsiz;
+  short dbr_type;       // -1 until the first event
+  long count;
+  int stale;            // data dictionary not updated with the event yet
+  PyObject* fields[PYCA_NFIELDS]; // fields decoded so far
+};
+
+static pyca_record* pyca_record_new()
+{
+  pyca_record* record = new pyca_record;
+  record->buffer = 0;
+  record->bufsiz = 0;
+  record->dbr_type = -1;
+  record->count = 0;
+  record->stale = 0;
+  for (int i=0; i<PYCA_NFIELDS; i++) {
+    record->fields[i] = 0;
+  }
+  return record;
+}
+
+static void pyca_record_clear_fields(pyca_record* record)
+{
+  for (int i=0; i<PYCA_NFIELDS; i++) {
+    Py_CLEAR(record->fields[i]);
+  }
+}
+
+static void pyca_record_free(pyca_record* record)
+{
+  pyca_record_clear_fields(record);
+  delete [] record->buffer;
+  delete record;
+}
+
+// Decoders of a single field, NULL (without exception) if the DBR
+// type has no such field
+template<class T> static inline
+PyObject* _pyca_field_sts(capv* pv, const T* dbrv, long count, int field)
+{
+  switch (field) {
+  case PYCA_STATUS:
+    return _pyca_get(dbrv->status);
+  case PYCA_SEVERITY:
+    return _pyca_get(dbrv->severity);
+  case PYCA_VALUE:
+    return _pyca_get_value(pv, dbrv, count);
+  default:
+    return NULL;
+  }
+}
+
+template<class T> static inline
+PyObject* _pyca_field_time(capv* pv, const T* dbrv, long count, int field)
+{
+  switch (field) {
+  case PYCA_SECS:
+    return _pyca_get(dbrv->stamp.secPastEpoch);
+  case PYCA_NSEC:
+    return _pyca_get(dbrv->stamp.nsec);
+  default:
+    return _pyca_field_sts(pv, dbrv, count, field);
+  }
+}
+
+template<class T> static inline
+PyObject* _pyca_field_ctrl_long(capv* pv, const T* dbrv, long count, int field)
+{
+  switch (field) {
+  case PYCA_UNITS:
+    return _pyca_get(dbrv->units);
+  case PYCA_DISPLAY_LLIM:
+    return _pyca_get(dbrv->lower_disp_limit);
+  case PYCA_DISPLAY_HLIM:
+    return _pyca_get(dbrv->upper_disp_limit);
+  case PYCA_WARN_LLIM:
+    return _pyca_get(dbrv->lower_warning_limit);
+  case PYCA_WARN_HLIM:
+    return _pyca_get(dbrv->upper_warning_limit);
+  case PYCA_ALARM_LLIM:
+    return _pyca_get(dbrv->lower_alarm_limit);
+  case PYCA_ALARM_HLIM:
+    return _pyca_get(dbrv->upper_alarm_limit);
+  case PYCA_CTRL_LLIM:
+    return _pyca_get(dbrv->lower_ctrl_limit);
+  case PYCA_CTRL_HLIM:
+    return _pyca_get(dbrv->upper_ctrl_limit);
+  default:
+    return _pyca_field_sts(pv, dbrv, count, field);
+  }
+}
+
+template<class T> static inline
+PyObject* _pyca_field_ctrl_double(capv* pv, const T* dbrv, long count, int field)
+{
+  if (field == PYCA_PRECISION) {
+    return _pyca_get(dbrv->precision);
+  }
+  return _pyca_field_ctrl_long(pv, dbrv, count, field);
+}
+
+template<class T> static inline
+PyObject* _pyca_field_ctrl_enum(capv* pv, const T* dbrv, long count, int field)
+{
+  if (field == PYCA_NO_STR) {
+    return _pyca_get(dbrv->no_str);
+  }
+  return _pyca_field_sts(pv, dbrv, count, field);
+}
+
+// Decode one field of the event in buffer, as _pyca_event_decode would
+static PyObject* _pyca_field_decode(capv* pv,
+                                    const void* buffer,
+                                    short dbr_type,
+                                    long count,
+                                    int field)
+{
+  const db_access_val* dbr = reinterpret_cast<const db_access_val*>(buffer);
+  if (field == PYCA_ENUM_STR) {
+    switch (dbr_type) {
+    case DBR_TIME_ENUM:
+      return _pyca_get_enum_str(pv, &dbr->tenmval, count);
+    case DBR_CTRL_ENUM:
+      return _pyca_get_enum_str(pv, &dbr->cenmval, count);
+    default:
+      return NULL;
+    }
+  }
+  switch (dbr_type) {
+  case DBR_TIME_STRING:
+    return _pyca_field_time(pv, &dbr->tstrval, count, field);
+  case DBR_TIME_ENUM:
+    return _pyca_field_time(pv, &dbr->tenmval, count, field);
+  case DBR_TIME_CHAR:
+    return _pyca_field_time(pv, &dbr->tchrval, count, field);
+  case DBR_TIME_SHORT:
+    return _pyca_field_time(pv, &dbr->tshrtval, count, field);
+  case DBR_TIME_LONG:
+    return _pyca_field_time(pv, &dbr->tlngval, count, field);
+  case DBR_TIME_FLOAT:
+    return _pyca_field_time(pv, &dbr->tfltval, count, field);
+  case DBR_TIME_DOUBLE:
+    return _pyca_field_time(pv, &dbr->tdblval, count, field);
+  case DBR_CTRL_STRING:
+    return _pyca_field_sts(pv, &dbr->sstrval, count, field);
+  case DBR_CTRL_ENUM:
+    return _pyca_field_ctrl_enum(pv, &dbr->cenmval, count, field);
+  case DBR_CTRL_CHAR:
+    return _pyca_field_ctrl_long(pv, &dbr->cchrval, count, field);
+  case DBR_CTRL_SHORT:
+    return _pyca_field_ctrl_long(pv, &dbr->cshrtval, count, field);
+  case DBR_CTRL_LONG:
+    return _pyca_field_ctrl_long(pv, &dbr->clngval, count, field);
+  case DBR_CTRL_FLOAT:
+    return _pyca_field_ctrl_double(pv, &dbr->cfltval, count, field);
+  case DBR_CTRL_DOUBLE:
+    return _pyca_field_ctrl_double(pv, &dbr->cdblval, count, field);
+  default:
+    return NULL;
+  }
+}
+
+// Bring the data dictionary of a PV in record mode up to date, reusing
+// the fields already decoded
+static void _pyca_record_sync(capv* pv)
+{
+  pyca_record* record = pv->record;
+  if (record && record->stale) {
+    record->stale = 0;
+    for (int i=0; i<PYCA_NFIELDS; i++) {
+      PyObject* pyval = record->fields[i];
+      record->fields[i] = 0;
+      if (!pyval) {
+        pyval = _pyca_field_decode(pv, record->buffer, record->dbr_type,
+                                   record->count, i);
+      }
+      _pyca_setitem(pv->data, pyca_field_names[i], pyval);
+    }
+  }
+}
+
+static const void* _pyca_event_apply(capv* pv,
+                                     const void* buffer,
+                                     short dbr_type,
+                                     long count)
+{
+  if (dbr_type != DBR_GR_ENUM) {
+    pyca_raw_store(pv, buffer, dbr_type, count);
+  }
+  pyca_record* record = pv->record;
+  // Processors must see every event, enum strings are not a record
+  if (!record || pv->processor || dbr_type == DBR_GR_ENUM ||
+      !(dbr_type_is_TIME(dbr_type) || dbr_type_is_CTRL(dbr_type))) {
+    _pyca_record_sync(pv);
+    return _pyca_event_decode(pv, buffer, dbr_type, count);
+  }
+  if (record->stale && record->dbr_type != dbr_type) {
+    // Keep the fields only the previous type has, as decoding would
+    _pyca_record_sync(pv);
+  }
+  unsigned size = dbr_size_n(dbr_type, count);
+  if (size > record->bufsiz) {
+    delete [] record->buffer;
+    record->buffer = new char[size];
+    record->bufsiz = size;
+    pyca_stat_add(pv, PYCA_STAT_REALLOCS, 1);
+  }
+  memcpy(record->buffer, buffer, size);
+  record->dbr_type = dbr_type;
+  record->count = count;
+  record->stale = 1;
+  pyca_record_clear_fields(record);
+  return buffer;
+}
+
+// Process an event received for pv: decoded into the data dictionary
+// or, in record mode, only copied into the record. Must be called with
+// the GIL. Returns NULL if the DBR type is not handled, or with an
+// exception set if a value could not be built.
+static const void* _pyca_event_process(capv* pv,
+                                       const void* buffer,
+                                       short dbr_type,
+                                       long count)
+{
+  pyca_trace_begin(PYCA_TRACE_DECODE, pv);
+  unsigned long long start = pyca_stat_now();
+  const void* result = _pyca_event_apply(pv, buffer, dbr_type, count);
+  pyca_stat_time(pv, PYCA_STAT_DECODE_NS, start);
+  pyca_trace_end(PYCA_TRACE_DECODE, pv);
+  return PyErr_Occurred() ? NULL : result;
+}
+
+// Value of a field of pv: from its record if the last event has this
+// field, otherwise from the data dictionary. Returns a new reference,
+// NULL with AttributeError set if the field is absent.
+static PyObject* _pyca_field_get(capv* pv, int field)
+{
+  pyca_record* record = pv->record;
+  if (record && record->stale) {
+    PyObject* pyval = record->fields[field];
+    if (!pyval) {
+      pyval = _pyca_field_decode(pv, record->buffer, record->dbr_type,
+                                 record->count, field);
+      record->fields[field] = pyval;
+    }
+    if (pyval) {
+      Py_INCREF(pyval);
+      return pyval;
+    }
+    if (PyErr_Occurred()) {
+      return NULL;
+    }
+    // Decoding the record would not change this field
+  }
+  PyObject* pyval = PyDict_GetItemString(pv->data, pyca_field_names[field]);
+  if (!pyval) {
+    PyErr_SetString(PyExc_AttributeError, pyca_field_names[field]);
+    return NULL;
+  }
+  Py_INCREF(pyval);
+  return pyval;
+}
@@ -0,0 +1,490 @@
+#include "p3compat.h"
+// Recording of the monitor updates of a set of PVs into a file.
+//
+// The monitor handlers append each update of a recorded PV, in the CA
+// thread and without the GIL, to the section of the PV in the chunk
+// being filled in memory. A writer thread swaps the chunk when it is
+// full or at the flush interval and appends it to the file, while the
+// next chunk fills up. If the writer falls behind by several chunks,
+// updates are dropped and counted. A crash may leave an incomplete
+// chunk at the end of the file, which readers ignore.
+//
+// File layout, in native byte order:
+//   pyca_rec_header
+//   npvs x (pyca_rec_pvdesc, name padded to 8 bytes)
+//   chunks: pyca_rec_chunkhdr, npvs x pyca_rec_index, then the section
+//           of each PV: count records of record_size bytes, each a
+//           pyca_rec_record followed by nelm elements
+// Since the records of a PV are contiguous in each chunk, a reader only
+// walks the chunk headers to gather the updates of one PV.
+#include <atomic>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char pyca_rec_magic[8] = {'P', 'Y', 'C', 'A', 'R', 'E', 'C', 0};
+static const uint32_t pyca_rec_version = 1;
+static const uint32_t pyca_rec_chunk_magic = 0x4b4e4843; // "CHNK"
+
+struct pyca_rec_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t npvs;
+};
+
+struct pyca_rec_pvdesc {
+  int16_t dbr_type;     // DBR value type (DBR_STRING ... DBR_DOUBLE)
+  uint16_t namelen;
+  uint32_t nelm;        // elements per record
+  uint32_t elsize;
+  uint32_t record_size;
+};
+
+struct pyca_rec_chunkhdr {
+  uint32_t magic;
+  uint32_t npvs;
+  uint64_t size;        // bytes of the chunk, this header included
+};
+
+struct pyca_rec_index {
+  uint64_t offset;      // of the section from the start of the chunk
+  uint32_t count;       // records in the section
+  uint32_t reserved;
+};
+
+struct pyca_rec_record {
+  uint32_t secs;
+  uint32_t nsec;
+  int16_t status;
+  int16_t severity;
+  uint32_t count;       // elements of the value
+  uint32_t reserved;
+};
+
+static inline size_t pyca_rec_pad(size_t size)
+{
+  return (size + 7) & ~(size_t)7;
+}
+
+// Records of a PV in a chunk being filled or written
+struct pyca_rec_section {
+  char* data;
+  size_t size;
+  size_t capacity;
+  uint32_t count;
+};
+
+struct pyca_recorder {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+  int fd;
+  int npvs;
+  pyca_rec_pvdesc* pvs;
+  pyca_rec_section* filling;  // chunk the CA thread appends to
+  pyca_rec_section* writing;  // chunk the writer thread writes
+  size_t pending;             // bytes in filling
+  size_t chunk_size;
+  double flush_interval;
+  int stop;
+  int error;                  // errno of the first failed write
+  unsigned long records;
+  unsigned long dropped;
+  unsigned long chunks;
+  unsigned long long bytes;   // written to the file
+};
+
+// Recording state of a PV, allocated once and kept for the PV lifetime
+struct pyca_rec_tap {
+  pthread_mutex_t lock;
+  pyca_recorder* recorder;    // NULL when not recorded
+  int index;                  // of the PV in the recorder
+};
+
+static pyca_rec_tap* pyca_rec_tap_new()
+{
+  pyca_rec_tap* tap = new pyca_rec_tap;
+  pthread_mutex_init(&tap->lock, NULL);
+  tap->recorder = 0;
+  tap->index = 0;
+  return tap;
+}
+
+static void pyca_rec_tap_free(pyca_rec_tap* tap)
+{
+  pthread_mutex_destroy(&tap->lock);
+  delete tap;
+}
+
+static void pyca_rec_tap_set(pyca_rec_tap* tap, pyca_recorder* recorder, int index)
+{
+  pthread_mutex_lock(&tap->lock);
+  tap->recorder = recorder;
+  tap->index = index;
+  pthread_mutex_unlock(&tap->lock);
+}
+
+static bool _pyca_rec_write(int fd, const char* buf, size_t size)
+{
+  while (size) {
+    ssize_t written = write(fd, buf, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    buf += written;
+    size -= written;
+  }
+  return true;
+}
+
+// Append the chunk in writing to the file. Called by the writer thread
+// without the lock.
+static void _pyca_rec_write_chunk(pyca_recorder* rec)
+{
+  int npvs = rec->npvs;
+  size_t hdrsize = sizeof(pyca_rec_chunkhdr) + npvs * sizeof(pyca_rec_index);
+  char* hdr = new char[hdrsize];
+  pyca_rec_chunkhdr* chunk = reinterpret_cast<pyca_rec_chunkhdr*>(hdr);
+  pyca_rec_index* index = reinterpret_cast<pyca_rec_index*>(hdr + sizeof(pyca_rec_chunkhdr));
+  uint64_t offset = hdrsize;
+  for (int i=0; i<npvs; i++) {
+    index[i].offset = offset;
+    index[i].count = rec->writing[i].count;
+    index[i].reserved = 0;
+    offset += rec->writing[i].size;
+  }
+  chunk->magic = pyca_rec_chunk_magic;
+  chunk->npvs = npvs;
+  chunk->size = offset;
+  bool ok = _pyca_rec_write(rec->fd, hdr, hdrsize);
+  for (int i=0; ok && i<npvs; i++) {
+    ok = _pyca_rec_write(rec->fd, rec->writing[i].data, rec->writing[i].size);
+  }
+  delete [] hdr;
+  pthread_mutex_lock(&rec->lock);
+  if (ok) {
+    rec->chunks++;
+    rec->bytes += offset;
+  } else if (!rec->error) {
+    rec->error = errno;
+  }
+  pthread_mutex_unlock(&rec->lock);
+  for (int i=0; i<npvs; i++) {
+    rec->writing[i].size = 0;
+    rec->writing[i].count = 0;
+  }
+}
+
+static void* pyca_rec_writer(void* arg)
+{
+  pyca_recorder* rec = reinterpret_cast<pyca_recorder*>(arg);
+  pthread_mutex_lock(&rec->lock);
+  for (;;) {
+    if (!rec->stop && rec->pending < rec->chunk_size) {
+      struct timespec deadline;
+      pyca_deadline(rec->flush_interval, &deadline);
+      pthread_cond_timedwait(&rec->cond, &rec->lock, &deadline);
+    }
+    int last = rec->stop;
+    if (rec->pending) {
+      pyca_rec_section* full = rec->filling;
+      rec->filling = rec->writing;
+      rec->writing = full;
+      rec->pending = 0;
+      pthread_mutex_unlock(&rec->lock);
+      _pyca_rec_write_chunk(rec);
+      pthread_mutex_lock(&rec->lock);
+    }
+    if (last) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&rec->lock);
+  return NULL;
+}
+
+// Open the file and start the writer thread, NULL with errno set on
+// failure. The descriptors of the PVs are filled by the caller.
+static pyca_recorder* pyca_recorder_new(const char* path, pyca_rec_pvdesc* pvs,
+                                        char** names, int npvs,
+                                        size_t chunk_size, double flush_interval)
+{
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return NULL;
+  }
+  pyca_rec_header header;
+  memcpy(header.magic, pyca_rec_magic, sizeof(pyca_rec_magic));
+  header.version = pyca_rec_version;
+  header.npvs = npvs;
+  bool ok = _pyca_rec_write(fd, reinterpret_cast<char*>(&header), sizeof(header));
+  for (int i=0; ok && i<npvs; i++) {
+    size_t padded = pyca_rec_pad(pvs[i].namelen);
+    char* name = new char[padded];
+    memset(name, 0, padded);
+    memcpy(name, names[i], pvs[i].namelen);
+    ok = _pyca_rec_write(fd, reinterpret_cast<char*>(&pvs[i]), sizeof(pvs[i])) &&
+      _pyca_rec_write(fd, name, padded);
+    delete [] name;
+  }
+  if (!ok) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return NULL;
+  }
+  pyca_recorder* rec = new pyca_recorder;
+  pthread_mutex_init(&rec->lock, NULL);
+  pthread_cond_init(&rec->cond, NULL);
+  rec->fd = fd;
+  rec->npvs = npvs;
+  rec->pvs = new pyca_rec_pvdesc[npvs];
+  memcpy(rec->pvs, pvs, npvs * sizeof(pyca_rec_pvdesc));
+  rec->filling = new pyca_rec_section[npvs];
+  rec->writing = new pyca_rec_section[npvs];
+  memset(rec->filling, 0, npvs * sizeof(pyca_rec_section));
+  memset(rec->writing, 0, npvs * sizeof(pyca_rec_section));
+  rec->pending = 0;
+  rec->chunk_size = chunk_size;
+  rec->flush_interval = flush_interval;
+  rec->stop = 0;
+  rec->error = 0;
+  rec->records = 0;
+  rec->dropped = 0;
+  rec->chunks = 0;
+  rec->bytes = 0;
+  int err = pthread_create(&rec->thread, NULL, pyca_rec_writer, rec);
+  if (err) {
+    rec->stop = 1;
+    close(fd);
+    errno = err;
+    // Nothing else refers to rec yet
+    delete [] rec->pvs;
+    delete [] rec->filling;
+    delete [] rec->writing;
+    pthread_cond_destroy(&rec->cond);
+    pthread_mutex_destroy(&rec->lock);
+    delete rec;
+    return NULL;
+  }
+  return rec;
+}
+
+// Flush the pending updates, stop the writer and close the file. The
+// taps of the PVs must have been detached.
+static void pyca_recorder_close(pyca_recorder* rec)
+{
+  pthread_mutex_lock(&rec->lock);
+  rec->stop = 1;
+  pthread_cond_signal(&rec->cond);
+  pthread_mutex_unlock(&rec->lock);
+  pthread_join(rec->thread, NULL);
+  if (close(rec->fd) < 0 && !rec->error) {
+    rec->error = errno;
+  }
+  rec->fd = -1;
+}
+
+static void pyca_recorder_free(pyca_recorder* rec)
+{
+  for (int i=0; i<rec->npvs; i++) {
+    free(rec->filling[i].data);
+    free(rec->writing[i].data);
+  }
+  delete [] rec->filling;
+  delete [] rec->writing;
+  delete [] rec->pvs;
+  pthread_cond_destroy(&rec->cond);
+  pthread_mutex_destroy(&rec->lock);
+  delete rec;
+}
+
+// Append a monitor event to the chunk being filled. Called by the CA
+// thread without the GIL.
+static void pyca_recorder_append(pyca_recorder* rec, int index,
+                                 struct event_handler_args& args)
+{
+  if (args.status != ECA_NORMAL || !args.dbr) {
+    return;
+  }
+  const pyca_rec_pvdesc* desc = &rec->pvs[index];
+  if (args.type % (LAST_TYPE+1) != desc->dbr_type) {
+    return;
+  }
+  pthread_mutex_lock(&rec->lock);
+  if (rec->pending >= 4 * rec->chunk_size) {
+    // The writer is too far behind
+    rec->dropped++;
+    pthread_mutex_unlock(&rec->lock);
+    return;
+  }
+  pyca_rec_section* section = &rec->filling[index];
+  if (section->size + desc->record_size > section->capacity) {
+    size_t capacity = section->capacity ? 2 * section->capacity : 16 * desc->record_size;
+    while (capacity < section->size + desc->record_size) {
+      capacity *= 2;
+    }
+    char* data = reinterpret_cast<char*>(realloc(section->data, capacity));
+    if (!data) {
+      rec->dropped++;
+      pthread_mutex_unlock(&rec->lock);
+      return;
+    }
+    section->data = data;
+    section->capacity = capacity;
+  }
+  char* dst = section->data + section->size;
+  pyca_rec_record* record = reinterpret_cast<pyca_rec_record*>(dst);
+  uint32_t count = args.count < (long)desc->nelm ? args.count : desc->nelm;
+  pyca_dbr_meta meta;
+  _pyca_dbr_meta(args.dbr, args.type, &meta);
+  record->status = meta.status;
+  record->severity = meta.severity;
+  record->secs = meta.secs;
+  record->nsec = meta.nsec;
+  record->count = count;
+  record->reserved = 0;
+  size_t nbytes = (size_t)count * desc->elsize;
+  memcpy(dst + sizeof(pyca_rec_record), dbr_value_ptr(args.dbr, args.type), nbytes);
+  memset(dst + sizeof(pyca_rec_record) + nbytes, 0,
+         desc->record_size - sizeof(pyca_rec_record) - nbytes);
+  section->size += desc->record_size;
+  section->count++;
+  rec->pending += desc->record_size;
+  rec->records++;
+  if (rec->pending >= rec->chunk_size) {
+    pthread_cond_signal(&rec->cond);
+  }
+  pthread_mutex_unlock(&rec->lock);
+}
+
+static void pyca_rec_tap_record(pyca_rec_tap* tap, struct event_handler_args& args)
+{
+  pthread_mutex_lock(&tap->lock);
+  if (tap->recorder) {
+    pyca_recorder_append(tap->recorder, tap->index, args);
+  }
+  pthread_mutex_unlock(&tap->lock);
+}
+
+// Memory mapped recording, read back by pyca.recording
+struct pyca_rec_file {
+  char* addr;
+  size_t size;
+  int npvs;
+  pyca_rec_pvdesc** pvs;      // into the mapping
+  const char** names;         // into the mapping, not terminated
+  size_t first;               // offset of the first chunk
+};
+
+static void pyca_rec_file_close(pyca_rec_file* file)
+{
+  if (file->addr) {
+    munmap(file->addr, file->size);
+  }
+  delete [] file->pvs;
+  delete [] file->names;
+  delete file;
+}
+
+// Map a recording and read its header, NULL with errno set on failure
+static pyca_rec_file* pyca_rec_file_open(const char* path)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  void* addr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(pyca_rec_header)) {
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  } else {
+    errno = EINVAL;
+  }
+  int err = errno;
+  close(fd);
+  if (addr == MAP_FAILED) {
+    errno = err;
+    return NULL;
+  }
+  pyca_rec_file* file = new pyca_rec_file;
+  file->addr = reinterpret_cast<char*>(addr);
+  file->size = st.st_size;
+  file->pvs = 0;
+  file->names = 0;
+  const pyca_rec_header* header = reinterpret_cast<const pyca_rec_header*>(addr);
+  // Each PV has at least its description in the file
+  if (memcmp(header->magic, pyca_rec_magic, sizeof(pyca_rec_magic)) != 0 ||
+      header->version != pyca_rec_version || header->npvs > INT_MAX ||
+      header->npvs > (file->size - sizeof(pyca_rec_header)) / sizeof(pyca_rec_pvdesc)) {
+    pyca_rec_file_close(file);
+    errno = EINVAL;
+    return NULL;
+  }
+  file->npvs = header->npvs;
+  file->pvs = new pyca_rec_pvdesc*[file->npvs];
+  file->names = new const char*[file->npvs];
+  size_t pos = sizeof(pyca_rec_header);
+  for (int i=0; i<file->npvs; i++) {
+    if (pos + sizeof(pyca_rec_pvdesc) > file->size) {
+      pyca_rec_file_close(file);
+      errno = EINVAL;
+      return NULL;
+    }
+    file->pvs[i] = reinterpret_cast<pyca_rec_pvdesc*>(file->addr + pos);
+    const pyca_rec_pvdesc* desc = file->pvs[i];
+    // Records must hold the values they claim
+    if (desc->dbr_type < DBR_STRING || desc->dbr_type > DBR_DOUBLE ||
+        desc->elsize != dbr_value_size[desc->dbr_type] ||
+        desc->record_size < sizeof(pyca_rec_record) + (uint64_t)desc->nelm * desc->elsize) {
+      pyca_rec_file_close(file);
+      errno = EINVAL;
+      return NULL;
+    }
+    pos += sizeof(pyca_rec_pvdesc);
+    file->names[i] = file->addr + pos;
+    pos += pyca_rec_pad(file->pvs[i]->namelen);
+  }
+  if (pos > file->size) {
+    pyca_rec_file_close(file);
+    errno = EINVAL;
+    return NULL;
+  }
+  file->first = pos;
+  return file;
+}
+
+// Chunk at offset pos, NULL at the end of the file or of its complete
+// chunks. Chunks are checked to hold their index and sections, the
+// first bad one ends the recording.
+static const pyca_rec_chunkhdr* pyca_rec_file_chunk(pyca_rec_file* file, size_t pos)
+{
+  if (pos + sizeof(pyca_rec_chunkhdr) > file->size) {
+    return NULL;
+  }
+  const pyca_rec_chunkhdr* chunk = reinterpret_cast<const pyca_rec_chunkhdr*>(file->addr + pos);
+  uint64_t start = sizeof(pyca_rec_chunkhdr) + (uint64_t)file->npvs * sizeof(pyca_rec_index);
+  if (chunk->magic != pyca_rec_chunk_magic || (int)chunk->npvs != file->npvs ||
+      chunk->size > file->size - pos || chunk->size < start) {
+    return NULL;
+  }
+  const pyca_rec_index* index = reinterpret_cast<const pyca_rec_index*>(chunk + 1);
+  for (int i=0; i<file->npvs; i++) {
+    if (index[i].offset < start || index[i].offset > chunk->size ||
+        (uint64_t)index[i].count * file->pvs[i]->record_size > chunk->size - index[i].offset) {
+      return NULL;
+    }
+  }
+  return chunk;
+}
+
+static inline const pyca_rec_index* pyca_rec_chunk_index(const pyca_rec_chunkhdr* chunk)
+{
+  return reinterpret_cast<const pyca_rec_index*>(chunk + 1);
+}
@@ -0,0 +1,172 @@
+#include "p3compat.h"
+// Replay of a recording into simulated PVs.
+//
+// A replay thread merges the records of the replayed PVs in time order
+// and turns each one back into the DBR_TIME event the IOC sent, which
+// goes through pyca_monitor_handler() as a live update would: native
+// taps, decoding or record mode, then monitor_cb. Only the simulated
+// capv which are subscribed receive updates. Records are paced after
+// their time stamps divided by the rate, or sent as fast as possible
+// with a rate of 0.
+#include <atomic>
+#include <time.h>
+
+struct pyca_replay {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+  pyca_rec_file* file;  // owned by a pyca.recording kept alive meanwhile
+  int npvs;             // replayed PVs
+  int* index;           // of each replayed PV in the file
+  capv** pvs;
+  double rate;
+  int loop;             // start over at the end
+  std::atomic<int> stop;
+  int done;             // guarded by lock
+  std::atomic<unsigned long> replayed;
+  std::atomic<unsigned long> skipped; // records of unsubscribed PVs
+};
+
+static inline double pyca_replay_now()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// Sleep until the monotonic time t, unless asked to stop
+static void pyca_replay_sleep_until(pyca_replay* replay, double t)
+{
+  for (;;) {
+    double left = t - pyca_replay_now();
+    if (left <= 0 || replay->stop.load()) {
+      return;
+    }
+    // Wake up regularly to see a stop request
+    if (left > 0.1) {
+      left = 0.1;
+    }
+    struct timespec delay;
+    delay.tv_sec = (time_t)left;
+    delay.tv_nsec = (long)((left - delay.tv_sec) * 1e9);
+    nanosleep(&delay, NULL);
+  }
+}
+
+// Send one record of replayed PV i as a monitor event
+static void pyca_replay_send(pyca_replay* replay, int i,
+                             const pyca_rec_record* record, char** buffer,
+                             unsigned* bufsiz)
+{
+  capv* pv = replay->pvs[i];
+  if (!pv->didmon) {
+    replay->skipped++;
+    return;
+  }
+  const pyca_rec_pvdesc* desc = replay->file->pvs[replay->index[i]];
+  short dbr_type = DBR_TIME_STRING + desc->dbr_type;
+  long count = record->count ? record->count : 1;
+  if (count > (long)desc->nelm) {
+    count = desc->nelm;
+  }
+  // A simulated subscription may ask for fewer elements
+  if (pv->count > 0 && count > pv->count) {
+    count = pv->count;
+  }
+  unsigned size = dbr_size_n(dbr_type, count);
+  if (size > *bufsiz) {
+    delete [] *buffer;
+    *buffer = new char[size];
+    *bufsiz = size;
+  }
+  // All the DBR_TIME structures start with status, severity and stamp
+  struct dbr_time_short* dbr = reinterpret_cast<struct dbr_time_short*>(*buffer);
+  dbr->status = record->status;
+  dbr->severity = record->severity;
+  dbr->stamp.secPastEpoch = record->secs;
+  dbr->stamp.nsec = record->nsec;
+  memcpy(dbr_value_ptr(*buffer, dbr_type),
+         reinterpret_cast<const char*>(record) + sizeof(pyca_rec_record),
+         (size_t)count * desc->elsize);
+  struct event_handler_args args;
+  memset(&args, 0, sizeof(args));
+  args.usr = pv;
+  args.chid = NULL;
+  args.type = dbr_type;
+  args.count = count;
+  args.dbr = *buffer;
+  args.status = ECA_NORMAL;
+  pyca_monitor_handler(args);
+  replay->replayed++;
+}
+
+static void* pyca_replay_run(void* arg)
+{
+  pyca_replay* replay = reinterpret_cast<pyca_replay*>(arg);
+  pyca_rec_file* file = replay->file;
+  int npvs = replay->npvs;
+  const char** cursor = new const char*[npvs];
+  uint32_t* left = new uint32_t[npvs];
+  char* buffer = 0;
+  unsigned bufsiz = 0;
+  double start = 0;     // monotonic time of the first record
+  double first = -1;    // time stamp of the first record
+  bool sent;
+  do {
+    sent = false;
+    for (size_t pos=file->first; !replay->stop.load(); ) {
+      const pyca_rec_chunkhdr* chunk = pyca_rec_file_chunk(file, pos);
+      if (!chunk) {
+        break;
+      }
+      const pyca_rec_index* index = pyca_rec_chunk_index(chunk);
+      for (int i=0; i<npvs; i++) {
+        const pyca_rec_index* idx = &index[replay->index[i]];
+        cursor[i] = reinterpret_cast<const char*>(chunk) + idx->offset;
+        left[i] = idx->count;
+      }
+      // Merge the sections of the chunk, each in time order
+      while (!replay->stop.load()) {
+        int next = -1;
+        double tnext = 0;
+        for (int i=0; i<npvs; i++) {
+          if (left[i]) {
+            const pyca_rec_record* record = reinterpret_cast<const pyca_rec_record*>(cursor[i]);
+            double t = record->secs + record->nsec * 1e-9;
+            if (next < 0 || t < tnext) {
+              next = i;
+              tnext = t;
+            }
+          }
+        }
+        if (next < 0) {
+          break;
+        }
+        sent = true;
+        if (replay->rate > 0) {
+          if (first < 0) {
+            first = tnext;
+            start = pyca_replay_now();
+          }
+          pyca_replay_sleep_until(replay, start + (tnext - first) / replay->rate);
+        }
+        pyca_replay_send(replay, next,
+                         reinterpret_cast<const pyca_rec_record*>(cursor[next]),
+                         &buffer, &bufsiz);
+        cursor[next] += file->pvs[replay->index[next]]->record_size;
+        left[next]--;
+      }
+      pos += chunk->size;
+    }
+    // Time stamps start over with the next pass
+    first = -1;
+  } while (replay->loop && sent && !replay->stop.load());
+  delete [] buffer;
+  delete [] left;
+  delete [] cursor;
+  pthread_mutex_lock(&replay->lock);
+  replay->done = 1;
+  pthread_cond_broadcast(&replay->cond);
+  pthread_mutex_unlock(&replay->lock);
+  return NULL;
+}
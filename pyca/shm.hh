@@ -0,0 +1,379 @@
+#include "p3compat.h"
+// Fan-out of the monitor events of a PV to other processes through a
+// POSIX shared memory ring.
+//
+// The publishing process writes every update of the PV in the CA
+// thread, without the GIL, into the next slot of a ring in a shared
+// memory segment. Each slot holds the update number, time stamp, alarm
+// status and severity and the value; readers attach to the segment in
+// their own process and look at the slots in place. A slot is guarded
+// by a sequence number, odd while the slot is written, so that readers
+// can tell whether what they read was overwritten (seqlock). There is
+// one writer per segment.
+#include <atomic>
+#include <new>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char pyca_shm_magic[8] = {'P', 'Y', 'C', 'A', 'S', 'H', 'M', 0};
+static const uint32_t pyca_shm_version = 2;
+
+// Layout of a segment: a header followed by nslots slots of slot_size
+// bytes, each a pyca_shm_slot followed by nelm elements
+struct pyca_shm_header {
+  char magic[8];
+  uint32_t version;
+  int16_t dbr_type;     // DBR value type (DBR_STRING ... DBR_DOUBLE)
+  int16_t reserved;
+  uint32_t nelm;        // elements per slot
+  uint32_t elsize;      // bytes per element
+  uint32_t nslots;
+  uint32_t slot_size;
+  std::atomic<uint64_t> head; // number of the last update written
+  int32_t pid;          // process of the publisher
+  std::atomic<uint32_t> closed; // set once the publisher stopped
+  char padding[16];
+};
+
+struct pyca_shm_slot {
+  std::atomic<uint64_t> seq;  // 2n-1 while update n is written, then 2n
+  uint32_t secs;
+  uint32_t nsec;
+  int16_t status;
+  int16_t severity;
+  uint32_t count;       // elements of the value
+};
+
+// Mapping of a segment in this process
+struct pyca_shm_map {
+  char* addr;
+  size_t size;
+  pyca_shm_header* header;
+  dev_t dev;            // file of the segment, for the publisher
+  ino_t ino;
+};
+
+static inline pyca_shm_slot* pyca_shm_slot_of(pyca_shm_map* map, uint64_t update)
+{
+  pyca_shm_header* header = map->header;
+  return reinterpret_cast<pyca_shm_slot*>(
+    map->addr + sizeof(pyca_shm_header) +
+    ((update - 1) % header->nslots) * header->slot_size);
+}
+
+static inline char* pyca_shm_value_of(pyca_shm_slot* slot)
+{
+  return reinterpret_cast<char*>(slot) + sizeof(pyca_shm_slot);
+}
+
+// POSIX names start with a slash, add it if missing. Returns a string
+// to be freed.
+static char* pyca_shm_name(const char* name)
+{
+  char* path = reinterpret_cast<char*>(malloc(strlen(name) + 2));
+  path[0] = '/';
+  strcpy(name[0] == '/' ? path : path + 1, name);
+  return path;
+}
+
+static void pyca_shm_unmap(pyca_shm_map* map)
+{
+  munmap(map->addr, map->size);
+  delete map;
+}
+
+// Whether path names the file dev/ino
+static bool pyca_shm_is_file(const char* path, dev_t dev, ino_t ino)
+{
+  int fd = shm_open(path, O_RDONLY, 0);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  bool same = fstat(fd, &st) == 0 && st.st_dev == dev && st.st_ino == ino;
+  close(fd);
+  return same;
+}
+
+// Unlink the segment path if it was provably left by a publisher which
+// is gone: it stopped, or its process no longer exists. A segment being
+// created, or of another version, is left alone. Returns true if it
+// was unlinked.
+static bool pyca_shm_unlink_stale(const char* path)
+{
+  int fd = shm_open(path, O_RDONLY, 0);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  void* addr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(pyca_shm_header)) {
+    addr = mmap(NULL, sizeof(pyca_shm_header), PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return false;
+  }
+  const pyca_shm_header* header = reinterpret_cast<const pyca_shm_header*>(addr);
+  bool stale = false;
+  if (memcmp(header->magic, pyca_shm_magic, sizeof(pyca_shm_magic)) == 0 &&
+      header->version == pyca_shm_version) {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    stale = header->closed.load(std::memory_order_acquire) ||
+      (kill(header->pid, 0) != 0 && errno == ESRCH);
+  }
+  munmap(addr, sizeof(pyca_shm_header));
+  // Another publisher may have replaced it in the meantime
+  if (stale && pyca_shm_is_file(path, st.st_dev, st.st_ino)) {
+    return shm_unlink(path) == 0;
+  }
+  return false;
+}
+
+// Create the segment of a publisher, NULL with errno set on failure,
+// EEXIST if another publisher uses the name. A segment left with the
+// same name by a publisher which stopped or crashed is unlinked rather
+// than reused: its readers keep mapping the old one, which is neither
+// zeroed nor shrunk under them.
+static pyca_shm_map* pyca_shm_create(const char* name, short dbr_type,
+                                     uint32_t nelm, uint32_t nslots)
+{
+  uint32_t elsize = dbr_value_size[dbr_type];
+  uint32_t slot_size = sizeof(pyca_shm_slot) + nelm * elsize;
+  slot_size = (slot_size + 7) & ~7u;
+  size_t size = sizeof(pyca_shm_header) + (size_t)nslots * slot_size;
+  char* path = pyca_shm_name(name);
+  int fd = shm_open(path, O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0 && errno == EEXIST) {
+    if (pyca_shm_unlink_stale(path)) {
+      fd = shm_open(path, O_CREAT | O_EXCL | O_RDWR, 0644);
+    } else {
+      errno = EEXIST;
+    }
+  }
+  if (fd < 0) {
+    free(path);
+    return NULL;
+  }
+  struct stat st;
+  void* addr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && ftruncate(fd, size) == 0) {
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  int err = errno;
+  close(fd);
+  if (addr == MAP_FAILED) {
+    shm_unlink(path);
+  }
+  free(path);
+  if (addr == MAP_FAILED) {
+    errno = err;
+    return NULL;
+  }
+  pyca_shm_map* map = new pyca_shm_map;
+  map->addr = reinterpret_cast<char*>(addr);
+  map->size = size;
+  map->header = new (addr) pyca_shm_header;
+  map->dev = st.st_dev;
+  map->ino = st.st_ino;
+  pyca_shm_header* header = map->header;
+  header->version = pyca_shm_version;
+  header->dbr_type = dbr_type;
+  header->reserved = 0;
+  header->nelm = nelm;
+  header->elsize = elsize;
+  header->nslots = nslots;
+  header->slot_size = slot_size;
+  header->head.store(0, std::memory_order_relaxed);
+  header->pid = getpid();
+  header->closed.store(0, std::memory_order_relaxed);
+  for (uint32_t i=0; i<nslots; i++) {
+    new (pyca_shm_slot_of(map, i + 1)) pyca_shm_slot;
+    pyca_shm_slot_of(map, i + 1)->seq.store(0, std::memory_order_relaxed);
+  }
+  // Readers check the magic last
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(header->magic, pyca_shm_magic, sizeof(pyca_shm_magic));
+  return map;
+}
+
+// Attach a reader to a segment, NULL with errno set on failure
+static pyca_shm_map* pyca_shm_attach(const char* name)
+{
+  char* path = pyca_shm_name(name);
+  int fd = shm_open(path, O_RDONLY, 0);
+  free(path);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  void* addr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(pyca_shm_header)) {
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  } else {
+    errno = EINVAL;
+  }
+  int err = errno;
+  close(fd);
+  if (addr == MAP_FAILED) {
+    errno = err;
+    return NULL;
+  }
+  pyca_shm_map* map = new pyca_shm_map;
+  map->addr = reinterpret_cast<char*>(addr);
+  map->size = st.st_size;
+  map->header = reinterpret_cast<pyca_shm_header*>(addr);
+  pyca_shm_header* header = map->header;
+  if (memcmp(header->magic, pyca_shm_magic, sizeof(pyca_shm_magic)) != 0 ||
+      header->version != pyca_shm_version ||
+      sizeof(pyca_shm_header) + (size_t)header->nslots * header->slot_size > map->size) {
+    pyca_shm_unmap(map);
+    errno = EINVAL;
+    return NULL;
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return map;
+}
+
+// Publishing state of a PV, allocated once and kept for the PV lifetime
+struct pyca_shm_pub {
+  pthread_mutex_t lock;
+  pyca_shm_map* map;    // NULL when not publishing
+  char* path;           // name of the segment
+  unsigned long skipped;// events of another type than the segment
+};
+
+static pyca_shm_pub* pyca_shm_pub_new()
+{
+  pyca_shm_pub* pub = new pyca_shm_pub;
+  pthread_mutex_init(&pub->lock, NULL);
+  pub->map = 0;
+  pub->path = 0;
+  pub->skipped = 0;
+  return pub;
+}
+
+// Stop publishing and remove the segment, unless its name was taken
+// over by another publisher; attached readers keep their mapping
+static void pyca_shm_pub_stop(pyca_shm_pub* pub)
+{
+  pthread_mutex_lock(&pub->lock);
+  pyca_shm_map* map = pub->map;
+  pub->map = 0;
+  pthread_mutex_unlock(&pub->lock);
+  if (map) {
+    map->header->closed.store(1, std::memory_order_release);
+    if (pyca_shm_is_file(pub->path, map->dev, map->ino)) {
+      shm_unlink(pub->path);
+    }
+    pyca_shm_unmap(map);
+  }
+  free(pub->path);
+  pub->path = 0;
+}
+
+static void pyca_shm_pub_free(pyca_shm_pub* pub)
+{
+  pyca_shm_pub_stop(pub);
+  pthread_mutex_destroy(&pub->lock);
+  delete pub;
+}
+
+// Write a monitor event in the next slot. Called by the CA thread
+// without the GIL.
+static void pyca_shm_publish(pyca_shm_pub* pub, struct event_handler_args& args)
+{
+  if (args.status != ECA_NORMAL || !args.dbr) {
+    return;
+  }
+  pthread_mutex_lock(&pub->lock);
+  pyca_shm_map* map = pub->map;
+  if (!map) {
+    pthread_mutex_unlock(&pub->lock);
+    return;
+  }
+  pyca_shm_header* header = map->header;
+  if (args.type % (LAST_TYPE+1) != header->dbr_type) {
+    pub->skipped++;
+    pthread_mutex_unlock(&pub->lock);
+    return;
+  }
+  uint64_t update = header->head.load(std::memory_order_relaxed) + 1;
+  pyca_shm_slot* slot = pyca_shm_slot_of(map, update);
+  slot->seq.store(2*update - 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  uint32_t count = args.count < (long)header->nelm ? args.count : header->nelm;
+  memcpy(pyca_shm_value_of(slot), dbr_value_ptr(args.dbr, args.type),
+         (size_t)count * header->elsize);
+  slot->count = count;
+  pyca_dbr_meta meta;
+  _pyca_dbr_meta(args.dbr, args.type, &meta);
+  slot->status = meta.status;
+  slot->severity = meta.severity;
+  slot->secs = meta.secs;
+  slot->nsec = meta.nsec;
+  slot->seq.store(2*update, std::memory_order_release);
+  header->head.store(update, std::memory_order_release);
+  pthread_mutex_unlock(&pub->lock);
+}
+
+// Metadata of an update read by a reader
+struct pyca_shm_meta {
+  uint32_t secs;
+  uint32_t nsec;
+  int16_t status;
+  int16_t severity;
+  uint32_t count;
+};
+
+// Read the metadata of an update, and copy its value to dst unless
+// NULL. Returns false if the update is not or no longer in the ring.
+static bool pyca_shm_read(pyca_shm_map* map, uint64_t update,
+                          pyca_shm_meta* meta, char* dst)
+{
+  pyca_shm_header* header = map->header;
+  if (update == 0) {
+    return false;
+  }
+  pyca_shm_slot* slot = pyca_shm_slot_of(map, update);
+  // The writer may have died in the middle of a slot, don't wait forever
+  for (int tries=0; tries<1000; tries++) {
+    uint64_t seq = slot->seq.load(std::memory_order_acquire);
+    if (seq == 2*update - 1) {
+      // Being written
+      sched_yield();
+      continue;
+    }
+    if (seq == 2*update) {
+      meta->secs = slot->secs;
+      meta->nsec = slot->nsec;
+      meta->status = slot->status;
+      meta->severity = slot->severity;
+      meta->count = slot->count < header->nelm ? slot->count : header->nelm;
+      if (dst) {
+        memcpy(dst, pyca_shm_value_of(slot), (size_t)meta->count * header->elsize);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot->seq.load(std::memory_order_relaxed) == seq) {
+        return true;
+      }
+      return false;
+    }
+    // Not written yet, or overwritten
+    return false;
+  }
+  return false;
+}
+
+// Whether the slot of an update still holds it, for readers that used
+// the value in place
+static bool pyca_shm_valid(pyca_shm_map* map, uint64_t update)
+{
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return update && pyca_shm_slot_of(map, update)->seq.load(std::memory_order_relaxed) == 2*update;
+}
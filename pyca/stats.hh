@@ -0,0 +1,118 @@
+#include "p3compat.h"
+// Counters of the event path, per PV and for the whole process.
+//
+// Each capv has a block of counters, allocated with it, and every
+// increment also goes to the global block. Counters are relaxed atomics
+// updated by whichever thread handles the event, with or without the
+// GIL; durations come from the monotonic clock. They are always on, the
+// cost of an event being a few uncontended increments and clock reads.
+#include <atomic>
+#include <time.h>
+
+enum pyca_stat {
+  PYCA_STAT_EVENTS,           // events received from channel access
+  PYCA_STAT_BYTES,            // DBR bytes of these events
+  PYCA_STAT_DECODE_NS,        // in _pyca_event_process()
+  PYCA_STAT_DECODES,
+  PYCA_STAT_GIL_WAIT_NS,      // in PyGILState_Ensure() of the CA thread
+  PYCA_STAT_GIL_WAITS,
+  PYCA_STAT_CALLBACK_NS,      // in user callbacks
+  PYCA_STAT_CALLBACKS,
+  PYCA_STAT_CALLBACK_ERRORS,  // callbacks which raised
+  PYCA_STAT_DROPPED,          // queued events dropped by the overflow policy
+  PYCA_STAT_CONFLATED,        // conflated events overwritten before polled
+  PYCA_STAT_REALLOCS,         // event and put buffers grown or shrunk
+  PYCA_NSTATS
+};
+
+static const char* pyca_stat_names[PYCA_NSTATS] = {
+  "events",
+  "bytes",
+  "decode_ns",
+  "decodes",
+  "gil_wait_ns",
+  "gil_waits",
+  "callback_ns",
+  "callbacks",
+  "callback_errors",
+  "dropped",
+  "conflated",
+  "reallocs",
+};
+
+struct pyca_stats {
+  std::atomic<unsigned long long> counter[PYCA_NSTATS];
+};
+
+static pyca_stats pyca_global_stats;
+
+static pyca_stats* pyca_stats_new()
+{
+  pyca_stats* stats = new pyca_stats;
+  for (int i=0; i<PYCA_NSTATS; i++) {
+    stats->counter[i].store(0, std::memory_order_relaxed);
+  }
+  return stats;
+}
+
+static inline unsigned long long pyca_stat_now()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static inline void pyca_stat_add(capv* pv, int stat, unsigned long long n)
+{
+  pv->stats->counter[stat].fetch_add(n, std::memory_order_relaxed);
+  pyca_global_stats.counter[stat].fetch_add(n, std::memory_order_relaxed);
+}
+
+// Account for a duration started at pyca_stat_now() and one occurrence
+static inline void pyca_stat_time(capv* pv, int stat_ns, unsigned long long start)
+{
+  pyca_stat_add(pv, stat_ns, pyca_stat_now() - start);
+  pyca_stat_add(pv, stat_ns + 1, 1);
+}
+
+// Account for an event received by the CA thread
+static inline void pyca_stat_event(capv* pv, struct event_handler_args& args)
+{
+  pyca_stat_add(pv, PYCA_STAT_EVENTS, 1);
+  if (args.status == ECA_NORMAL && args.dbr) {
+    pyca_stat_add(pv, PYCA_STAT_BYTES, dbr_size_n(args.type, args.count));
+  }
+}
+
+// PyGILState_Ensure() for an event of pv, timed
+static inline PyGILState_STATE pyca_gil_ensure(capv* pv)
+{
+  pyca_trace_begin(PYCA_TRACE_GIL_WAIT, pv);
+  unsigned long long start = pyca_stat_now();
+  PyGILState_STATE gstate = PyGILState_Ensure();
+  pyca_stat_time(pv, PYCA_STAT_GIL_WAIT_NS, start);
+  pyca_trace_end(PYCA_TRACE_GIL_WAIT, pv);
+  return gstate;
+}
+
+// Dictionary of the counters, reset to 0 if reset is true
+static PyObject* pyca_stats_dict(pyca_stats* stats, bool reset)
+{
+  PyObject* pydict = PyDict_New();
+  if (!pydict) {
+    return NULL;
+  }
+  for (int i=0; i<PYCA_NSTATS; i++) {
+    unsigned long long value = reset ?
+      stats->counter[i].exchange(0, std::memory_order_relaxed) :
+      stats->counter[i].load(std::memory_order_relaxed);
+    PyObject* pyvalue = PyLong_FromUnsignedLongLong(value);
+    if (!pyvalue || PyDict_SetItemString(pydict, pyca_stat_names[i], pyvalue) < 0) {
+      Py_XDECREF(pyvalue);
+      Py_DECREF(pydict);
+      return NULL;
+    }
+    Py_DECREF(pyvalue);
+  }
+  return pydict;
+}
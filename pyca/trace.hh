@@ -0,0 +1,220 @@
+#include "p3compat.h"
+// Ring of trace events of the channel access callbacks.
+//
+// Once started with pyca.trace_start(), the handlers record the entry
+// and exit of connection, monitor, get and put callbacks, and the spans
+// waiting for the GIL, decoding an event and running a user callback,
+// each with its PV and thread. Records go into a fixed size ring shared
+// by all the threads, written without locks: a writer claims the next
+// record number and marks the record with it once filled, so that
+// pyca.dump_trace() only exports records that were completely written
+// and not overwritten since. Records point to the PV name, not to the
+// PV, which may be freed before the dump. The ring is exported in the
+// Chrome trace event format, which Perfetto and chrome://tracing open.
+#include <atomic>
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+enum pyca_trace_kind {
+  PYCA_TRACE_CONNECT,
+  PYCA_TRACE_GET,
+  PYCA_TRACE_PUT,
+  PYCA_TRACE_MONITOR,
+  PYCA_TRACE_GIL_WAIT,
+  PYCA_TRACE_DECODE,
+  PYCA_TRACE_CALLBACK,
+  PYCA_TRACE_NKINDS
+};
+
+static const char* pyca_trace_names[PYCA_TRACE_NKINDS] = {
+  "connection",
+  "get",
+  "put",
+  "monitor",
+  "gil_wait",
+  "decode",
+  "callback",
+};
+
+struct pyca_trace_rec {
+  std::atomic<uint64_t> seq;  // n+1 once record n is written, 0 meanwhile
+  uint64_t ts;          // monotonic nanoseconds
+  const char* name;     // of the PV, see pyca_trace_name()
+  uint32_t tid;
+  uint8_t kind;
+  char phase;           // 'B' or 'E'
+};
+
+struct pyca_trace {
+  uint64_t capacity;
+  pyca_trace_rec* recs;
+  std::atomic<uint64_t> head; // number of records claimed
+  std::atomic<uint64_t> start;// first record of the current trace
+  std::atomic<int> active;
+};
+
+// Allocated by the first pyca.trace_start() and kept, since the CA
+// thread may be writing to it at any time
+static std::atomic<pyca_trace*> pyca_tracer(NULL);
+
+// PV names of the trace records, never freed
+static PyObject* pyca_trace_pvnames = 0;
+
+// Name of a PV, as recorded by the CA thread without the GIL. The name
+// is kept for good, once per distinct name. Called with the GIL.
+// Returns NULL with an exception on failure.
+static const char* pyca_trace_name(PyObject* name)
+{
+  if (!pyca_trace_pvnames) {
+    pyca_trace_pvnames = PyDict_New();
+    if (!pyca_trace_pvnames) {
+      return NULL;
+    }
+  }
+  PyObject* kept = PyDict_GetItem(pyca_trace_pvnames, name);
+  if (!kept) {
+    if (PyDict_SetItem(pyca_trace_pvnames, name, name) < 0) {
+      return NULL;
+    }
+    kept = name;
+  }
+  return PyString_AsString(kept);
+}
+
+// Ring of capacity records, NULL if it can't be allocated
+static pyca_trace* pyca_trace_new(uint64_t capacity)
+{
+  if (capacity > SIZE_MAX / sizeof(pyca_trace_rec)) {
+    return NULL;
+  }
+  pyca_trace_rec* recs = new (std::nothrow) pyca_trace_rec[capacity];
+  if (!recs) {
+    return NULL;
+  }
+  pyca_trace* trace = new pyca_trace;
+  trace->capacity = capacity;
+  trace->recs = recs;
+  for (uint64_t i=0; i<capacity; i++) {
+    trace->recs[i].seq.store(0, std::memory_order_relaxed);
+  }
+  trace->head.store(0, std::memory_order_relaxed);
+  trace->start.store(0, std::memory_order_relaxed);
+  trace->active.store(0, std::memory_order_relaxed);
+  return trace;
+}
+
+static inline uint32_t pyca_trace_tid()
+{
+  static __thread uint32_t tid = 0;
+  if (!tid) {
+#ifdef __linux__
+    tid = (uint32_t)syscall(SYS_gettid);
+#else
+    tid = (uint32_t)(uintptr_t)pthread_self();
+#endif
+  }
+  return tid;
+}
+
+static void pyca_trace_write(pyca_trace* trace, int kind, capv* pv, char phase)
+{
+  uint64_t n = trace->head.fetch_add(1, std::memory_order_relaxed);
+  pyca_trace_rec* rec = &trace->recs[n % trace->capacity];
+  rec->seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  rec->ts = now.tv_sec * 1000000000ULL + now.tv_nsec;
+  rec->name = pv ? pv->tracename : "";
+  rec->tid = pyca_trace_tid();
+  rec->kind = kind;
+  rec->phase = phase;
+  rec->seq.store(n + 1, std::memory_order_release);
+}
+
+// Record the beginning or end of a span of pv, if tracing
+static inline void pyca_trace_begin(int kind, capv* pv)
+{
+  pyca_trace* trace = pyca_tracer.load(std::memory_order_acquire);
+  if (trace && trace->active.load(std::memory_order_relaxed)) {
+    pyca_trace_write(trace, kind, pv, 'B');
+  }
+}
+
+static inline void pyca_trace_end(int kind, capv* pv)
+{
+  pyca_trace* trace = pyca_tracer.load(std::memory_order_acquire);
+  if (trace && trace->active.load(std::memory_order_relaxed)) {
+    pyca_trace_write(trace, kind, pv, 'E');
+  }
+}
+
+// Copy the complete records of the current trace, oldest first, into
+// recs of trace->capacity records. Returns how many were copied.
+static uint64_t pyca_trace_snapshot(pyca_trace* trace, pyca_trace_rec* recs)
+{
+  uint64_t head = trace->head.load(std::memory_order_acquire);
+  uint64_t first = trace->start.load(std::memory_order_relaxed);
+  if (head - first > trace->capacity) {
+    first = head - trace->capacity;
+  }
+  uint64_t copied = 0;
+  for (uint64_t n=first; n<head; n++) {
+    pyca_trace_rec* rec = &trace->recs[n % trace->capacity];
+    if (rec->seq.load(std::memory_order_acquire) != n + 1) {
+      continue;
+    }
+    pyca_trace_rec* dst = &recs[copied];
+    dst->ts = rec->ts;
+    dst->name = rec->name;
+    dst->tid = rec->tid;
+    dst->kind = rec->kind;
+    dst->phase = rec->phase;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (rec->seq.load(std::memory_order_relaxed) == n + 1) {
+      copied++;
+    }
+  }
+  return copied;
+}
+
+static void pyca_trace_json_string(FILE* file, const char* str)
+{
+  fputc('"', file);
+  for (const unsigned char* c=(const unsigned char*)str; *c; c++) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(file, "\\%c", *c);
+    } else if (*c < 0x20) {
+      fprintf(file, "\\u%04x", *c);
+    } else {
+      fputc(*c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+// Write n records in the Chrome trace event format. Returns 0, or -1
+// with errno set.
+static int pyca_trace_write_json(FILE* file, const pyca_trace_rec* recs, uint64_t n)
+{
+  int pid = getpid();
+  fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+  for (uint64_t i=0; i<n; i++) {
+    const pyca_trace_rec* rec = &recs[i];
+    fprintf(file, "{\"name\": \"%s\", \"cat\": \"pyca\", \"ph\": \"%c\", "
+            "\"ts\": %llu.%03llu, \"pid\": %d, \"tid\": %u, \"args\": {\"pv\": ",
+            pyca_trace_names[rec->kind], rec->phase,
+            (unsigned long long)(rec->ts / 1000), (unsigned long long)(rec->ts % 1000),
+            pid, rec->tid);
+    pyca_trace_json_string(file, rec->name);
+    fprintf(file, i + 1 < n ? "}},\n" : "}}\n");
+  }
+  fprintf(file, "]}\n");
+  return ferror(file) ? -1 : 0;
+}
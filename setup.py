@@ -14,6 +14,10 @@ def get_numpy_include_dirs():
 
 
 extra = []
+libraries = get_config_var('LDADD')
+if sys.platform.startswith('linux'):
+    # shm_open() and shm_unlink() of the shared memory publisher
+    libraries = libraries + ['rt']
 if sys.platform == 'linux2':
     extra += ['-v']
 elif platform.system() == 'Darwin':
@@ -35,7 +39,7 @@ pyca = Extension(
         'epicscorelibs.lib.ca',
         'epicscorelibs.lib.Com'
     ],
-    libraries=get_config_var('LDADD'),
+    libraries=libraries,
 )
 
 setup(
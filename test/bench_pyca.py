@@ -0,0 +1,254 @@
+"""
+Benchmarks of pyca, from the decoding of one event to whole scenarios
+against a channel access server.
+
+Run it as a script, it is not collected by pytest:
+
+    python test/bench_pyca.py --output bench.json
+
+The results are written as JSON, to compare them between builds:
+
+- micro: the cost of processing an event of every value type in DBR_TIME
+  and DBR_CTRL form, decoded or in record mode, and of converting a
+  value for a put from a numpy array or a list, for sizes from 1 to 1M
+  elements. These use the native pyca._bench_event and pyca._bench_put
+  hooks on an unconnected capv, so they time pyca alone.
+- e2e: monitor throughput in events/s, get and put latency percentiles
+  and the time to connect many PVs, against a pcaspy server started in
+  this process. With --no-server they run against PVs served by an IOC
+  instead: <prefix>:DOUBLE (ao), <prefix>:WAVE (waveform) and
+  <prefix>:STORM00000 ... for the connect storm (see --storm-name).
+"""
+import argparse
+import json
+import os
+import platform
+import sys
+import time
+
+import numpy as np
+
+import pyca
+
+prefix = "PYCA:BENCH"
+storm_name = "{prefix}:STORM{index:05d}"
+
+dbr_names = ("STRING", "SHORT", "FLOAT", "ENUM", "CHAR", "LONG", "DOUBLE")
+dbr_dtypes = (None, np.int16, np.float32, np.uint16, np.uint8, np.int32,
+              np.float64)
+DBR_TIME_STRING = 14
+DBR_CTRL_STRING = 28
+
+sizes = (1, 10, 100, 1000, 10000, 100000, 1000000)
+quick_sizes = (1, 10, 100, 1000, 10000)
+
+
+def timed(run, min_time):
+    """
+    Run run(iterations) with more iterations until it takes at least
+    min_time seconds. Returns the seconds per iteration.
+    """
+    iterations = 1
+    while True:
+        elapsed = run(iterations)
+        if elapsed >= min_time:
+            return elapsed / iterations
+        if elapsed <= 0:
+            iterations *= 10
+        else:
+            iterations = max(iterations + 1,
+                             int(iterations * 1.2 * min_time / elapsed))
+
+
+def micro_result(name, dbr_type, count, seconds):
+    return dict(name=name, dbr_type=dbr_names[dbr_type], count=count,
+                ns_per_call=seconds * 1e9,
+                ns_per_element=seconds * 1e9 / count)
+
+
+def bench_micro(args):
+    pv = pyca.capv(prefix + ":MICRO")
+    results = []
+    for count in (quick_sizes if args.quick else sizes):
+        for dbr_type in range(len(dbr_names)):
+            for name, base, record in (("event_time", DBR_TIME_STRING, False),
+                                       ("event_ctrl", DBR_CTRL_STRING, False),
+                                       ("event_record", DBR_TIME_STRING, True)):
+                pv.set_record(record)
+                seconds = timed(lambda n: pyca._bench_event(
+                    pv, base + dbr_type, count, n), args.min_time)
+                results.append(micro_result(name, dbr_type, count, seconds))
+            pv.set_record(False)
+            if dbr_type == 0:
+                values = (("put_list", ["%d" % i for i in range(count)]),)
+            else:
+                array = np.arange(count).astype(dbr_dtypes[dbr_type])
+                values = (("put_array", array), ("put_list", array.tolist()))
+            for name, value in values:
+                seconds = timed(lambda n: pyca._bench_put(
+                    pv, value, dbr_type, count, n), args.min_time)
+                results.append(micro_result(name, dbr_type, count, seconds))
+            pv.data = {}
+    return results
+
+
+def percentiles(samples):
+    samples = np.array(samples) * 1e6
+    result = dict(("p%g" % p, float(np.percentile(samples, p)))
+                  for p in (50, 90, 99, 99.9))
+    result.update(min=float(samples.min()), max=float(samples.max()),
+                  mean=float(samples.mean()), samples=len(samples))
+    return result
+
+
+def connect(name, timeout=5.0):
+    pv = pyca.capv(name)
+    pv.create_channel()
+    missing = pyca.wait_connected([pv], timeout)
+    if missing:
+        raise RuntimeError("Can't connect to " + name)
+    return pv
+
+
+def bench_monitor(name, duration, value):
+    """
+    Events/s received by a subscription while another channel puts as
+    fast as the server takes them
+    """
+    pv = connect(name)
+    writer = connect(name)
+    received = [0]
+
+    def monitor_cb(exception=None):
+        received[0] += 1
+    pv.monitor_cb = monitor_cb
+    pv.subscribe_channel(pyca.DBE_VALUE, False)
+    pyca.flush_io()
+    time.sleep(0.2)
+    received[0] = 0
+    sent = 0
+    start = time.perf_counter()
+    while time.perf_counter() - start < duration:
+        writer.put_data(value(sent), 1.0)
+        sent += 1
+    elapsed = time.perf_counter() - start
+    # Let the last updates arrive
+    time.sleep(0.2)
+    count = received[0]
+    pv.unsubscribe_channel()
+    pv.clear_channel()
+    writer.clear_channel()
+    return dict(puts=sent, events=count, seconds=elapsed,
+                events_per_second=count / elapsed)
+
+
+def bench_latency(name, samples):
+    pv = connect(name)
+    gets = []
+    puts = []
+    for i in range(samples):
+        start = time.perf_counter()
+        pv.get_data(False, 1.0)
+        gets.append(time.perf_counter() - start)
+        start = time.perf_counter()
+        pv.put_data(float(i), 1.0)
+        puts.append(time.perf_counter() - start)
+    pv.clear_channel()
+    return dict(get_us=percentiles(gets), put_us=percentiles(puts))
+
+
+def bench_connect_storm(count, timeout, pattern):
+    pvs = [pyca.capv(pattern.format(prefix=prefix, index=i))
+           for i in range(count)]
+    start = time.perf_counter()
+    errors = pyca.create_channels(pvs)
+    missing = pyca.wait_connected(pvs, timeout)
+    elapsed = time.perf_counter() - start
+    for pv, error in zip(pvs, errors):
+        if error is None:
+            pv.clear_channel()
+    pyca.flush_io()
+    return dict(pvs=count, connected=count - len(missing), seconds=elapsed)
+
+
+def start_server(args):
+    sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+    from conftest import TestServer
+    pvdb = dict(DOUBLE=dict(type="float"),
+                WAVE=dict(type="float", count=args.wave_size))
+    for i in range(args.storm):
+        name = storm_name.format(prefix=prefix, index=i)
+        pvdb[name[len(prefix) + 1:]] = dict(type="int")
+    server = TestServer(prefix, **pvdb)
+    server.start_server()
+    return server
+
+
+def bench_e2e(args):
+    wave = np.arange(args.wave_size, dtype=np.float64)
+    results = dict(
+        monitor_double=bench_monitor(prefix + ":DOUBLE", args.duration,
+                                     float),
+        monitor_wave=bench_monitor(prefix + ":WAVE", args.duration,
+                                   lambda i: wave + i),
+        latency_double=bench_latency(prefix + ":DOUBLE", args.samples))
+    if args.storm:
+        results["connect_storm"] = bench_connect_storm(
+            args.storm, args.storm_timeout, args.storm_name)
+    return results
+
+
+def main():
+    global prefix
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--output", help="JSON file, stdout by default")
+    parser.add_argument("--quick", action="store_true",
+                        help="sizes up to 10k elements only")
+    parser.add_argument("--min-time", type=float, default=0.05,
+                        help="seconds per microbenchmark")
+    parser.add_argument("--no-micro", action="store_true")
+    parser.add_argument("--no-e2e", action="store_true")
+    parser.add_argument("--no-server", action="store_true",
+                        help="use the PVs of a running IOC")
+    parser.add_argument("--prefix", default=prefix)
+    parser.add_argument("--duration", type=float, default=2.0,
+                        help="seconds of each monitor scenario")
+    parser.add_argument("--samples", type=int, default=1000,
+                        help="gets and puts of the latency scenario")
+    parser.add_argument("--wave-size", type=int, default=1000)
+    parser.add_argument("--storm", type=int, default=10000,
+                        help="PVs of the connect storm, 0 to skip it")
+    parser.add_argument("--storm-timeout", type=float, default=60.0)
+    parser.add_argument("--storm-name", default=storm_name,
+                        help="format of the PV names of the connect storm")
+    args = parser.parse_args()
+    prefix = args.prefix
+
+    results = dict(
+        meta=dict(time=time.strftime("%Y-%m-%dT%H:%M:%S%z"),
+                  python=platform.python_version(),
+                  numpy=np.__version__,
+                  machine=platform.machine(),
+                  system=platform.platform(),
+                  quick=args.quick,
+                  min_time=args.min_time))
+    pyca.set_numpy(True)
+    if not args.no_micro:
+        results["micro"] = bench_micro(args)
+    if not args.no_e2e:
+        server = None if args.no_server else start_server(args)
+        try:
+            results["e2e"] = bench_e2e(args)
+        finally:
+            if server is not None:
+                server.kill_server()
+    text = json.dumps(results, indent=1, sort_keys=True)
+    if args.output:
+        with open(args.output, "w") as output:
+            output.write(text + "\n")
+    else:
+        print(text)
+
+
+if __name__ == "__main__":
+    main()
@@ -15,6 +15,8 @@ pvdb = dict(
     WAVE=dict(type="int", count=10)
 )
 test_pvs = [pvbase + ":" + key for key in pvdb.keys()]
+# Served too, but only used by the tests of string arrays
+pvdb.update(SWAVE=dict(type="string", count=4))
 
 
 # We need a trivial subclass of Driver for pcaspy to work
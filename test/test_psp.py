@@ -99,6 +99,19 @@ def test_misc(server, pvname):
     pv.disconnect()
 
 
+@pytest.mark.timeout(10)
+def test_get_as_string(server):
+    pv = setup_pv(pvbase + ":ENUM")
+    value = pv.put(1)
+    assert pv.get() == value
+    assert pv.get(as_string=True) == pv.get_enum_set()[value]
+    # The strings are now cached, values are converted as they arrive
+    pv.get()
+    assert pv.data['enum_str'] == pv.enum_set[value]
+    assert pv.get(as_string=True) == pv.data['enum_str']
+    pv.disconnect()
+
+
 @pytest.mark.timeout(10)
 def test_waveform(server):
     logger.debug('test_waveform')
@@ -1,7 +1,13 @@
+import ctypes
 import logging
+import multiprocessing
+import os
+import struct
 import sys
 import threading
 import time
+import tracemalloc
+import weakref
 
 import numpy as np
 import pytest
@@ -189,6 +195,318 @@ def test_subscribe(server, pvname):
     pv.clear_channel()
 
 
+@pytest.mark.timeout(10)
+def test_cache_ctrl(server):
+    logger.debug('test_cache_ctrl')
+    pv = setup_pv(pvbase + ":DOUBLE")
+    ev = threading.Event()
+    values = []
+
+    def mon_cb(exception=None):
+        values.append(pv.data.get('value'))
+        if exception is None and 'value' in pv.data and 'units' in pv.data:
+            ev.set()
+    pv.monitor_cb = mon_cb
+    pv.subscribe_channel(pyca.DBE_VALUE, False, cache_ctrl=True)
+    assert ev.wait(timeout=1)
+    # Values come as DBR_TIME, control data from the DBE_PROPERTY events
+    for key in ('secs', 'nsec', 'precision', 'display_llim', 'ctrl_hlim'):
+        assert key in pv.data
+    new_value = pv.data['value'] + 1
+    ev.clear()
+    pv.put_data(new_value, 1.0)
+    assert ev.wait(timeout=1)
+    assert pv.data['value'] == new_value
+    # Control updates do not call the monitor callback
+    time.sleep(0.2)
+    assert values == [new_value - 1, new_value]
+    pv.unsubscribe_channel()
+    pv.clear_channel()
+
+
+@pytest.mark.timeout(10)
+@pytest.mark.skipif(sys.version_info < (3, 7), reason='needs asyncio.run')
+def test_async(server):
+    import asyncio
+    logger.debug('test_async')
+
+    async def run():
+        pvs = [setup_pv(pvbase + suffix) for suffix in (':LONG', ':DOUBLE')]
+        values = await asyncio.gather(*[pv.get_async() for pv in pvs])
+        assert values == [pv.data['value'] for pv in pvs]
+        pv = pvs[0]
+        await pv.put_async(values[0] + 1)
+        assert await pv.get_async() == values[0] + 1
+        updates = []
+        async for data in pv.monitor_async(pyca.DBE_VALUE):
+            updates.append(data['value'])
+            if len(updates) == 1:
+                await pv.put_async(values[0] + 2)
+            else:
+                pv.unsubscribe_channel()
+        assert updates == [values[0] + 1, values[0] + 2]
+        for pv in pvs:
+            pv.clear_channel()
+
+    asyncio.run(run())
+
+
+@pytest.mark.timeout(10)
+@pytest.mark.skipif(sys.version_info < (3, 7), reason='needs asyncio.run')
+def test_async_cleared(server):
+    import asyncio
+    logger.debug('test_async_cleared')
+
+    async def run():
+        pv = setup_pv(pvbase + ":LONG")
+        refs = sys.getrefcount(pv)
+        futures = [pv.get_async() for i in range(20)]
+        futures += [pv.put_async(i) for i in range(20)]
+        # Requests keep their PV alive
+        assert sys.getrefcount(pv) == refs + len(futures)
+        # Cleared before they were answered, they fail instead of
+        # waiting forever
+        pv.clear_channel()
+        done, pending = await asyncio.wait(futures, timeout=2)
+        assert not pending
+        for future in done:
+            assert future.exception() is None or \
+                isinstance(future.exception(), pyca.caexc)
+        del done, future, futures
+        assert sys.getrefcount(pv) == refs
+
+    asyncio.run(run())
+
+
+@pytest.mark.timeout(10)
+def test_event_fd(server):
+    import select
+    logger.debug('test_event_fd')
+    fd = pyca.event_fd()
+    try:
+        pv = setup_pv(pvbase + ":LONG", connect=False)
+        thread = threading.current_thread()
+        threads = []
+        pv.connect_cb = lambda isconn: threads.append(threading.current_thread())
+        pv.create_channel()
+        # Nothing runs until dispatched
+        assert select.select([fd], [], [], 1)[0] == [fd]
+        assert not threads
+        assert pyca.dispatch_pending() >= 1
+        assert threads == [thread]
+        pv.getevt_cb.reset()
+        pv.get_data(False, -1.0)
+        pyca.flush_io()
+        assert select.select([fd], [], [], 1)[0] == [fd]
+        assert not pv.getevt_cb.gev.is_set()
+        assert pyca.dispatch_pending() == 1
+        assert pv.getevt_cb.gev.is_set()
+        assert 'value' in pv.data
+        assert select.select([fd], [], [], 0)[0] == []
+        # Nothing runs for a PV cleared with events pending
+        getevt_cb = pv.getevt_cb
+        getevt_cb.reset()
+        pv.get_data(False, -1.0)
+        pyca.flush_io()
+        assert select.select([fd], [], [], 1)[0] == [fd]
+        pv.clear_channel()
+        del pv
+        assert pyca.dispatch_pending() == 0
+        assert not getevt_cb.gev.is_set()
+    finally:
+        pyca.event_fd(False)
+        pyca.dispatch_pending()
+
+
+@pytest.mark.timeout(10)
+def test_dispatcher(server):
+    logger.debug('test_dispatcher')
+    with pytest.raises(pyca.pyexc):
+        pyca.dispatcher_start(batch=0)
+    with pytest.raises(pyca.pyexc):
+        pyca.dispatcher_start(max_latency=-1.0)
+    pyca.dispatcher_start(batch=4, max_latency=0.5)
+    try:
+        assert pyca.dispatcher_stats()['running']
+        thread = threading.get_ident()
+        threads = []
+        errors = []
+        connected = threading.Event()
+        pvs = [setup_pv(pvbase + ":N%d" % i, connect=False) for i in range(8)]
+
+        def connect_cb(isconn):
+            threads.append(threading.get_ident())
+            try:
+                pyca.dispatcher_stop()
+            except pyca.pyexc:
+                errors.append(isconn)
+            if len(threads) == len(pvs):
+                connected.set()
+        for pv in pvs:
+            pv.connect_cb = connect_cb
+            pv.create_channel()
+        pyca.flush_io()
+        assert connected.wait(timeout=2)
+        # Not on this thread, and not one GIL acquisition per event
+        assert thread not in threads
+        assert len(set(threads)) == 1
+        assert len(errors) == len(pvs)
+        stats = pyca.dispatcher_stats()
+        assert stats['dispatched'] >= len(pvs)
+        assert stats['batches'] < stats['dispatched']
+        # Reconfigured while running
+        pyca.dispatcher_start(batch=1, max_latency=0.0)
+        assert pyca.dispatcher_stats()['batch'] == 1
+        # Callbacks can use channel access, the dispatcher is attached
+        # to the context
+        pv = pvs[0]
+        put_errors = []
+        got = threading.Event()
+
+        def put_cb(exception=None):
+            try:
+                pv.put_data(pv.data['value'] + 1, 1.0)
+            except pyca.caexc as exc:
+                put_errors.append(exc)
+            got.set()
+        pv.getevt_cb = put_cb
+        pv.get_data(False, -1.0)
+        pyca.flush_io()
+        assert got.wait(timeout=1)
+        value = pv.data['value']
+        assert put_errors == []
+        pv.get_data(False, 1.0)
+        assert pv.data['value'] == value + 1
+        # Nothing runs for a PV cleared while its events wait for a batch
+        pyca.dispatcher_start(batch=1000, max_latency=0.5)
+        other = pvs.pop()
+        cleared = []
+        other.getevt_cb = lambda exception=None: cleared.append(exception)
+        other.get_data(False, -1.0)
+        pyca.flush_io()
+        time.sleep(0.1)
+        assert pyca.dispatcher_stats()['pending'] == 1
+        other.clear_channel()
+        del other
+        time.sleep(0.6)
+        assert pyca.dispatcher_stats()['pending'] == 0
+        assert cleared == []
+    finally:
+        pyca.dispatcher_stop()
+    stats = pyca.dispatcher_stats()
+    assert not stats['running']
+    assert stats['pending'] == 0
+    # Back to the CA thread
+    pyca.dispatcher_stop()
+    got.clear()
+    callers = []
+
+    def get_cb(exception=None):
+        callers.append(threading.get_ident())
+        got.set()
+    pv.getevt_cb = get_cb
+    pv.get_data(False, -1.0)
+    pyca.flush_io()
+    assert got.wait(timeout=1)
+    assert callers[0] not in (thread, threads[0])
+    assert pyca.dispatcher_stats()['dispatched'] == stats['dispatched']
+    for pv in pvs:
+        pv.clear_channel()
+
+
+@pytest.mark.timeout(10)
+def test_poll_events(server):
+    logger.debug('test_poll_events')
+    pyca.set_event_queue(4, pyca.DROP_OLDEST)
+    pv = setup_pv(pvbase + ":LONG")
+    pv.subscribe_channel(pyca.DBE_VALUE, False, queued=True)
+    with pytest.raises(pyca.pyexc):
+        pyca.set_event_queue(8)
+    # The initial value
+    events = pyca.poll_events(100, 1.0)
+    assert len(events) == 1
+    evpv, data, exc = events[0]
+    assert evpv is pv
+    assert exc is None
+    assert data == pv.data
+    # Only the newest events are kept while nobody drains the queue
+    first = data['value'] + 1
+    for value in range(first, first + 10):
+        pv.put_data(value, 1.0)
+    values = []
+    while not values or values[-1] != first + 9:
+        events = pyca.poll_events(100, 1.0)
+        assert events
+        values += [data['value'] for _, data, _ in events]
+    assert values == sorted(values)
+    assert len(values) <= 4
+    stats = pyca.event_queue_stats()
+    assert stats['capacity'] == 4
+    assert stats['policy'] == pyca.DROP_OLDEST
+    assert stats['dropped'] + len(values) <= stats['queued']
+    assert pv.stats()['dropped'] == stats['dropped']
+    pv.clear_channel()
+    pyca.set_event_queue(1024)
+    assert pyca.poll_events(100) == []
+
+
+@pytest.mark.timeout(10)
+def test_poll_unsubscribed(server):
+    logger.debug('test_poll_unsubscribed')
+    pv = setup_pv(pvbase + ":LONG")
+    other = setup_pv(pvbase + ":DOUBLE")
+    pv.subscribe_channel(pyca.DBE_VALUE, False, queued=True)
+    other.subscribe_channel(pyca.DBE_VALUE, False, queued=True)
+    first = pv.data.get('value', 0) + 1
+    for value in range(first, first + 5):
+        pv.put_data(value, 1.0)
+    other.put_data(other.data.get('value', 0) + 1, 1.0)
+    time.sleep(0.5)
+    # Events left in the queue by an unsubscribed PV are not delivered
+    pv.unsubscribe_channel()
+    events = pyca.poll_events(100, 0.5)
+    assert events
+    assert all(evpv is other for evpv, _, _ in events)
+    pv.clear_channel()
+    other.clear_channel()
+    assert pyca.poll_events(100) == []
+
+
+@pytest.mark.timeout(10)
+def test_poll_conflated(server):
+    logger.debug('test_poll_conflated')
+    pvs = [setup_pv(pvbase + ":LONG"), setup_pv(pvbase + ":DOUBLE")]
+    for pv in pvs:
+        pv.subscribe_channel(pyca.DBE_VALUE, False, conflate=True)
+    events = []
+    while len(events) < len(pvs):
+        events += pyca.poll_events(100, 1.0)
+    assert sorted(pv.name for pv, _, _ in events) == sorted(pv.name for pv in pvs)
+    # Many updates, a single event per PV with the latest value
+    last = [pv.data['value'] + 10 for pv in pvs]
+    for i in range(10, 0, -1):
+        for pv, value in zip(pvs, last):
+            pv.put_data(value - i + 1, 1.0)
+    time.sleep(0.5)
+    events = pyca.poll_events(100, 1.0)
+    assert len(events) == len(pvs)
+    for (evpv, data, exc), pv, value in zip(events, pvs, last):
+        assert evpv is pv
+        assert exc is None
+        assert data['value'] == value
+    assert pyca.poll_events(100) == []
+    # Dirty PVs are forgotten when unsubscribed
+    for pv, value in zip(pvs, last):
+        pv.put_data(value + 1, 1.0)
+    time.sleep(0.5)
+    pvs[0].unsubscribe_channel()
+    events = pyca.poll_events(100, 1.0)
+    assert [evpv for evpv, _, _ in events] == pvs[1:]
+    for pv in pvs:
+        pv.clear_channel()
+    assert pyca.poll_events(100) == []
+
+
 @pytest.mark.timeout(10)
 @pytest.mark.parametrize('pvname', test_pvs)
 def test_misc(server, pvname):
@@ -202,6 +520,33 @@ def test_misc(server, pvname):
     pv.clear_channel()
 
 
+@pytest.mark.timeout(10)
+def test_enum_strings(server):
+    pv = setup_pv(pvbase + ":ENUM")
+    pv.put_data(2, 1.0)
+    pv.get_data(False, 1.0)
+    assert pv.data['enum_str'] is None
+    pv.get_enum_strings(1.0)
+    enum_set = pv.data['enum_set']
+    assert enum_set == ('zero', 'one', 'two', 'three')
+    # Cached: the same tuple again, and values converted on decode
+    del pv.data['enum_set']
+    pv.get_enum_strings(-1.0)
+    assert pv.data['enum_set'] is enum_set
+    # Asynchronous callers are called back, fetched or cached
+    other = setup_pv(pvbase + ":ENUM")
+    for i in range(2):
+        other.getevt_cb.reset()
+        other.get_enum_strings(-1.0)
+        pyca.flush_io()
+        assert other.getevt_cb.wait(timeout=1)
+        assert other.data['enum_set'] == enum_set
+    other.clear_channel()
+    pv.get_data(False, 1.0)
+    assert pv.enum_str == 'two'
+    pv.clear_channel()
+
+
 @pytest.mark.timeout(10)
 def test_waveform(server):
     logger.debug('test_waveform')
@@ -226,6 +571,751 @@ def test_waveform(server):
     pv.clear_channel()
 
 
+@pytest.mark.timeout(10)
+def test_string_waveform(server):
+    logger.debug('test_string_waveform')
+    pv = setup_pv(pvbase + ":SWAVE")
+    pv.use_numpy = True
+    values = ('zero', 'one', 'a longer string', 'x' * 39)
+    pv.put_data(values, 1.0)
+    pv.get_data(False, 1.0)
+    val = pv.data['value']
+    # Whole DBR strings, not zero sized items overrun by the copy
+    assert isinstance(val, np.ndarray)
+    assert val.dtype == np.dtype('S40')
+    assert [s.decode() for s in val] == list(values)
+    pv.clear_channel()
+
+
+@pytest.mark.timeout(10)
+def test_put_buffer(server):
+    logger.debug('test_put_buffer')
+    pv = setup_pv(pvbase + ":WAVE")
+    pv.use_numpy = True
+    pv.get_data(False, 1.0)
+    count = pv.count()
+    dtype = pv.data['value'].dtype
+    values = [
+        np.arange(count, dtype=dtype),           # sent as is
+        np.arange(count, dtype=np.float64) + 1,  # cast once
+        np.arange(2 * count, dtype=dtype)[::2],  # not contiguous
+        memoryview(np.arange(count, dtype=dtype) + 3),
+        list(range(4, count + 4)),
+        tuple(range(5, count + 5)),
+    ]
+    for value in values:
+        pv.put_data(value, 1.0)
+        pv.get_data(False, 1.0)
+        assert np.array_equal(pv.data['value'], np.asarray(value))
+    # Shorter values only set their elements
+    pv.put_data([7, 8], 1.0)
+    pv.get_data(False, 1.0)
+    assert list(pv.data['value'][:2]) == [7, 8]
+    with pytest.raises(pyca.pyexc):
+        pv.put_data(['a', 'b'], 1.0)
+    # Empty values are not sent
+    for value in ([], (), np.arange(0, dtype=dtype)):
+        with pytest.raises(pyca.pyexc):
+            pv.put_data(value, 1.0)
+    pv.get_data(False, 1.0)
+    assert list(pv.data['value'][:2]) == [7, 8]
+    string = setup_pv(pvbase + ":STRING")
+    with pytest.raises(pyca.pyexc):
+        string.put_data((), 1.0)
+    string.clear_channel()
+    pv.clear_channel()
+
+
+@pytest.mark.timeout(10)
+def test_buffer(server):
+    logger.debug('test_buffer')
+    pv = setup_pv(pvbase + ":WAVE")
+    count = pv.count()
+    # Events are only kept once enabled
+    pv.get_data(False, 1.0)
+    assert not pv.is_buffer()
+    with pytest.raises(BufferError):
+        memoryview(pv)
+    pv.set_buffer(True)
+    assert pv.is_buffer()
+    with pytest.raises(BufferError):
+        memoryview(pv)
+    pv.put_data(np.arange(count, dtype=np.int32), 1.0)
+    pv.get_data(False, 1.0)
+    generation = pv.generation
+    view = memoryview(pv)
+    assert view.readonly
+    assert view.format == 'i'
+    assert view.shape == (count,)
+    assert view.strides == (view.itemsize,)
+    arr = np.asarray(pv)
+    assert arr.tolist() == list(range(count))
+    # Exported values are not overwritten by later events
+    pv.put_data(np.arange(count, dtype=np.int32) + 1, 1.0)
+    pv.get_data(False, 1.0)
+    assert pv.generation == generation + 1
+    assert arr.tolist() == list(range(count))
+    assert view.tolist() == list(range(count))
+    assert np.asarray(pv).tolist() == list(range(1, count + 1))
+    # Disabled, views already taken stay valid
+    pv.set_buffer(False)
+    with pytest.raises(BufferError):
+        memoryview(pv)
+    assert view.tolist() == list(range(count))
+    view.release()
+    del arr
+    pv.clear_channel()
+
+
+@pytest.mark.timeout(10)
+def test_array_pool(server):
+    logger.debug('test_array_pool')
+    pv = setup_pv(pvbase + ":WAVE")
+    pv.use_numpy = True
+    pv.set_array_pool(2)
+    arrays = []
+    for i in range(3):
+        pv.get_data(False, 1.0)
+        arrays.append(pv.data['value'])
+    assert arrays[0] is arrays[2]
+    assert arrays[0] is not arrays[1]
+    # No reference left behind by each event
+    before = sys.getrefcount(arrays[1])
+    for i in range(2):
+        pv.get_data(False, 1.0)
+    after = sys.getrefcount(arrays[1])
+    assert after == before
+    # Filled in place
+    out = np.zeros(pv.count(), dtype=arrays[0].dtype)
+    pv.set_output_array(out)
+    pv.get_data(False, 1.0)
+    assert pv.data['value'] is out
+    assert list(out) == list(arrays[0])
+    # Falls back to a new array when it doesn't fit
+    pv.set_output_array(np.zeros(pv.count() + 1, dtype=out.dtype))
+    pv.get_data(False, 1.0)
+    assert len(pv.data['value']) == pv.count()
+    pv.set_array_pool(0)
+    pv.clear_channel()
+
+
+@pytest.mark.timeout(10)
+def test_array_unpooled(server):
+    logger.debug('test_array_unpooled')
+    pv = setup_pv(pvbase + ":WAVE")
+    pv.use_numpy = True
+    pv.set_array_pool(0)
+    pv.get_data(False, 1.0)
+    # Each replaced value is freed
+    refs = []
+    for i in range(100):
+        pv.get_data(False, 1.0)
+        refs.append(weakref.ref(pv.data['value']))
+    assert [ref() is None for ref in refs] == [True] * (len(refs) - 1) + [False]
+    # Nothing grows per event
+    tracemalloc.start()
+    try:
+        for i in range(50):
+            pv.get_data(False, 1.0)
+        before = tracemalloc.get_traced_memory()[0]
+        for i in range(500):
+            pv.get_data(False, 1.0)
+        after = tracemalloc.get_traced_memory()[0]
+    finally:
+        tracemalloc.stop()
+    assert after - before < 4096
+    pv.clear_channel()
+
+
+@pytest.mark.timeout(10)
+@pytest.mark.parametrize('pvname', [pvbase + ":DOUBLE", pvbase + ":WAVE"])
+def test_history(server, pvname):
+    logger.debug('test_history %s', pvname)
+    pv = setup_pv(pvname)
+    ev = threading.Event()
+
+    def mon_cb(exception=None):
+        ev.set()
+    pv.monitor_cb = mon_cb
+    pv.history_start(4)
+    pv.subscribe_channel(pyca.DBE_VALUE, False)
+    assert ev.wait(timeout=1)
+    hist = pv.history_get()
+    assert len(hist['value']) == 1
+    assert not hist['value'].flags.writeable
+    assert hist['secs'][0] == pv.data['secs']
+    first = hist['value'][0]
+    values = []
+    for i in range(1, 6):
+        ev.clear()
+        values.append(first + i)
+        pv.put_data(values[-1], 1.0)
+        assert ev.wait(timeout=1)
+    hist = pv.history_get()
+    assert hist['total'] == 6
+    assert len(hist['value']) == 4
+    assert hist['value'].tolist() == [v.tolist() for v in values[-4:]]
+    assert list(hist['secs']) == sorted(hist['secs'])
+    # The views of a partial history are not overwritten
+    pv.history_clear()
+    ev.clear()
+    pv.put_data(first, 1.0)
+    assert ev.wait(timeout=1)
+    view = pv.history_get()['value']
+    pv.history_clear()
+    ev.clear()
+    pv.put_data(first + 1, 1.0)
+    assert ev.wait(timeout=1)
+    assert view.tolist() == [first.tolist()]
+    pv.history_stop()
+    pv.clear_channel()
+
+
+@pytest.mark.timeout(10)
+@pytest.mark.parametrize('pvname', [pvbase + ":DOUBLE", pvbase + ":WAVE"])
+def test_accum(server, pvname):
+    logger.debug('test_accum %s', pvname)
+    pv = setup_pv(pvname)
+    ev = threading.Event()
+
+    def mon_cb(exception=None):
+        ev.set()
+    pv.monitor_cb = mon_cb
+    pv.accum_start()
+    assert pv.accum_get()['num'] == 0
+    pv.subscribe_channel(pyca.DBE_VALUE, False)
+    assert ev.wait(timeout=1)
+    pv.accum_reset()
+    first = np.array(pv.data['value'])
+    values = []
+    for i in (3, 1, 4, 1, 5):
+        ev.clear()
+        values.append(first + i)
+        pv.put_data(values[-1], 1.0)
+        assert ev.wait(timeout=1)
+    stats = pv.accum_get()
+    values = np.array(values)
+    assert stats['num'] == len(values)
+    assert np.allclose(stats['mean'], values.mean(axis=0))
+    assert np.allclose(stats['std'], values.std(axis=0))
+    assert np.allclose(stats['err'], values.std(axis=0) / np.sqrt(len(values)))
+    assert np.allclose(stats['min'], values.min(axis=0))
+    assert np.allclose(stats['max'], values.max(axis=0))
+    pv.accum_stop()
+    ev.clear()
+    pv.put_data(first, 1.0)
+    assert ev.wait(timeout=1)
+    assert pv.accum_get()['num'] == len(values)
+    pv.clear_channel()
+
+
+@pytest.mark.timeout(10)
+def test_latency(server):
+    logger.debug('test_latency')
+    pvs = [setup_pv(pvbase + ":DOUBLE"), setup_pv(pvbase + ":LONG")]
+    ev = threading.Event()
+
+    def mon_cb(exception=None):
+        ev.set()
+    with pytest.raises(pyca.pyexc):
+        pvs[0].latency_get()
+    for pv in pvs:
+        pv.monitor_cb = mon_cb
+        pv.latency_start()
+        ev.clear()
+        pv.subscribe_channel(pyca.DBE_VALUE, False)
+        assert ev.wait(timeout=1)
+    for i in range(5):
+        for pv in pvs:
+            ev.clear()
+            pv.put_data(i + 1, 1.0)
+            assert ev.wait(timeout=1)
+    total = pyca.histogram()
+    for pv in pvs:
+        latency = pv.latency_get()
+        for name in ('transport', 'delivery'):
+            hist = latency[name]
+            assert hist.count == 6
+            p50, p99 = hist.percentiles([50, 99])
+            assert hist.min <= p50 <= p99 <= hist.max < 1.0
+            assert hist.min <= hist.mean <= hist.max
+            assert sum(count for _, _, count in hist.buckets()) == 6
+        total.merge(latency['delivery'])
+    assert total.count == 12
+    assert total.max == max(pv.latency_get()['delivery'].max for pv in pvs)
+    with pytest.raises(pyca.pyexc):
+        total.percentile(101)
+    pvs[0].latency_stop()
+    ev.clear()
+    pvs[0].put_data(0, 1.0)
+    assert ev.wait(timeout=1)
+    assert pvs[0].latency_get()['delivery'].count == 6
+    pvs[0].latency_reset()
+    assert pvs[0].latency_get()['delivery'].count == 0
+    assert pvs[0].latency_get()['delivery'].percentile(50) is None
+    for pv in pvs:
+        pv.clear_channel()
+
+
+def shm_read_process(name, updates, results):
+    """
+    Reader of test_shm in another process: sends the head of the segment,
+    then the value of each of the next updates.
+    """
+    reader = pyca.shm_reader(name)
+    results.put(reader.head)
+    head = reader.head
+    for i in range(updates):
+        deadline = time.time() + 5
+        while reader.head == head and time.time() < deadline:
+            time.sleep(0.001)
+        head = reader.head
+        update = reader.get()
+        results.put(None if update is None else update['value'].tolist())
+
+
+def shm_publish_process(name):
+    """
+    Publisher of test_shm in another process, which exits without
+    stopping.
+    """
+    pv = setup_pv(pvbase + ":WAVE")
+    pv.shm_publish(name, slots=2)
+    os._exit(0)
+
+
+@pytest.mark.timeout(20)
+@pytest.mark.skipif(not sys.platform.startswith('linux'),
+                    reason='needs POSIX shared memory')
+def test_shm(server):
+    logger.debug('test_shm')
+    pv = setup_pv(pvbase + ":WAVE")
+    ev = threading.Event()
+
+    def mon_cb(exception=None):
+        ev.set()
+    pv.monitor_cb = mon_cb
+    name = 'pyca_test_%d' % os.getpid()
+    pv.shm_publish(name, slots=4)
+    try:
+        reader = pyca.shm_reader(name)
+        assert reader.head == 0
+        assert reader.get() is None
+        count = pv.count()
+        assert (reader.slots, reader.nelm) == (4, count)
+        pv.subscribe_channel(pyca.DBE_VALUE, False)
+        assert ev.wait(timeout=1)
+        for i in range(1, 6):
+            ev.clear()
+            pv.put_data(np.arange(count, dtype=np.int32) + i, 1.0)
+            assert ev.wait(timeout=1)
+        assert reader.head == 6
+        update = reader.get()
+        assert update['update'] == 6
+        assert update['value'].tolist() == list(range(5, count + 5))
+        assert update['secs'] == pv.data['secs']
+        assert not update['value'].flags.writeable
+        assert reader.valid(6)
+        assert reader.get(3)['value'].tolist() == list(range(2, count + 2))
+        # Update 2 was overwritten by update 6
+        assert reader.get(2) is None
+        copied = reader.get(3, copy=True)
+        ev.clear()
+        pv.put_data(np.arange(count, dtype=np.int32), 1.0)
+        assert ev.wait(timeout=1)
+        assert not reader.valid(3)
+        assert copied['value'].tolist() == list(range(2, count + 2))
+        # Updates are seen by a reader in another process
+        context = multiprocessing.get_context('spawn')
+        results = context.Queue()
+        child = context.Process(target=shm_read_process,
+                                args=(name, 2, results))
+        child.start()
+        try:
+            assert results.get(timeout=10) == reader.head
+            for i in range(2):
+                ev.clear()
+                pv.put_data(np.arange(count, dtype=np.int32) * (i + 2), 1.0)
+                assert ev.wait(timeout=1)
+                value = results.get(timeout=5)
+                assert value == list(range(0, count * (i + 2), i + 2))
+        finally:
+            child.join(timeout=5)
+        assert child.exitcode == 0
+        # The name of a live publisher can't be taken
+        other = setup_pv(pvbase + ":WAVE")
+        with pytest.raises(OSError):
+            other.shm_publish(name, slots=2)
+        # Once removed, another publisher of the name leaves the old
+        # segment alone, and stopping the old one leaves the new one
+        os.unlink('/dev/shm/' + name)
+        other.shm_publish(name, slots=2)
+        try:
+            assert pyca.shm_reader(name).head == 0
+            assert reader.head == 9
+            assert reader.get()['value'].tolist() == list(range(0, count * 3, 3))
+            pv.shm_stop()
+            assert pyca.shm_reader(name).slots == 2
+        finally:
+            other.shm_stop()
+            other.clear_channel()
+    finally:
+        pv.shm_stop()
+    with pytest.raises(OSError):
+        pyca.shm_reader(name)
+    # The name left by a publisher which exited is taken over
+    child = context.Process(target=shm_publish_process, args=(name,))
+    child.start()
+    child.join(timeout=10)
+    assert child.exitcode == 0
+    assert pyca.shm_reader(name).slots == 2
+    pv.shm_publish(name, slots=4)
+    assert pyca.shm_reader(name).slots == 4
+    pv.shm_stop()
+    pv.clear_channel()
+
+
+@pytest.mark.timeout(10)
+def test_recorder(server, tmp_path):
+    logger.debug('test_recorder')
+    pvs = [setup_pv(pvbase + ":WAVE"), setup_pv(pvbase + ":DOUBLE")]
+    ev = threading.Event()
+
+    def mon_cb(exception=None):
+        ev.set()
+    path = str(tmp_path / 'pvs.rec')
+    with pytest.raises(pyca.pyexc):
+        pyca.recorder(path, [pvs[1], pvs[1]])
+    # Small chunks, so that updates span several of them
+    recorder = pyca.recorder(path, pvs, chunk_size=256, flush_interval=0.01)
+    with pytest.raises(pyca.pyexc):
+        pyca.recorder(path + '2', pvs[:1])
+    count = pvs[0].count()
+    for pv in pvs:
+        pv.monitor_cb = mon_cb
+        ev.clear()
+        pv.subscribe_channel(pyca.DBE_VALUE, False)
+        assert ev.wait(timeout=1)
+    for i in range(10):
+        for pv in pvs:
+            ev.clear()
+            pv.put_data(np.arange(count, dtype=np.int32) + i
+                        if pv is pvs[0] else i * 0.5, 1.0)
+            assert ev.wait(timeout=1)
+    recorder.close()
+    stats = recorder.stats()
+    assert stats['recorded'] == 22
+    assert stats['dropped'] == 0
+    assert stats['chunks'] > 1
+    assert os.path.getsize(path) > stats['bytes']
+    recording = pyca.recording(path)
+    assert recording.names == (pvbase + ":WAVE", pvbase + ":DOUBLE")
+    wave = recording.get(pvbase + ":WAVE")
+    assert wave['value'].shape == (11, count)
+    assert wave['value'][1:, 0].tolist() == list(range(10))
+    assert set(wave['count']) == {count}
+    assert list(wave['secs']) == sorted(wave['secs'])
+    double = recording.get(1)
+    assert double['value'][1:].tolist() == [i * 0.5 for i in range(10)]
+    with pytest.raises(KeyError):
+        recording.get('nope')
+    # A damaged chunk ends the recording: an empty one, then a section
+    # out of its chunk
+    with open(path, 'rb') as f:
+        data = bytearray(f.read())
+    first = data.index(b'CHNK')
+    second = data.index(b'CHNK', first + 1)
+    # Chunk header: magic, npvs, size, then per PV: offset, count
+    in_first = struct.unpack_from('<I', data, first + 24)[0]
+    assert in_first > 0
+    for where, field, records in ((first + 8, 0, 0),
+                                  (second + 16, 1 << 40, in_first)):
+        damaged = bytearray(data)
+        struct.pack_into('<Q', damaged, where, field)
+        with open(path + '.bad', 'wb') as f:
+            f.write(damaged)
+        assert len(pyca.recording(path + '.bad').get(0)['value']) == records
+    # More PVs than the file can describe
+    damaged = bytearray(data)
+    struct.pack_into('<I', damaged, 12, 1 << 31)
+    with open(path + '.bad', 'wb') as f:
+        f.write(damaged)
+    with pytest.raises(OSError):
+        pyca.recording(path + '.bad')
+    for pv in pvs:
+        pv.clear_channel()
+
+
+@pytest.mark.timeout(10)
+def test_replay(server, tmp_path):
+    logger.debug('test_replay')
+    pvs = [setup_pv(pvbase + ":WAVE"), setup_pv(pvbase + ":DOUBLE")]
+    ev = threading.Event()
+
+    def mon_cb(exception=None):
+        ev.set()
+    path = str(tmp_path / 'pvs.rec')
+    recorder = pyca.recorder(path, pvs, chunk_size=256, flush_interval=0.01)
+    count = pvs[0].count()
+    for pv in pvs:
+        pv.monitor_cb = mon_cb
+        ev.clear()
+        pv.subscribe_channel(pyca.DBE_VALUE, False)
+        assert ev.wait(timeout=1)
+    for i in range(5):
+        ev.clear()
+        pvs[1].put_data(i * 0.5, 1.0)
+        assert ev.wait(timeout=1)
+    recorder.close()
+    for pv in pvs:
+        pv.clear_channel()
+    recording = pyca.recording(path)
+    wave = pyca.capv(pvbase + ":WAVE")
+    double = pyca.capv(pvbase + ":DOUBLE")
+    with pytest.raises(pyca.pyexc):
+        pyca.replayer(recording, [wave])
+    received = []
+    for pv in (wave, double):
+        pv.simulated = True
+        pv.monitor_cb = lambda exception=None, pv=pv: received.append(
+            (pv.name, pv.data['value']))
+    double.subscribe_channel(pyca.DBE_VALUE, False)
+    with pytest.raises(pyca.pyexc):
+        pyca.replayer(recording, [pyca.capv(pvbase + ":NOPE")])
+    # As fast as possible, the wave is not subscribed
+    replayer = pyca.replayer(recording, [wave, double], rate=0)
+    assert replayer.wait(5)
+    assert replayer.stats() == {'replayed': 6, 'skipped': 1}
+    assert [n for n, v in received] == [pvbase + ":DOUBLE"] * 6
+    assert [v for n, v in received] == recording.get(1)['value'].tolist()
+    # Paced, looping until stopped
+    del received[:]
+    wave.subscribe_channel(pyca.DBE_VALUE, False, 4)
+    replayer = pyca.replayer(recording, [wave, double], rate=1e3, loop=True)
+    assert not replayer.wait(0.2)
+    replayer.stop()
+    assert replayer.wait(0)
+    assert replayer.stats()['replayed'] > 7
+    waves = [v for n, v in received if n == wave.name]
+    assert waves and all(len(v) == min(count, 4) for v in waves)
+
+
+@pytest.mark.timeout(10)
+@pytest.mark.filterwarnings("ignore::pytest.PytestUnraisableExceptionWarning")
+def test_stats(server):
+    logger.debug('test_stats')
+    pv = setup_pv(pvbase + ":DOUBLE")
+    ev = threading.Event()
+    calls = []
+
+    def monitor_cb(exception=None):
+        calls.append(exception)
+        ev.set()
+        if len(calls) == 2:
+            raise RuntimeError('test_stats')
+    pv.monitor_cb = monitor_cb
+    pv.subscribe_channel(pyca.DBE_VALUE, False)
+    assert ev.wait(timeout=1)
+    for i in range(3):
+        ev.clear()
+        pv.put_data(i + 0.25, 1.0)
+        assert ev.wait(timeout=1)
+    stats = pv.stats()
+    assert stats['events'] == 4
+    assert stats['bytes'] >= 4 * 8
+    assert stats['decodes'] >= 4
+    # And connect_cb
+    assert stats['callbacks'] == 5
+    assert stats['callback_errors'] == 1
+    assert stats['gil_waits'] >= 4
+    assert stats['callback_ns'] > 0 and stats['decode_ns'] > 0
+    total = pyca.stats()
+    assert set(total) == set(stats)
+    assert all(total[key] >= stats[key] for key in stats)
+    assert pv.stats(reset=True) == stats
+    assert set(pv.stats().values()) == {0}
+    pyca.stats(reset=True)
+    assert pyca.stats()['events'] <= pv.stats()['events'] + 1
+    pv.clear_channel()
+
+
+@pytest.mark.timeout(10)
+def test_trace(server, tmp_path):
+    logger.debug('test_trace')
+    import json
+    pv = setup_pv(pvbase + ":DOUBLE")
+    ev = threading.Event()
+
+    def mon_cb(exception=None):
+        ev.set()
+    pv.monitor_cb = mon_cb
+    with pytest.raises(MemoryError):
+        pyca.trace_start(2 ** 62)
+    pyca.trace_start(1024)
+    with pytest.raises(pyca.pyexc):
+        pyca.trace_start(2048)
+    ev.clear()
+    pv.subscribe_channel(pyca.DBE_VALUE, False)
+    assert ev.wait(timeout=1)
+    for i in range(3):
+        ev.clear()
+        pv.put_data(i + 0.5, 1.0)
+        assert ev.wait(timeout=1)
+    pyca.trace_stop()
+    path = str(tmp_path / 'trace.json')
+    count = pyca.dump_trace(path)
+    with open(path) as f:
+        events = json.load(f)['traceEvents']
+    assert len(events) == count
+    names = set(event['name'] for event in events)
+    assert {'monitor', 'gil_wait', 'decode', 'callback'} <= names
+    assert all(event['args']['pv'] == pv.name for event in events)
+    assert all(event['ph'] in 'BE' for event in events)
+    monitors = [event for event in events if event['name'] == 'monitor']
+    # The last monitor span may end after trace_stop()
+    phases = [event['ph'] for event in monitors]
+    assert phases[:7] == ['B', 'E'] * 3 + ['B']
+    assert len(phases) in (7, 8)
+    assert [event['ts'] for event in events] == sorted(event['ts'] for event in events)
+    # Nothing is recorded once stopped, the trace is kept, and so are
+    # the names of the PVs gone since
+    pv.put_data(0.0, 1.0)
+    name = pv.name
+    pv.clear_channel()
+    del pv
+    assert pyca.dump_trace(path) == count
+    with open(path) as f:
+        events = json.load(f)['traceEvents']
+    assert all(event['args']['pv'] == name for event in events)
+    pyca.trace_start(1024)
+    assert pyca.dump_trace(path) == 0
+    pyca.trace_stop()
+
+
+@pytest.mark.timeout(10)
+def test_bench_hooks():
+    logger.debug('test_bench_hooks')
+    pv = pyca.capv(pvbase + ":BENCH")
+    pv.use_numpy = True
+    # DBR_TIME_STRING to DBR_TIME_DOUBLE
+    for dbr_type in range(14, 21):
+        assert pyca._bench_event(pv, dbr_type, 10, 3) >= 0
+        assert len(pv.data['value']) == 10
+    # String arrays hold whole DBR strings
+    pyca._bench_event(pv, 14, 10, 1)
+    assert pv.data['value'].dtype == np.dtype('S40')
+    assert pyca._bench_put(pv, np.arange(10.), 6, 10, 3) >= 0
+    assert pyca._bench_put(pv, ['a', 'b'], 0, 2, 3) >= 0
+    with pytest.raises(pyca.pyexc):
+        pyca._bench_event(pv, 7, 10, 1)
+
+
+@pytest.mark.timeout(10)
+@pytest.mark.parametrize('pvname', test_pvs)
+def test_record(server, pvname):
+    logger.debug('test_record %s', pvname)
+    pv = setup_pv(pvname)
+    pv.get_data(True, 1.0)
+    pv.get_data(False, 1.0)
+    expected = dict(pv.data)
+    pv.data = {}
+    pv.set_record(True)
+    assert pv.is_record()
+    pv.get_data(True, 1.0)
+    pv.get_data(False, 1.0)
+    # Fields come from the last event, or the dictionary
+    assert pv.status == expected['status']
+    assert pv.secs >= expected['secs']
+    if 'units' in expected:
+        assert pv.units == expected['units']
+    with pytest.raises(AttributeError):
+        pv.enum_set
+    value = pv.value
+    assert pv.value is value
+    data = pv.data
+    assert sorted(data.keys()) == sorted(expected.keys())
+    assert data['value'] is value
+    pv.set_record(False)
+    assert not pv.is_record()
+    pv.clear_channel()
+
+
+class ProcessorEvent(ctypes.Structure):
+    _fields_ = [('kind', ctypes.c_int), ('name', ctypes.c_char_p),
+                ('castatus', ctypes.c_int), ('dbr_type', ctypes.c_short),
+                ('count', ctypes.c_long), ('dbr', ctypes.c_void_p),
+                ('value', ctypes.c_void_p), ('size', ctypes.c_ulong),
+                ('status', ctypes.c_int), ('severity', ctypes.c_int),
+                ('secs', ctypes.c_uint), ('nsec', ctypes.c_uint)]
+
+
+ProcessFn = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.POINTER(ProcessorEvent),
+                             ctypes.c_void_p)
+
+
+class Processor(ctypes.Structure):
+    _fields_ = [('version', ctypes.c_int), ('flags', ctypes.c_int),
+                ('process', ProcessFn), ('context', ctypes.c_void_p)]
+
+
+@pytest.mark.timeout(10)
+def test_processor(server):
+    logger.debug('test_processor')
+    pv = setup_pv(pvbase + ":LONG")
+    events = []
+    ev = threading.Event()
+
+    def process(event, context):
+        event = event.contents
+        value = ctypes.cast(event.value, ctypes.POINTER(ctypes.c_int32))[0]
+        events.append((event.kind, event.name, event.dbr_type, event.count,
+                       value, event.secs, context))
+        ev.set()
+        return 1  # consume monitor events
+    process_fn = ProcessFn(process)
+    proc = Processor(2, 0, process_fn, 42)
+    capsule_new = ctypes.pythonapi.PyCapsule_New
+    capsule_new.restype = ctypes.py_object
+    capsule_new.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_void_p]
+    capsule = capsule_new(ctypes.addressof(proc), b'pyca.processor_v2', None)
+    pv.processor = capsule
+    assert pv.processor is capsule
+    monitored = []
+    pv.monitor_cb = lambda exception=None: monitored.append(exception)
+    pv.subscribe_channel(pyca.DBE_VALUE, False)
+    assert ev.wait(timeout=1)
+    ev.clear()
+    pv.put_data(7, 1.0)
+    assert ev.wait(timeout=1)
+    kind, name, dbr_type, count, value, secs, context = events[-1]
+    assert (kind, name, count, value, context) == (
+        0, (pvbase + ":LONG").encode(), 1, 7, 42)
+    assert dbr_type == 19  # DBR_TIME_LONG
+    assert secs != 0
+    # Consumed monitor events never reach Python
+    assert monitored == []
+    pv.getevt_cb.reset()
+    pv.get_data(False, -1.0)
+    pyca.flush_io()
+    assert pv.getevt_cb.wait(timeout=1)
+    assert events[-1][0] == 1
+    assert pv.value == 7
+    # Without a processor, events go back to the decoding path
+    pv.processor = None
+    assert pv.processor is None
+    ev.clear()
+    pv.put_data(8, 1.0)
+    time.sleep(0.1)
+    assert not ev.is_set()
+    assert monitored
+    # Processors of another version are refused
+    old = Processor(1, 0, process_fn, 0)
+    bad = capsule_new(ctypes.addressof(old), b'pyca.processor_v2', None)
+    with pytest.raises(ValueError):
+        pv.processor = bad
+    pv.clear_channel()
+
+
 @pytest.mark.timeout(10)
 def test_threads(server):
     logger.debug('test_threads')
@@ -243,3 +1333,97 @@ def test_threads(server):
     thread = threading.Thread(target=some_thread_thing, args=(pvname,))
     thread.start()
     thread.join()
+
+
+@pytest.mark.timeout(10)
+def test_create_channels(server):
+    logger.debug('test_create_channels')
+    # No connect_cb: connections are tracked natively
+    pvs = [pyca.capv(pvname) for pvname in test_pvs]
+    assert pyca.wait_connected(pvs, 0.0) == list(test_pvs)
+    assert pyca.create_channels(pvs) == [None] * len(pvs)
+    assert pyca.wait_connected(pvs, 5.0) == []
+    # Existing channels are left alone
+    assert pyca.create_channels(pvs) == [None] * len(pvs)
+    pvs[0].clear_channel()
+    assert pyca.wait_connected(pvs, 0.0) == [test_pvs[0]]
+    for pv in pvs[1:]:
+        pv.clear_channel()
+
+
+@pytest.mark.timeout(10)
+def test_get_many(server):
+    logger.debug('test_get_many')
+    pvs = [setup_pv(pvname) for pvname in test_pvs]
+    unconnected = setup_pv(pvbase + ":LONG", connect=False)
+    errors = pyca.get_many(pvs + [unconnected], False, 1.0)
+    assert errors[:-1] == [None] * len(pvs)
+    assert isinstance(errors[-1], str)
+    for pv in pvs:
+        assert pv.data['value'] is not None
+    wave = setup_pv(pvbase + ":WAVE")
+    assert pyca.get_many([wave], control=False, timeout=1.0, count=2) == [None]
+    assert len(wave.data['value']) == 2
+    for pv in pvs + [wave]:
+        pv.clear_channel()
+
+
+@pytest.mark.timeout(10)
+@pytest.mark.parametrize('wait_complete', [False, True])
+def test_put_many(server, wait_complete):
+    logger.debug('test_put_many wait_complete=%s', wait_complete)
+    pvs = [setup_pv(pvbase + ":LONG"), setup_pv(pvbase + ":DOUBLE")]
+    assert pyca.get_many(pvs, False, 1.0) == [None, None]
+    new_values = [pv.data['value'] + 1 for pv in pvs]
+    errors = pyca.put_many(pvs, new_values, 1.0, wait_complete=wait_complete)
+    assert errors == [None, None]
+    assert pyca.get_many(pvs, False, 1.0) == [None, None]
+    assert [pv.data['value'] for pv in pvs] == new_values
+    for pv in pvs:
+        pv.clear_channel()
+
+
+@pytest.mark.timeout(10)
+@pytest.mark.parametrize('pvname', test_pvs)
+def test_sync_callback(server, pvname):
+    logger.debug('test_sync_callback %s', pvname)
+    pv = setup_pv(pvname)
+    pv.sync_callback = True
+    pv.get_data(False, 1.0)
+    old_value = pv.data['value']
+    pv_type = type(old_value)
+    if pv_type in (int, long, float):
+        new_value = old_value + 1
+    elif pv_type == str:
+        new_value = "putsync"
+    elif pv_type == tuple:
+        new_value = tuple([2] * len(old_value))
+    pv.put_data(new_value, 1.0)
+    pv.get_data(True, 1.0)
+    assert pv.data['value'] == new_value
+    pv.clear_channel()
+
+
+@pytest.mark.timeout(10)
+def test_sync_callback_threads(server):
+    logger.debug('test_sync_callback_threads')
+    errors = []
+
+    def getter(pvname):
+        pyca.attach_context()
+        pv = setup_pv(pvname)
+        pv.sync_callback = True
+        try:
+            for _ in range(20):
+                pv.get_data(False, 1.0)
+        except Exception as exc:
+            errors.append(exc)
+        pv.clear_channel()
+
+    threads = [threading.Thread(target=getter, args=(pvname,))
+               for pvname in test_pvs * 4]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    assert not errors